@@ -0,0 +1,202 @@
+#include "../include/pipeline.hpp"
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <vector>
+#include <chrono>
+#include <random>
+
+// Compares the fused pipelines used by ProcessingServer with the same stage
+// chain run as separate passes over materialized std::string tokens, and the
+// tokenizer with the istringstream >> word loop it replaced.
+
+namespace {
+
+std::string runUnfused(const PipelineConfig& config, std::string_view text) {
+	std::vector<std::string> tokens;
+	forEachWord(text, config.unicodeWhitespace, [&](std::string_view word) {
+		tokens.emplace_back(word);
+	});
+
+	if (config.stages & PIPELINE_LOWERCASE) {
+		std::vector<std::string> lowered;
+		std::string folded;
+		for (const auto& token : tokens) {
+			foldCase(token, folded);
+			lowered.push_back(folded);
+		}
+		tokens.swap(lowered);
+	}
+	if (config.stages & PIPELINE_STOP_WORDS) {
+		std::vector<std::string> kept;
+		for (const auto& token : tokens) {
+			if (config.stopWords.find(token) == config.stopWords.end()) {
+				kept.push_back(token);
+			}
+		}
+		tokens.swap(kept);
+	}
+	if (config.stages & PIPELINE_DEDUP) {
+		std::vector<std::string> unique;
+		std::unordered_set<std::string> seen;
+		for (const auto& token : tokens) {
+			if (seen.insert(token).second) {
+				unique.push_back(token);
+			}
+		}
+		tokens.swap(unique);
+	}
+	if ((config.stages & PIPELINE_TRUNCATE) && tokens.size() > config.truncateLimit) {
+		tokens.resize(config.truncateLimit);
+	}
+
+	std::string result;
+	for (const auto& token : tokens) {
+		if (!result.empty()) {
+			result += ' ';
+		}
+		result += token;
+	}
+	return result;
+}
+
+template<typename Function>
+double measure(const std::vector<std::string>& messages, size_t tokenCount, Function function) {
+	const int ROUNDS = 20;
+	size_t checksum = 0;
+	auto started = std::chrono::steady_clock::now();
+	for (int round = 0; round < ROUNDS; round++) {
+		for (const auto& message : messages) {
+			checksum += function(message).size();
+		}
+	}
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+	if (checksum == 0) {
+		std::cerr << "Empty output" << std::endl;
+	}
+	return seconds * 1e9 / (static_cast<double>(tokenCount) * ROUNDS);
+}
+
+}
+
+int main() {
+	const char* vocabulary[] = {
+		"The", "quick", "brown", "fox", "jumps", "over", "the", "lazy", "dog", "and",
+		"a", "Server", "client", "display", "message", "of", "to", "in", "processing", "Words"
+	};
+
+	std::mt19937 random(42);
+	std::vector<std::string> messages(2000);
+	size_t tokenCount = 0;
+	for (auto& message : messages) {
+		for (int i = 0; i < 200; i++) {
+			message += vocabulary[random() % 20];
+			message += std::to_string(random() % 50);
+			message += ' ';
+			tokenCount++;
+		}
+	}
+
+	// Tokenizing only: every word's length is summed so no path can skip
+	// the words. The ASCII fast path must keep up with operator>>.
+	double streamTokens = measure(messages, tokenCount, [](const std::string& message) {
+		std::istringstream stream(message);
+		std::string word;
+		size_t letters = 0;
+		while (stream >> word) {
+			letters += word.size();
+		}
+		return std::string(letters % 7 + 1, 'x');
+	});
+	double asciiTokens = measure(messages, tokenCount, [](const std::string& message) {
+		size_t letters = 0;
+		forEachWord(message, false, [&](std::string_view word) { letters += word.size(); });
+		return std::string(letters % 7 + 1, 'x');
+	});
+	double unicodeTokens = measure(messages, tokenCount, [](const std::string& message) {
+		size_t letters = 0;
+		forEachWord(message, true, [&](std::string_view word) { letters += word.size(); });
+		return std::string(letters % 7 + 1, 'x');
+	});
+
+	std::cout << std::left << std::setw(32) << "tokenizer" << std::right << std::setw(14) << "ns/tok" << std::endl;
+	std::cout << std::fixed << std::setprecision(1)
+		<< std::left << std::setw(32) << "istringstream >> word" << std::right << std::setw(14) << streamTokens << std::endl
+		<< std::left << std::setw(32) << "forEachWord ascii" << std::right << std::setw(14) << asciiTokens << std::endl
+		<< std::left << std::setw(32) << "forEachWord unicode" << std::right << std::setw(14) << unicodeTokens << std::endl
+		<< std::endl;
+	if (asciiTokens > streamTokens || unicodeTokens > streamTokens) {
+		std::cerr << "ASCII tokenizing is slower than operator>>" << std::endl;
+		return 1;
+	}
+
+	struct Scenario {
+		const char* name;
+		unsigned stages;
+	};
+	const Scenario scenarios[] = {
+		{ "dedup", PIPELINE_DEDUP },
+		{ "lowercase+dedup", PIPELINE_LOWERCASE | PIPELINE_DEDUP },
+		{ "lowercase+stop+dedup+truncate", PIPELINE_LOWERCASE | PIPELINE_STOP_WORDS | PIPELINE_DEDUP | PIPELINE_TRUNCATE },
+	};
+
+	std::cout << std::left << std::setw(32) << "pipeline" << std::right
+		<< std::setw(14) << "fused ns/tok" << std::setw(16) << "unfused ns/tok" << std::endl;
+
+	for (const auto& scenario : scenarios) {
+		PipelineConfig config;
+		config.stages = scenario.stages;
+		config.stopWords = { "the0", "a1", "and2", "of3", "to4", "in5" };
+		config.truncateLimit = 100;
+
+		double fused = measure(messages, tokenCount, [&](const std::string& message) {
+			return runPipeline(config, message);
+		});
+		double unfused = measure(messages, tokenCount, [&](const std::string& message) {
+			return runUnfused(config, message);
+		});
+
+		std::cout << std::left << std::setw(32) << scenario.name << std::right << std::fixed
+			<< std::setprecision(1) << std::setw(14) << fused << std::setw(16) << unfused << std::endl;
+	}
+
+	// One large document with a vocabulary big enough that the dedup set
+	// outgrows the cache, serial against the partitioned parallel dedup.
+	std::string document;
+	std::vector<std::string> large = { std::string() };
+	size_t documentTokens = 0;
+	while (document.size() < (8u << 20)) {
+		document += vocabulary[random() % 20];
+		document += std::to_string(random() % 200000);
+		document += ' ';
+		documentTokens++;
+	}
+	large[0].swap(document);
+
+	std::cout << std::endl << std::left << std::setw(32) << "8 MiB document" << std::right
+		<< std::setw(14) << "serial ns/tok" << std::setw(16) << "parallel ns/tok" << std::endl;
+
+	for (const auto& scenario : scenarios) {
+		PipelineConfig serial;
+		serial.stages = scenario.stages;
+		serial.stopWords = { "the0", "a1", "and2", "of3", "to4", "in5" };
+		serial.truncateLimit = 1000000;
+		serial.parallelThreshold = 0;
+
+		if (runPipeline(serial, large[0]) != runParallelDedupPipeline(serial, large[0])) {
+			std::cerr << "Parallel dedup output differs for " << scenario.name << std::endl;
+			return 1;
+		}
+
+		double sequential = measure(large, documentTokens, [&](const std::string& message) {
+			return runPipeline(serial, message);
+		});
+		double parallel = measure(large, documentTokens, [&](const std::string& message) {
+			return runParallelDedupPipeline(serial, message);
+		});
+
+		std::cout << std::left << std::setw(32) << scenario.name << std::right << std::fixed
+			<< std::setprecision(1) << std::setw(14) << sequential << std::setw(16) << parallel << std::endl;
+	}
+	return 0;
+}
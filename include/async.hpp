@@ -0,0 +1,493 @@
+#pragma once
+
+#include "protocol.hpp"
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <utility>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <chrono>
+#include <atomic>
+#include <unordered_map>
+#include <unordered_set>
+#include <type_traits>
+#include <cstdint>
+
+#ifndef _WIN32
+#include <sys/socket.h>
+#endif
+
+template<typename T>
+class Task;
+
+namespace detail {
+
+struct TaskPromiseBase {
+	std::coroutine_handle<> continuation;
+	std::exception_ptr error;
+
+	struct FinalAwaiter {
+		bool await_ready() const noexcept { return false; }
+
+		template<typename Promise>
+		std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> handle) noexcept {
+			std::coroutine_handle<> continuation = handle.promise().continuation;
+			return continuation ? continuation : std::noop_coroutine();
+		}
+
+		void await_resume() const noexcept {}
+	};
+
+	std::suspend_always initial_suspend() const noexcept { return {}; }
+	FinalAwaiter final_suspend() const noexcept { return {}; }
+	void unhandled_exception() noexcept { error = std::current_exception(); }
+};
+
+template<typename T>
+struct TaskPromise : TaskPromiseBase {
+	std::optional<T> value;
+
+	Task<T> get_return_object() noexcept;
+	void return_value(T result) { value.emplace(std::move(result)); }
+
+	T result() {
+		if (error) {
+			std::rethrow_exception(error);
+		}
+		return std::move(*value);
+	}
+};
+
+template<>
+struct TaskPromise<void> : TaskPromiseBase {
+	Task<void> get_return_object() noexcept;
+	void return_void() const noexcept {}
+
+	void result() {
+		if (error) {
+			std::rethrow_exception(error);
+		}
+	}
+};
+
+}
+
+// Lazily started coroutine. The body runs when the task is awaited and the
+// awaiting coroutine is resumed by symmetric transfer once it finishes.
+template<typename T = void>
+class Task {
+public:
+	using promise_type = detail::TaskPromise<T>;
+
+	Task() noexcept : handle(nullptr) {}
+	explicit Task(std::coroutine_handle<promise_type> handle) noexcept : handle(handle) {}
+	Task(Task&& other) noexcept : handle(std::exchange(other.handle, nullptr)) {}
+	Task(const Task&) = delete;
+	Task& operator=(const Task&) = delete;
+
+	Task& operator=(Task&& other) noexcept {
+		if (this != &other) {
+			if (handle) {
+				handle.destroy();
+			}
+			handle = std::exchange(other.handle, nullptr);
+		}
+		return *this;
+	}
+
+	~Task() {
+		if (handle) {
+			handle.destroy();
+		}
+	}
+
+	bool await_ready() const noexcept { return !handle || handle.done(); }
+
+	std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept {
+		handle.promise().continuation = awaiting;
+		return handle;
+	}
+
+	T await_resume() { return handle.promise().result(); }
+
+private:
+	std::coroutine_handle<promise_type> handle;
+};
+
+namespace detail {
+
+template<typename T>
+Task<T> TaskPromise<T>::get_return_object() noexcept {
+	return Task<T>(std::coroutine_handle<TaskPromise<T>>::from_promise(*this));
+}
+
+inline Task<void> TaskPromise<void>::get_return_object() noexcept {
+	return Task<void>(std::coroutine_handle<TaskPromise<void>>::from_promise(*this));
+}
+
+}
+
+
+namespace detail {
+
+// Starts at once and stays suspended at the end, so whoever waits for it
+// destroys the frame only after it has signalled completion.
+struct BlockingTask {
+	struct promise_type {
+		std::mutex mutex;
+		std::condition_variable finished;
+		bool done = false;
+
+		struct FinalAwaiter {
+			bool await_ready() const noexcept { return false; }
+
+			void await_suspend(std::coroutine_handle<promise_type> handle) const noexcept {
+				promise_type& promise = handle.promise();
+				std::lock_guard<std::mutex> lock(promise.mutex);
+				promise.done = true;
+				promise.finished.notify_all();
+			}
+
+			void await_resume() const noexcept {}
+		};
+
+		BlockingTask get_return_object() noexcept {
+			return BlockingTask(std::coroutine_handle<promise_type>::from_promise(*this));
+		}
+		std::suspend_never initial_suspend() const noexcept { return {}; }
+		FinalAwaiter final_suspend() const noexcept { return {}; }
+		void return_void() const noexcept {}
+		void unhandled_exception() const noexcept { std::terminate(); }
+	};
+
+	explicit BlockingTask(std::coroutine_handle<promise_type> handle) : handle(handle) {}
+	BlockingTask(const BlockingTask&) = delete;
+	BlockingTask& operator=(const BlockingTask&) = delete;
+	~BlockingTask() { handle.destroy(); }
+
+	void wait() {
+		promise_type& promise = handle.promise();
+		std::unique_lock<std::mutex> lock(promise.mutex);
+		promise.finished.wait(lock, [&promise]() { return promise.done; });
+	}
+
+	std::coroutine_handle<promise_type> handle;
+};
+
+}
+
+// Runs a task on the calling thread and blocks until it has finished, also
+// when it suspends and is resumed elsewhere.
+template<typename T>
+T runBlocking(Task<T> task) {
+	std::optional<std::conditional_t<std::is_void_v<T>, bool, T>> result;
+	std::exception_ptr error;
+
+	detail::BlockingTask runner = [](Task<T>& task, auto& result, std::exception_ptr& error) -> detail::BlockingTask {
+		try {
+			if constexpr (std::is_void_v<T>) {
+				co_await task;
+				result.emplace(true);
+			} else {
+				result.emplace(co_await task);
+			}
+		}
+		catch (...) {
+			error = std::current_exception();
+		}
+	}(task, result, error);
+	runner.wait();
+
+	if (error) {
+		std::rethrow_exception(error);
+	}
+	if constexpr (!std::is_void_v<T>) {
+		return std::move(*result);
+	}
+}
+
+// Mutex that coroutines can wait for without blocking their thread, shared
+// with threads that simply block in lock(). Ownership passes to waiters in
+// arrival order.
+class AsyncMutex {
+public:
+	// Held lock, released when the guard is destroyed.
+	class Guard {
+	public:
+		Guard() noexcept : mutex(nullptr) {}
+		explicit Guard(AsyncMutex* mutex) noexcept : mutex(mutex) {}
+		Guard(Guard&& other) noexcept : mutex(std::exchange(other.mutex, nullptr)) {}
+		Guard(const Guard&) = delete;
+		Guard& operator=(const Guard&) = delete;
+
+		Guard& operator=(Guard&& other) noexcept {
+			if (this != &other) {
+				release();
+				mutex = std::exchange(other.mutex, nullptr);
+			}
+			return *this;
+		}
+
+		~Guard() { release(); }
+
+		void release() {
+			if (mutex) {
+				std::exchange(mutex, nullptr)->unlock();
+			}
+		}
+
+	private:
+		AsyncMutex* mutex;
+	};
+
+	AsyncMutex() : locked(false), owner(0), nextTicket(1) {}
+	AsyncMutex(const AsyncMutex&) = delete;
+	AsyncMutex& operator=(const AsyncMutex&) = delete;
+
+	// Blocks the calling thread until the lock is held.
+	Guard lock();
+
+	// Takes the lock and returns 0 if it is free. Otherwise queues the
+	// caller and returns its ticket: wake is called, from the unlocking
+	// thread, once the lock has been handed over to that ticket.
+	uint64_t lockOrQueue(std::function<void()> wake);
+	// Withdraws a ticket whose owner will never resume, unlocking if the
+	// lock was already handed over to it.
+	void abandon(uint64_t ticket);
+	void unlock();
+
+private:
+	struct Waiter {
+		uint64_t ticket;
+		std::function<void()> wake;
+	};
+
+	std::mutex stateMutex;
+	bool locked;
+	// Ticket the lock was last handed to, 0 when taken directly.
+	uint64_t owner;
+	uint64_t nextTicket;
+	std::deque<Waiter> waiters;
+
+	void handOver();
+};
+
+#ifndef _WIN32
+
+// Single-threaded executor over epoll. Coroutines suspend on socket readiness
+// or timers and are resumed from run(); other threads hand work over through
+// spawn(), schedule() and post(), which wake the loop with an eventfd.
+class EventLoop {
+public:
+	EventLoop();
+	// Destroys the spawned tasks that are still suspended, which runs the
+	// destructors of their locals. The loop must no longer be running.
+	~EventLoop();
+
+	void run();
+	void stop();
+
+	// Starts a task detached from the caller. Safe to call from any thread,
+	// the task begins executing on the loop thread.
+	void spawn(Task<void> task);
+	// Resumes a suspended coroutine on the loop thread. Safe to call from
+	// any thread.
+	void post(std::coroutine_handle<> handle);
+
+	class ScheduleAwaiter {
+	public:
+		explicit ScheduleAwaiter(EventLoop& loop) : loop(loop) {}
+		bool await_ready() const noexcept { return false; }
+		void await_suspend(std::coroutine_handle<> handle) { loop.post(handle); }
+		void await_resume() const noexcept {}
+	private:
+		EventLoop& loop;
+	};
+
+	class ReadinessAwaiter {
+	public:
+		ReadinessAwaiter(EventLoop& loop, int fd, bool writing) : loop(loop), fd(fd), writing(writing) {}
+		bool await_ready() const noexcept { return false; }
+		void await_suspend(std::coroutine_handle<> handle) { loop.waitFor(fd, writing, handle); }
+		void await_resume() const noexcept {}
+	private:
+		EventLoop& loop;
+		int fd;
+		bool writing;
+	};
+
+	class TimerAwaiter {
+	public:
+		TimerAwaiter(EventLoop& loop, std::chrono::steady_clock::duration delay) : loop(loop), delay(delay) {}
+		bool await_ready() const noexcept { return delay.count() <= 0; }
+		void await_suspend(std::coroutine_handle<> handle) {
+			loop.timers.emplace(std::chrono::steady_clock::now() + delay, handle);
+		}
+		void await_resume() const noexcept {}
+	private:
+		EventLoop& loop;
+		std::chrono::steady_clock::duration delay;
+	};
+
+	ScheduleAwaiter schedule() { return ScheduleAwaiter(*this); }
+	ReadinessAwaiter readable(int fd) { return ReadinessAwaiter(*this, fd, false); }
+	ReadinessAwaiter writable(int fd) { return ReadinessAwaiter(*this, fd, true); }
+	// Only from the loop thread.
+	TimerAwaiter sleepFor(std::chrono::steady_clock::duration delay) { return TimerAwaiter(*this, delay); }
+
+	// Must be called before a watched descriptor is closed.
+	void forget(int fd);
+
+	// Runs the loop on the calling thread until the task completes.
+	template<typename T>
+	T runUntilComplete(Task<T> task);
+
+private:
+	struct Waiters {
+		std::coroutine_handle<> reader;
+		std::coroutine_handle<> writer;
+	};
+
+	// Frame of a spawned task, registered with the loop while it lives.
+	struct DetachedTask;
+
+	int epollFd;
+	int wakeFd;
+	std::atomic<bool> stopRequested;
+	std::mutex queueMutex;
+	std::deque<std::coroutine_handle<>> readyQueue;
+	std::unordered_map<int, Waiters> waiters;
+	std::multimap<std::chrono::steady_clock::time_point, std::coroutine_handle<>> timers;
+	std::mutex tasksMutex;
+	std::unordered_set<void*> liveTasks;
+
+	static DetachedTask runDetached(EventLoop& loop, Task<void> task);
+
+	void waitFor(int fd, bool writing, std::coroutine_handle<> handle);
+	void drainReadyQueue();
+	// Milliseconds until the first timer is due, -1 without timers.
+	int timerTimeout() const;
+	void resumeDueTimers();
+};
+
+template<typename T>
+T EventLoop::runUntilComplete(Task<T> task) {
+	std::optional<std::conditional_t<std::is_void_v<T>, bool, T>> result;
+	std::exception_ptr error;
+
+	spawn([](EventLoop& loop, Task<T> task, auto& result, std::exception_ptr& error) -> Task<void> {
+		try {
+			if constexpr (std::is_void_v<T>) {
+				co_await task;
+				result.emplace(true);
+			} else {
+				result.emplace(co_await task);
+			}
+		}
+		catch (...) {
+			error = std::current_exception();
+		}
+		loop.stop();
+	}(*this, std::move(task), result, error));
+
+	run();
+	if (error) {
+		std::rethrow_exception(error);
+	}
+	if constexpr (!std::is_void_v<T>) {
+		return std::move(*result);
+	}
+}
+
+// Non-blocking socket helpers. They try the operation first and only
+// suspend on the loop when the kernel reports EAGAIN.
+bool setNonBlocking(int socket);
+Task<bool> asyncConnect(EventLoop& loop, int socket, const sockaddr* address, socklen_t length);
+Task<int> asyncAccept(EventLoop& loop, int socket);
+Task<bool> asyncReceiveExact(EventLoop& loop, int socket, char* buffer, size_t length);
+Task<bool> asyncDiscard(EventLoop& loop, int socket, size_t length);
+Task<bool> asyncSendAll(EventLoop& loop, int socket, const char* data, size_t length);
+Task<bool> asyncSendVector(EventLoop& loop, int socket, const std::vector<FrameSlice>& slices);
+
+// Waits for an AsyncMutex without blocking the loop thread.
+Task<AsyncMutex::Guard> asyncLock(EventLoop& loop, AsyncMutex& mutex);
+
+// Suspends until attempt(wake) returns true. When it returns false it must
+// arrange for wake to be called, from any thread, once trying again may
+// succeed; cancel() withdraws that if the waiting task is destroyed first.
+template<typename Attempt, typename Cancel>
+class RetryAwaiter {
+public:
+	RetryAwaiter(EventLoop& loop, Attempt& attempt, Cancel& cancel)
+		: loop(loop), attempt(attempt), cancel(cancel), succeeded(false), waiting(false) {}
+	RetryAwaiter(const RetryAwaiter&) = delete;
+	RetryAwaiter& operator=(const RetryAwaiter&) = delete;
+
+	~RetryAwaiter() {
+		if (waiting) {
+			cancel();
+		}
+	}
+
+	bool await_ready() const noexcept { return false; }
+
+	bool await_suspend(std::coroutine_handle<> handle) {
+		EventLoop* target = &loop;
+		succeeded = attempt([target, handle]() { target->post(handle); });
+		waiting = !succeeded;
+		return waiting;
+	}
+
+	bool await_resume() noexcept {
+		waiting = false;
+		return succeeded;
+	}
+
+private:
+	EventLoop& loop;
+	Attempt& attempt;
+	Cancel& cancel;
+	bool succeeded;
+	bool waiting;
+};
+
+template<typename Attempt, typename Cancel>
+Task<void> asyncRetry(EventLoop& loop, Attempt attempt, Cancel cancel) {
+	for (;;) {
+		RetryAwaiter<Attempt, Cancel> awaiter(loop, attempt, cancel);
+		bool succeeded = co_await awaiter;
+		if (succeeded) {
+			co_return;
+		}
+	}
+}
+
+// Awaitable counterpart of Client. One send() may be outstanding per client;
+// concurrency comes from running many clients on the same loop. Client is
+// not built on top of it because it also runs on Windows, which has no
+// EventLoop; both write frames with transport::appendFrame and read the same
+// acks.
+class AsyncClient {
+public:
+	AsyncClient(EventLoop& loop, const std::string& serverHost, int serverPort);
+	~AsyncClient();
+
+	Task<bool> connect();
+	Task<bool> send(std::string_view message);
+	void disconnect();
+
+private:
+	EventLoop& loop;
+	std::string serverHost;
+	int serverPort;
+	int clientSocket;
+};
+
+#endif
@@ -1,5 +1,15 @@
+#pragma once
+
 #include <string>
+#include <string_view>
+#include <vector>
+#include <span>
 #include <atomic>
+#include <optional>
+#include <cstdio>
+#include "protocol.hpp"
+#include "transport.hpp"
+#include "trace.hpp"
 
 class Client {
 public:
@@ -8,19 +18,53 @@ public:
 
 	bool connectToServer();
 	void run();
+	bool runInput(const std::string& inputPath);
 	void disconnect();
 	bool sendData(const std::string& data);
+	bool sendBatch(std::span<const std::string_view> messages);
 	bool receiveAcknowledgement();
+	void setTraceSampleRate(double rate);
+	// Sent as an options frame (e.g. "passthrough=1") on every connect.
+	void setConnectionOptions(const std::string& options);
 
 private:
 	std::string serverHost;
 	int serverPort;
 	std::atomic<bool> isRunning;
 	int clientSocket;
+	TraceSampler traceSampler;
+	std::string connectionOptions;
+	// Ack already read by sendData() and not yet reported through
+	// receiveAcknowledgement().
+	std::optional<bool> unreadAcknowledgement;
+
+	struct InputStats {
+		size_t lines;
+		size_t bytes;
+		size_t skipped;
+		size_t rejected;
+	};
+
+	bool sendInputFile(const std::string& path, InputStats& stats);
+	bool sendInputStream(FILE* stream, InputStats& stats);
+	bool queueInputLines(const char* data, size_t length, bool endOfInput, size_t& consumed,
+		std::vector<std::string_view>& pending, InputStats& stats);
+	bool flushInputLines(std::vector<std::string_view>& pending, InputStats& stats);
+
+	struct BatchAck {
+		BatchAckStatus status;
+		uint32_t delivered;
+		// Batch indices of the messages the server rejected, in order.
+		std::vector<uint32_t> dropped;
+	};
 
-	int createTCPSocket();
-	bool connectTCPSocket(int socket, const std::string& host, int port);
-	int sendTCPData(int socket, const char* data, size_t length);
-	int receiveTCPData(int socket, char* buffer, size_t length);
-	void closeTCPSocket(int socket);
+	// Sends messages in pipelined batches of up to MAX_BATCH_MESSAGES and
+	// stores each batch's ack. No batch is sent after one the display server
+	// did not get. False only if the connection failed.
+	bool transmitBatches(std::span<const std::string_view> messages, std::vector<BatchAck>& acknowledged);
+	bool sendBatchFrames(std::span<const std::string_view> messages, size_t first, size_t count,
+		std::vector<uint64_t>& traceIds);
+	bool receiveBatchAcknowledgement(size_t batchSize, BatchAck& ack);
+	bool readAcknowledgement();
+	bool sendConnectionOptions();
 };
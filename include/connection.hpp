@@ -0,0 +1,90 @@
+#pragma once
+
+#include "async.hpp"
+#include "relay.hpp"
+#include "scheduler.hpp"
+#include "protocol.hpp"
+#include "transport.hpp"
+#include <vector>
+#include <chrono>
+#include <cstddef>
+
+// A client connection as seen by ProcessingServer's protocol, which is
+// written once as coroutines over these operations. BlockingConnection
+// completes each of them on the calling thread; LoopConnection suspends on an
+// event loop instead, so that one loop thread serves many clients.
+class Connection {
+public:
+	explicit Connection(int clientSocket) : clientSocket(clientSocket) {}
+	virtual ~Connection() = default;
+
+	Connection(const Connection&) = delete;
+	Connection& operator=(const Connection&) = delete;
+
+	int socket() const { return clientSocket; }
+
+	// Client socket I/O, as in transport.
+	virtual Task<bool> receiveExact(char* buffer, size_t length) = 0;
+	virtual Task<bool> discard(size_t length) = 0;
+	virtual Task<bool> sendAll(const char* data, size_t length) = 0;
+	// transport::receiveFrameHeader over receiveExact.
+	Task<bool> receiveFrameHeader(transport::FrameHeader& header);
+	// Moves length payload bytes from the client into relay.
+	virtual Task<bool> fillRelay(SpliceRelay& relay, size_t length) = 0;
+
+	// Writes to a socket shared with other connections (the display link),
+	// which the caller holds a lock for.
+	virtual Task<bool> sendVectorTo(int socket, const std::vector<FrameSlice>& slices) = 0;
+	virtual Task<bool> drainRelayTo(SpliceRelay& relay, int socket) = 0;
+
+	virtual Task<AsyncMutex::Guard> lock(AsyncMutex& mutex) = 0;
+	virtual Task<void> sleepFor(std::chrono::milliseconds delay) = 0;
+
+	// Queues a job for the session's scheduler, waiting while the queue is
+	// full, or runs it inline without one.
+	virtual Task<void> submit(SchedulerSession& session, size_t cost, FairScheduler::Job job) = 0;
+	// Waits until the session's queued jobs have run.
+	virtual Task<void> drain(SchedulerSession& session) = 0;
+
+protected:
+	int clientSocket;
+};
+
+class BlockingConnection : public Connection {
+public:
+	explicit BlockingConnection(int clientSocket) : Connection(clientSocket) {}
+
+	Task<bool> receiveExact(char* buffer, size_t length) override;
+	Task<bool> discard(size_t length) override;
+	Task<bool> sendAll(const char* data, size_t length) override;
+	Task<bool> fillRelay(SpliceRelay& relay, size_t length) override;
+	Task<bool> sendVectorTo(int socket, const std::vector<FrameSlice>& slices) override;
+	Task<bool> drainRelayTo(SpliceRelay& relay, int socket) override;
+	Task<AsyncMutex::Guard> lock(AsyncMutex& mutex) override;
+	Task<void> sleepFor(std::chrono::milliseconds delay) override;
+	Task<void> submit(SchedulerSession& session, size_t cost, FairScheduler::Job job) override;
+	Task<void> drain(SchedulerSession& session) override;
+};
+
+#ifndef _WIN32
+// The client socket must be non-blocking. Scheduled jobs still reply from a
+// worker thread through a BlockingConnection on the same socket.
+class LoopConnection : public Connection {
+public:
+	LoopConnection(EventLoop& loop, int clientSocket) : Connection(clientSocket), loop(loop) {}
+
+	Task<bool> receiveExact(char* buffer, size_t length) override;
+	Task<bool> discard(size_t length) override;
+	Task<bool> sendAll(const char* data, size_t length) override;
+	Task<bool> fillRelay(SpliceRelay& relay, size_t length) override;
+	Task<bool> sendVectorTo(int socket, const std::vector<FrameSlice>& slices) override;
+	Task<bool> drainRelayTo(SpliceRelay& relay, int socket) override;
+	Task<AsyncMutex::Guard> lock(AsyncMutex& mutex) override;
+	Task<void> sleepFor(std::chrono::milliseconds delay) override;
+	Task<void> submit(SchedulerSession& session, size_t cost, FairScheduler::Job job) override;
+	Task<void> drain(SchedulerSession& session) override;
+
+private:
+	EventLoop& loop;
+};
+#endif
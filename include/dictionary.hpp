@@ -0,0 +1,78 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <atomic>
+#include <memory>
+#include <cstdint>
+#include <cstddef>
+
+// Dictionary-encoded frames (FRAME_FLAG_DICTIONARY) carry a sequence of
+// varint tokens instead of text:
+//   0, <length>, <bytes>  defines the next word id and emits the word
+//   1, <length>, <bytes>  emits a literal word when the dictionary is full
+//   id + 2                emits a previously defined word
+// Words are joined with single spaces on decode. The dictionary lives for
+// the duration of one processing -> display connection.
+const uint32_t DICTIONARY_TOKEN_DEFINE = 0;
+const uint32_t DICTIONARY_TOKEN_LITERAL = 1;
+const uint32_t DICTIONARY_FIRST_ID_TOKEN = 2;
+const size_t DEFAULT_DICTIONARY_CAPACITY = 1 << 16;
+
+void appendVarint(std::string& out, uint32_t value);
+bool readVarint(const char*& data, const char* end, uint32_t& value);
+
+// Sender side of the dictionary; not thread-safe, callers serialize access
+// together with the socket it encodes for. Words defined by encode() are
+// staged until commit(), once the frames carrying them have been sent;
+// rollback() forgets them after a failed send, so that later frames never
+// use ids the receiver has not seen.
+class WordEncoder {
+public:
+	explicit WordEncoder(size_t capacity = DEFAULT_DICTIONARY_CAPACITY);
+
+	void encode(std::string_view text, std::string& out);
+	void commit();
+	void rollback();
+	void reset();
+	size_t size() const { return ids.size(); }
+
+private:
+	struct StringHash {
+		using is_transparent = void;
+		size_t operator()(std::string_view value) const { return std::hash<std::string_view>()(value); }
+	};
+
+	size_t capacity;
+	std::unordered_map<std::string, uint32_t, StringHash, std::equal_to<>> ids;
+	// Ids below this were sent; ids are handed out in order.
+	size_t committed;
+};
+
+// Receiver side of the dictionary. Only the connection thread appends, any
+// thread may look words up without locking: entries are written before the
+// published size is released and are never modified afterwards.
+class WordTable {
+public:
+	explicit WordTable(size_t capacity = DEFAULT_DICTIONARY_CAPACITY);
+	~WordTable();
+
+	WordTable(const WordTable&) = delete;
+	WordTable& operator=(const WordTable&) = delete;
+
+	bool add(std::string_view word);
+	bool lookup(uint32_t id, std::string_view& word) const;
+	size_t size() const { return count.load(std::memory_order_acquire); }
+
+	// Decodes one dictionary-encoded payload, defining new words on the way.
+	bool decode(const char* data, size_t length, std::string& out);
+
+private:
+	static const size_t CHUNK_BITS = 10;
+	static const size_t CHUNK_SIZE = size_t(1) << CHUNK_BITS;
+
+	size_t capacity;
+	std::unique_ptr<std::atomic<std::string*>[]> chunks;
+	std::atomic<size_t> count;
+};
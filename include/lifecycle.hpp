@@ -0,0 +1,48 @@
+#pragma once
+
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <random>
+
+// Invoked by a server once it accepts connections, with the port it is
+// actually bound to (useful when it was asked to bind port 0).
+using ReadyCallback = std::function<void(int port)>;
+
+// One-shot readiness signal for components started in the same process.
+class ReadinessLatch {
+public:
+	ReadinessLatch();
+
+	void signal(int port);
+	bool waitFor(std::chrono::milliseconds timeout);
+	int port() const;
+
+private:
+	mutable std::mutex mutex;
+	std::condition_variable ready;
+	bool signaled;
+	int readyPort;
+};
+
+// Exponential restart delay with equal jitter: each delay is drawn from the
+// upper half of the current window so that crashed peers do not restart in
+// lockstep.
+class Backoff {
+public:
+	Backoff(std::chrono::milliseconds initial, std::chrono::milliseconds maximum);
+
+	std::chrono::milliseconds next();
+	void reset();
+
+private:
+	std::chrono::milliseconds initial;
+	std::chrono::milliseconds maximum;
+	std::chrono::milliseconds current;
+	std::mt19937 random;
+};
+
+// Tells a service manager that the process is ready, sd_notify style: sends
+// "READY=1" to the datagram socket named by $NOTIFY_SOCKET when it is set.
+bool notifyServiceManager(const char* state);
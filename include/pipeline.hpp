@@ -0,0 +1,146 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <utility>
+#include <unordered_set>
+#include <cstddef>
+#include "utf8.hpp"
+
+// Token transforms applied by ProcessingServer::processData(). Each stage is
+// called once per token, may rewrite it in place and returns false to drop
+// it. Pipeline<...> folds its stages into a single pass over the words, so a
+// chain costs one tokenization and no intermediate containers.
+
+struct LowercaseStage {
+	std::string folded;
+
+	bool operator()(std::string& token) {
+		foldCase(token, folded);
+		token.swap(folded);
+		return true;
+	}
+};
+
+struct StopWordStage {
+	const std::unordered_set<std::string>* stopWords;
+
+	explicit StopWordStage(const std::unordered_set<std::string>* stopWords) : stopWords(stopWords) {}
+
+	bool operator()(std::string& token) const {
+		return stopWords == nullptr || stopWords->find(token) == stopWords->end();
+	}
+};
+
+struct DedupStage {
+	std::unordered_set<std::string> seen;
+
+	bool operator()(std::string& token) {
+		return seen.insert(token).second;
+	}
+};
+
+struct TruncateStage {
+	size_t limit;
+	size_t count = 0;
+
+	explicit TruncateStage(size_t limit) : limit(limit) {}
+
+	bool operator()(std::string&) {
+		return count++ < limit;
+	}
+};
+
+// Compiles to an always-true stage when disabled, which the fold in
+// Pipeline::apply() then drops entirely.
+template<bool Enabled, typename Stage>
+struct OptionalStage {
+	Stage stage;
+
+	explicit OptionalStage(Stage stage) : stage(std::move(stage)) {}
+	bool operator()(std::string& token) { return stage(token); }
+};
+
+template<typename Stage>
+struct OptionalStage<false, Stage> {
+	explicit OptionalStage(const Stage&) {}
+	bool operator()(std::string&) const { return true; }
+};
+
+template<typename... Stages>
+class Pipeline {
+public:
+	explicit Pipeline(Stages... stages) : stages(std::move(stages)...) {}
+
+	bool apply(std::string& token) {
+		return std::apply([&token](auto&... stage) { return (stage(token) && ...); }, stages);
+	}
+
+	std::string run(std::string_view text, bool unicodeWhitespace) {
+		std::string result;
+		std::string token;
+		forEachWord(text, unicodeWhitespace, [&](std::string_view word) {
+			token.assign(word.data(), word.size());
+			if (apply(token)) {
+				if (!result.empty()) {
+					result += ' ';
+				}
+				result += token;
+			}
+		});
+		return result;
+	}
+
+private:
+	std::tuple<Stages...> stages;
+};
+
+// Runtime selection of a stage chain. Stages always run in the order
+// lowercase -> stop words -> dedup -> truncate; every combination is
+// instantiated as its own fused pipeline and picked through a table.
+const unsigned PIPELINE_LOWERCASE = 1u << 0;
+const unsigned PIPELINE_STOP_WORDS = 1u << 1;
+const unsigned PIPELINE_DEDUP = 1u << 2;
+const unsigned PIPELINE_TRUNCATE = 1u << 3;
+const unsigned PIPELINE_STAGE_COMBINATIONS = 1u << 4;
+
+// Texts of at least this many bytes are deduplicated on several threads.
+// Wire messages never get that long (MAX_MESSAGE_LENGTH), so this serves
+// in-process callers of runPipeline with whole documents.
+const size_t PARALLEL_DEDUP_THRESHOLD = 1 << 20;
+
+struct PipelineConfig {
+	unsigned stages = PIPELINE_DEDUP;
+	bool unicodeWhitespace = false;
+	std::unordered_set<std::string> stopWords;
+	size_t truncateLimit = 0;
+	// 0 keeps every message on the calling thread.
+	size_t parallelThreshold = PARALLEL_DEDUP_THRESHOLD;
+	// 0 uses one thread per hardware thread.
+	size_t parallelThreads = 0;
+};
+
+template<unsigned Mask>
+std::string runFusedPipeline(const PipelineConfig& config, std::string_view text) {
+	Pipeline<
+		OptionalStage<(Mask & PIPELINE_LOWERCASE) != 0, LowercaseStage>,
+		OptionalStage<(Mask & PIPELINE_STOP_WORDS) != 0, StopWordStage>,
+		OptionalStage<(Mask & PIPELINE_DEDUP) != 0, DedupStage>,
+		OptionalStage<(Mask & PIPELINE_TRUNCATE) != 0, TruncateStage>> pipeline(
+			OptionalStage<(Mask & PIPELINE_LOWERCASE) != 0, LowercaseStage>(LowercaseStage()),
+			OptionalStage<(Mask & PIPELINE_STOP_WORDS) != 0, StopWordStage>(StopWordStage(&config.stopWords)),
+			OptionalStage<(Mask & PIPELINE_DEDUP) != 0, DedupStage>(DedupStage()),
+			OptionalStage<(Mask & PIPELINE_TRUNCATE) != 0, TruncateStage>(TruncateStage(config.truncateLimit)));
+	return pipeline.run(text, config.unicodeWhitespace);
+}
+
+std::string runPipeline(const PipelineConfig& config, std::string_view text);
+
+// Same output as runFusedPipeline, for pipelines with PIPELINE_DEDUP. The
+// text is cut at whitespace into one chunk per thread; every thread
+// tokenizes and dedups its chunk into a local set, then every thread owns
+// one hash partition of the words and keeps the earliest occurrence of each
+// by scanning the chunks in order. Falls back to the serial pipeline when
+// the text is too short to split.
+std::string runParallelDedupPipeline(const PipelineConfig& config, std::string_view text);
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+// Every frame starts with a 4-byte length word in network byte order.
+// The high bits of that word are reserved for control flags, the rest
+// carries the payload length.
+//
+// A batch header carries the message count in its length bits and is
+// followed by that many regular frames. ProcessingServer delivers the
+// messages in order and answers the whole batch with a single batch-ack:
+// "BA", a BatchAckStatus byte and the number of messages delivered as a
+// 4-byte network order count.
+//   BATCH_DELIVERED    every message was delivered
+//   BATCH_INVALID      the messages that failed validation were dropped and
+//                      the others delivered; the ack goes on with the batch
+//                      index of every dropped message, 4 bytes each
+//   BATCH_UNDELIVERED  the display server could not be reached; the first
+//                      <count> valid messages were delivered, none after
+const uint32_t FRAME_FLAG_BATCH = 0x80000000u;
+const uint32_t FRAME_FLAG_DICTIONARY = 0x40000000u;
+// Set on a message frame whose length word is followed by an 8-byte trace
+// id in network byte order; the payload length does not include it.
+const uint32_t FRAME_FLAG_TRACE = 0x20000000u;
+// Connection options frame: the payload is "key=value" pairs separated by
+// spaces or commas (e.g. "passthrough=1"). Answered with "OK" or "NO".
+const uint32_t FRAME_FLAG_OPTIONS = 0x10000000u;
+const uint32_t FRAME_LENGTH_MASK = 0x0FFFFFFFu;
+
+// Message and options frames are answered with "OK" or "NO".
+const char ACK_POSITIVE[2] = { 'O', 'K' };
+const char ACK_NEGATIVE[2] = { 'N', 'O' };
+const size_t ACK_SIZE = 2;
+
+inline bool isPositiveAcknowledgement(const char* ack) {
+	return ack[0] == ACK_POSITIVE[0] && ack[1] == ACK_POSITIVE[1];
+}
+
+// Largest payload ProcessingServer accepts in a single message frame.
+const size_t MAX_MESSAGE_LENGTH = 4095;
+
+const size_t MAX_BATCH_MESSAGES = 500;
+enum BatchAckStatus : uint8_t {
+	BATCH_DELIVERED,
+	BATCH_INVALID,
+	BATCH_UNDELIVERED
+};
+const char BATCH_ACK_TAG[2] = { 'B', 'A' };
+// Without the indices that follow a BATCH_INVALID ack.
+const size_t BATCH_ACK_SIZE = 7;
+
+// One contiguous piece of a scatter-gather write.
+struct FrameSlice {
+	const char* data;
+	size_t length;
+};
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <vector>
+#include <cstddef>
+
+#ifdef _WIN32
+using ssize_t = int;
+#else
+#include <sys/types.h>
+#endif
+
+// Relays frames from one socket to another through a kernel pipe with
+// splice(2), so payload bytes never enter user space. Frame headers are
+// appended to the pipe by the caller, payloads are pulled in with fill() and
+// the assembled frames go out with a single drainTo(). Where splice is not
+// available, or the pipe runs out of slots before drainTo(), the remaining
+// bytes are copied through a buffer that is sent after the pipe contents.
+class SpliceRelay {
+public:
+	SpliceRelay();
+	~SpliceRelay();
+	SpliceRelay(const SpliceRelay&) = delete;
+	SpliceRelay& operator=(const SpliceRelay&) = delete;
+
+	bool isZeroCopy() const;
+	size_t buffered() const;
+	// Bytes that can be buffered before drainTo() must be called.
+	size_t capacity() const;
+
+	// Adds a few bytes (a frame header) from user space.
+	bool append(const char* data, size_t length);
+
+	// Moves up to length bytes from socket into the relay. Returns the
+	// number of bytes moved, 0 at end of stream and -1 on error (errno is
+	// EAGAIN when a non-blocking socket has nothing to read).
+	ssize_t fill(int socket, size_t length);
+
+	// Writes everything buffered to socket, waiting for it if it is
+	// non-blocking. A peer that has gone away fails the write without
+	// raising SIGPIPE.
+	bool drainTo(int socket);
+	// Writes what a non-blocking socket takes without waiting, false on
+	// errors. Everything is out once buffered() is 0.
+	bool drainSome(int socket);
+
+	// Drops buffered bytes, e.g. after a failed drainTo().
+	void reset();
+
+private:
+	int pipeFds[2];
+	size_t pending;
+	size_t pipeCapacity;
+	// Set once the pipe is full (or splice failed) until the next drain, so
+	// that later bytes queue up behind the ones already in the pipe.
+	bool overflowing;
+	bool spliceUnsupported;
+	std::vector<char> copyBuffer;
+	// Bytes of copyBuffer already sent by drainSome().
+	size_t copySent;
+
+	bool openPipe();
+	void closePipe();
+	bool pipeFull() const;
+	ssize_t copyFrom(int socket, size_t length);
+};
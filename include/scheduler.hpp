@@ -0,0 +1,167 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <deque>
+#include <unordered_map>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <chrono>
+#include <cstdint>
+#include <cstddef>
+
+// Priority classes a client can pick with the "class=" connection option.
+enum PriorityClass : uint32_t {
+	PRIORITY_INTERACTIVE,
+	PRIORITY_NORMAL,
+	PRIORITY_BULK,
+	PRIORITY_CLASS_COUNT
+};
+
+const char* priorityClassName(PriorityClass priority);
+bool parsePriorityClass(std::string_view name, PriorityClass& priority);
+
+struct ClassPolicy {
+	// Share of the workers relative to the other classes: a client gets
+	// weight * SCHEDULER_QUANTUM bytes of work per round.
+	uint32_t weight;
+	// Bytes per second for all clients of the class together, 0 = unlimited.
+	uint64_t rateLimit;
+};
+
+const size_t SCHEDULER_QUANTUM = 4096;
+
+struct SchedulerConfig {
+	// 0 = one per hardware thread.
+	size_t workerThreads = 0;
+	// Jobs a client may have waiting before its connection stops reading.
+	size_t maxQueueDepth = 64;
+	// Prints every client's queue statistics this often, 0 = never.
+	std::chrono::seconds reportInterval{ 0 };
+	ClassPolicy classes[PRIORITY_CLASS_COUNT] = { { 8, 0 }, { 4, 0 }, { 1, 0 } };
+};
+
+struct ClientSchedulingStats {
+	uint64_t client;
+	PriorityClass priority;
+	size_t queued;
+	size_t maxQueued;
+	uint64_t completed;
+	std::chrono::nanoseconds totalWait;
+	std::chrono::nanoseconds maxWait;
+
+	std::chrono::nanoseconds averageWait() const {
+		return completed > 0 ? totalWait / static_cast<int64_t>(completed) : std::chrono::nanoseconds(0);
+	}
+};
+
+// Runs jobs from per-client queues on a pool of workers in deficit round
+// robin order, weighted by each client's class, so a client with a deep
+// queue cannot delay others by more than one round. At most one job of a
+// client runs at a time, which keeps every client's jobs in order.
+class FairScheduler {
+public:
+	using Job = std::function<void()>;
+
+	explicit FairScheduler(const SchedulerConfig& config = SchedulerConfig());
+	// Runs the jobs still queued, ignoring rate limits, then stops.
+	~FairScheduler();
+
+	FairScheduler(const FairScheduler&) = delete;
+	FairScheduler& operator=(const FairScheduler&) = delete;
+
+	uint64_t addClient(PriorityClass priority);
+	void setClientClass(uint64_t client, PriorityClass priority);
+	// Waits for the client's queued jobs to finish.
+	void removeClient(uint64_t client);
+
+	// Queues a job costing cost bytes; blocks while the client's queue is
+	// full. Returns false for unknown clients.
+	bool submit(uint64_t client, size_t cost, Job job);
+	void drain(uint64_t client);
+
+	// Non-blocking forms for callers that must not wait on a thread, such as
+	// coroutines on an event loop. A false return leaves the job untouched
+	// and keeps wake, which a worker calls once one of the client's jobs has
+	// finished. Jobs of unknown clients are dropped.
+	bool trySubmit(uint64_t client, size_t cost, Job& job, std::function<void()> wake);
+	bool tryDrain(uint64_t client, std::function<void()> wake);
+	void cancelWake(uint64_t client);
+
+	std::vector<ClientSchedulingStats> statistics() const;
+
+private:
+	struct QueuedJob {
+		size_t cost;
+		Job work;
+		std::chrono::steady_clock::time_point enqueuedAt;
+	};
+
+	struct ClientQueue {
+		uint64_t id;
+		PriorityClass priority;
+		std::deque<QueuedJob> jobs;
+		size_t deficit = 0;
+		// Quantum already granted for the current turn at the ring's front.
+		bool inTurn = false;
+		bool busy = false;
+		// Called under the mutex when the next job completes.
+		std::function<void()> wake;
+		size_t maxQueued = 0;
+		uint64_t completed = 0;
+		std::chrono::nanoseconds totalWait{ 0 };
+		std::chrono::nanoseconds maxWait{ 0 };
+	};
+
+	struct TokenBucket {
+		double tokens = 0;
+		std::chrono::steady_clock::time_point refilledAt;
+	};
+
+	SchedulerConfig settings;
+	mutable std::mutex mutex;
+	std::condition_variable workAvailable;
+	std::condition_variable progress;
+	std::condition_variable reportWakeup;
+	std::unordered_map<uint64_t, std::unique_ptr<ClientQueue>> clients;
+	// Clients with queued jobs, in round robin order.
+	std::deque<ClientQueue*> ring;
+	TokenBucket buckets[PRIORITY_CLASS_COUNT];
+	uint64_t nextClientId;
+	bool stopping;
+	std::vector<std::thread> workers;
+	std::thread reporter;
+
+	void runWorker();
+	void printReports();
+	bool dispatch(QueuedJob& job, ClientQueue*& client, std::chrono::steady_clock::time_point& wakeAt);
+	void refill(std::chrono::steady_clock::time_point now);
+	void endTurn(size_t position);
+};
+
+// A connection's registration with an optional scheduler. Without one, jobs
+// run inline on the calling thread.
+class SchedulerSession {
+public:
+	SchedulerSession(FairScheduler* scheduler, PriorityClass priority);
+	~SchedulerSession();
+
+	SchedulerSession(const SchedulerSession&) = delete;
+	SchedulerSession& operator=(const SchedulerSession&) = delete;
+
+	bool active() const { return scheduler != nullptr; }
+	void setClass(PriorityClass priority);
+	bool submit(size_t cost, FairScheduler::Job job);
+	void drain();
+	bool trySubmit(size_t cost, FairScheduler::Job& job, std::function<void()> wake);
+	bool tryDrain(std::function<void()> wake);
+	void cancelWake();
+
+private:
+	FairScheduler* scheduler;
+	uint64_t client;
+};
@@ -1,8 +1,39 @@
+#pragma once
+
 #include <string>
-#include <unordered_set>
 #include <vector>
 #include <cerrno>
 #include <atomic>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <chrono>
+#include <functional>
+#include <string_view>
+#include <unordered_set>
+#include "protocol.hpp"
+#include "transport.hpp"
+#include "async.hpp"
+#include "dictionary.hpp"
+#include "utf8.hpp"
+#include "pipeline.hpp"
+#include "lifecycle.hpp"
+#include "trace.hpp"
+#include "relay.hpp"
+#include "sketch.hpp"
+#include "scheduler.hpp"
+
+class Connection;
+
+// Per-connection settings a client can change with an options frame.
+struct ConnectionOptions {
+	// Relay messages to the display server unchanged: only the frame header
+	// is checked and the payload is spliced without entering user space.
+	bool passthrough = false;
+	// Scheduling class when the server runs a FairScheduler.
+	PriorityClass priority = PRIORITY_NORMAL;
+};
 
 class ProcessingServer {
 public:
@@ -10,33 +41,95 @@ public:
 	~ProcessingServer();
 
 	void start();
+	void startAsync(size_t threadCount);
 	void stop();
 	std::string processData(const std::string& data);
 	bool validateData(const std::string& data);
+	void setDictionaryEncoding(bool enabled);
+	void setTokenizerOptions(const TokenizerOptions& options);
+	void setPipelineConfig(const PipelineConfig& config);
+	void setReadyCallback(ReadyCallback callback);
+	// Interface to listen on: empty for all, a host or "unix:/path".
+	void setListenAddress(const std::string& host);
+	// Default for connections that do not send an options frame.
+	void setPassthrough(bool enabled);
+	// Runs message processing and display sends through a FairScheduler.
+	// Must be called before start() or startAsync().
+	void setFairScheduling(const SchedulerConfig& config);
+	// Per-client queue statistics while the server is running.
+	std::vector<ClientSchedulingStats> schedulingStatistics() const;
+
+	static bool parseConnectionOptions(std::string_view text, ConnectionOptions& options);
 
 private:
 	int serverPort;
+	std::string listenHost;
 	std::string displayServerHost;
 	int displayServerPort;
-	bool isRunning;
+	std::atomic<bool> isRunning;
 	int serverSocket;
 	int displayServerSocket;
+	// Serializes frames on the display link, and with them displayEncoder.
+	AsyncMutex displayLock;
+	bool dictionaryEncoding;
+	WordEncoder displayEncoder;
+	PipelineConfig pipelineConfig;
+	ReadyCallback readyCallback;
+	bool passthrough;
+	bool fairScheduling;
+	SchedulerConfig schedulerConfig;
+	std::shared_ptr<FairScheduler> scheduler;
+	// Sockets of the connected clients, shut down by stop().
+	std::mutex clientsMutex;
+	std::condition_variable clientsFinished;
+	std::unordered_set<int> clientSockets;
 
-	bool handleClient(int clientSocket);
+	bool openSockets();
+	// The client protocol, shared by both modes: start() runs handleClient()
+	// on a thread per connection, startAsync() on an event loop. Scheduled
+	// jobs run deliverMessage() and the like on a worker thread.
+	Task<void> handleClient(Connection& connection);
+	Task<bool> handleFrame(Connection& connection, ConnectionOptions& options,
+		std::unique_ptr<SpliceRelay>& relay, SchedulerSession& session);
+	Task<bool> handleBatch(Connection& connection, uint32_t messageCount, SchedulerSession& session);
+	Task<bool> relayBatch(Connection& connection, uint32_t messageCount, SpliceRelay& relay,
+		SchedulerSession& session);
+	Task<bool> relayBuffered(Connection& connection, SpliceRelay& relay, const std::vector<uint64_t>& traceIds,
+		SchedulerSession& session);
+	Task<bool> deliverMessage(Connection& connection, const std::string& data, uint64_t traceId);
+	Task<bool> deliverBatch(Connection& connection, const std::vector<std::string>& messages,
+		const std::vector<uint64_t>& traceIds);
+	Task<bool> handleOptions(Connection& connection, uint32_t dataLength, ConnectionOptions& options);
+	// Batch headers announce 1..MAX_BATCH_MESSAGES frames.
+	static bool validBatchSize(uint32_t messageCount);
+	void releaseClient(int clientSocket);
 	bool connectToDisplayServer();
-	bool sendToDisplayServer(const std::string& processedData);
-	bool sendAcknowledgement(int clientSocket);
-
-	int createTCPSocket();
-	bool bindTCPSocket(int socket, int port);
-	bool startTCPListening(int socket);
-	int acceptTCPConnection(int socket);
-	int receiveTCPData(int socket, char* buffer, size_t length);
-	int sendTCPData(int socket, const char* data, size_t lenght);
-	void closeTCPSocket(int socket);
+	Task<bool> sendToDisplayServer(Connection& connection, const std::string& processedData, uint64_t traceId);
+	Task<bool> sendBatchToDisplayServer(Connection& connection, const std::vector<std::string>& processedData,
+		const std::vector<uint64_t>& traceIds);
+	Task<bool> relayToDisplayServer(Connection& connection, SpliceRelay& relay,
+		const std::vector<uint64_t>& traceIds);
+	Task<bool> sendAcknowledgement(Connection& connection);
+	Task<bool> sendNegativeAcknowledgement(Connection& connection);
+	// dropped lists the batch indices of invalid messages, sent with BATCH_INVALID.
+	Task<bool> sendBatchAcknowledgement(Connection& connection, BatchAckStatus status, uint32_t delivered,
+		const std::vector<uint32_t>& dropped);
+
+#ifndef _WIN32
+	// Filled by startAsync(), stopped from other threads by stop().
+	std::mutex loopsMutex;
+	std::vector<std::unique_ptr<EventLoop>> eventLoops;
+
+	Task<void> acceptConnectionsAsync(EventLoop& loop, std::vector<EventLoop*> targets);
+	Task<void> handleClientAsync(EventLoop& loop, int clientSocket);
+#endif
 };
 
 
+// Receives every message DisplayServer outputs, already decoded. Set one to
+// consume messages in-process instead of printing them.
+using MessageHandler = std::function<void(std::string_view message)>;
+
 class DisplayServer {
 public:
 	explicit DisplayServer(int port);
@@ -44,18 +137,46 @@ public:
 
 	void start();
 	void stop();
+	std::shared_ptr<const WordTable> wordTable() const;
+	void setReadyCallback(ReadyCallback callback);
+	void setMessageHandler(MessageHandler handler);
+	// Interface to listen on: empty for all, a host or "unix:/path".
+	void setListenAddress(const std::string& host);
+
+	// Counts every displayed word in a sketch of fixed size. Must be called
+	// before start().
+	void enableWordStatistics(const SketchConfig& config);
+	std::shared_ptr<const WordFrequencySketch> wordStatistics() const;
+	// Prints the most frequent words every interval; zero disables it.
+	void setSnapshotInterval(std::chrono::seconds interval);
+	// Serves "TOP [n]" and "COUNT <word>" queries, one per line, on a
+	// separate socket. Port 0 picks a free port, see queryPort().
+	void setQueryAddress(const std::string& host, int port);
+	int queryPort() const;
+
+	static std::string answerQuery(const WordFrequencySketch& statistics, std::string_view query);
 
 private:
 	int serverPort;
+	std::string listenHost;
 	std::atomic<bool> isRunning;
 	int serverSocket;
+	std::atomic<int> activeClientSocket;
+	std::shared_ptr<const WordTable> currentWordTable;
+	ReadyCallback readyCallback;
+	MessageHandler messageHandler;
+	std::shared_ptr<WordFrequencySketch> statistics;
+	std::chrono::seconds snapshotInterval;
+	std::mutex snapshotMutex;
+	std::condition_variable snapshotWakeup;
+	std::string queryHost;
+	std::atomic<int> queryServerPort;
+	int querySocket;
+	std::atomic<int> activeQuerySocket;
 
 	void handleClient(int clientSocket);
-
-	int createTCPSocket();
-	bool bindTCPSocket(int socket, int port);
-	bool startTCPListening(int socket);
-	int acceptTCPConnection(int socket);
-	int receiveTCPData(int socket, char* buffer, size_t lenght);
-	void closeTCPSocket(int socket);
+	void countWords(std::string_view text);
+	void serveQueries();
+	void handleQueryClient(int clientSocket);
+	void printSnapshots();
 };
\ No newline at end of file
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <unordered_map>
+#include <atomic>
+#include <memory>
+#include <cstdint>
+#include <cstddef>
+
+// Approximate word frequencies in fixed memory: a count-min sketch estimates
+// every word's count and a min-heap keeps the topK words with the highest
+// estimates, evicting the smallest when a word overtakes it. Estimates never
+// undercount; the overcount stays below 2 * total / width with probability
+// 1 - 2^-depth. Counters are 64-bit, so a hot word in a long-running server
+// cannot wrap them.
+const size_t SKETCH_DEFAULT_WIDTH = 1 << 16;
+const size_t SKETCH_DEFAULT_DEPTH = 4;
+const size_t SKETCH_DEFAULT_TOP_K = 32;
+// Longer words are counted by the sketch but never tracked as top words.
+const size_t SKETCH_MAX_WORD_LENGTH = 64;
+
+struct SketchConfig {
+	size_t width = SKETCH_DEFAULT_WIDTH;
+	size_t depth = SKETCH_DEFAULT_DEPTH;
+	size_t topK = SKETCH_DEFAULT_TOP_K;
+};
+
+struct WordCount {
+	std::string word;
+	uint64_t count;
+};
+
+// add() is meant for one thread at a time (DisplayServer's receive path);
+// any number of threads may query concurrently without blocking it. Sketch
+// counters are relaxed atomics and each top-K slot is published under a
+// sequence lock, so readers retry instead of taking a lock.
+class WordFrequencySketch {
+public:
+	explicit WordFrequencySketch(const SketchConfig& config = SketchConfig());
+
+	WordFrequencySketch(const WordFrequencySketch&) = delete;
+	WordFrequencySketch& operator=(const WordFrequencySketch&) = delete;
+
+	// Counts occurrences of word at once.
+	void add(std::string_view word, uint64_t occurrences = 1);
+
+	uint64_t estimate(std::string_view word) const;
+	uint64_t total() const { return totalCount.load(std::memory_order_relaxed); }
+	// Up to count tracked words, most frequent first.
+	std::vector<WordCount> top(size_t count) const;
+
+	const SketchConfig& config() const { return settings; }
+	size_t memoryBytes() const;
+
+private:
+	static const size_t SLOT_CHUNKS = SKETCH_MAX_WORD_LENGTH / sizeof(uint64_t);
+
+	struct Slot {
+		// Odd while the writer is changing the slot.
+		std::atomic<uint32_t> sequence;
+		std::atomic<uint32_t> length;
+		std::atomic<uint64_t> count;
+		std::atomic<uint64_t> bytes[SLOT_CHUNKS];
+	};
+
+	struct StringHash {
+		using is_transparent = void;
+		size_t operator()(std::string_view value) const { return std::hash<std::string_view>()(value); }
+	};
+
+	SketchConfig settings;
+	std::unique_ptr<std::atomic<uint64_t>[]> counters;
+	std::atomic<uint64_t> totalCount;
+	std::unique_ptr<Slot[]> slots;
+	std::atomic<size_t> usedSlots;
+
+	// Writer-only state: the heap orders slot indices by count, smallest
+	// first, and slotOf finds the slot of a tracked word.
+	std::vector<uint32_t> heap;
+	std::vector<uint32_t> heapPosition;
+	std::vector<uint64_t> slotCounts;
+	std::vector<std::string> slotWords;
+	std::unordered_map<std::string, uint32_t, StringHash, std::equal_to<>> slotOf;
+
+	size_t counterIndex(size_t row, uint64_t hash) const;
+	void publish(uint32_t slot, std::string_view word, uint64_t count);
+	bool readSlot(size_t slot, WordCount& out) const;
+	void siftUp(size_t position);
+	void siftDown(size_t position);
+	void swapHeap(size_t a, size_t b);
+};
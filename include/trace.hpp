@@ -0,0 +1,130 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstddef>
+
+// Per-message tracing. A sampled message carries a 64-bit trace id next to
+// its frame header (FRAME_FLAG_TRACE) from the client through both servers.
+// Every process that runs a trace writer records one span per stage into a
+// per-thread ring buffer; the writer drains the rings into a binary file that
+// `app trace-convert` turns into Chrome trace JSON plus a latency summary.
+// Timestamps come from the monotonic clock, so files written by processes
+// on the same host line up on one timeline.
+
+enum TraceStage : uint32_t {
+	TRACE_CLIENT_SEND,
+	TRACE_CLIENT_ACK,
+	TRACE_PROCESSING_RECEIVE,
+	TRACE_PROCESSING_PIPELINE,
+	TRACE_PROCESSING_DISPLAY_SEND,
+	TRACE_DISPLAY_RECEIVE,
+	TRACE_DISPLAY_OUTPUT,
+	TRACE_STAGE_COUNT
+};
+
+const char* traceStageName(uint32_t stage);
+
+// On-disk record, written in host byte order after an 8-byte magic and the
+// writing process id.
+struct TraceRecord {
+	uint64_t traceId;
+	uint64_t startNanos;
+	uint64_t endNanos;
+	uint32_t threadId;
+	uint32_t stage;
+};
+
+static_assert(sizeof(TraceRecord) == 32, "trace records are written as raw 32-byte blocks");
+
+const size_t TRACE_ID_SIZE = 8;
+
+inline void encodeTraceId(uint64_t traceId, char* out) {
+	for (size_t i = 0; i < TRACE_ID_SIZE; i++) {
+		out[i] = static_cast<char>(traceId >> (56 - 8 * i));
+	}
+}
+
+inline uint64_t decodeTraceId(const char* data) {
+	uint64_t traceId = 0;
+	for (size_t i = 0; i < TRACE_ID_SIZE; i++) {
+		traceId = (traceId << 8) | static_cast<unsigned char>(data[i]);
+	}
+	return traceId;
+}
+
+extern std::atomic<bool> traceWriterActive;
+
+inline bool isTracing() {
+	return traceWriterActive.load(std::memory_order_relaxed);
+}
+
+inline uint64_t traceClock() {
+	return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+// Never blocks: when the calling thread's ring is full the span is dropped
+// and counted.
+void recordTraceSpan(uint64_t traceId, TraceStage stage, uint64_t startNanos, uint64_t endNanos);
+
+bool startTraceWriter(const std::string& path);
+void stopTraceWriter();
+
+uint64_t newTraceId();
+
+// Times one stage of a traced message. Untraced messages (id 0) and
+// processes without a trace writer skip the clock reads entirely.
+class TraceSpan {
+public:
+	TraceSpan(uint64_t traceId, TraceStage stage)
+		: traceId(traceId != 0 && isTracing() ? traceId : 0), stage(stage),
+		startNanos(this->traceId != 0 ? traceClock() : 0) {}
+	TraceSpan(const TraceSpan&) = delete;
+	TraceSpan& operator=(const TraceSpan&) = delete;
+
+	~TraceSpan() { finish(); }
+
+	void finish() {
+		if (traceId != 0) {
+			recordTraceSpan(traceId, stage, startNanos, traceClock());
+			traceId = 0;
+		}
+	}
+
+private:
+	uint64_t traceId;
+	TraceStage stage;
+	uint64_t startNanos;
+};
+
+// Decides which messages get a trace id. A rate of 0.01 traces about 1% of
+// messages at the cost of one xorshift step per message.
+class TraceSampler {
+public:
+	explicit TraceSampler(double rate = 0.0);
+
+	void setRate(double rate);
+	bool enabled() const { return threshold != 0; }
+
+	bool sample() {
+		if (threshold == 0) {
+			return false;
+		}
+		state ^= state << 13;
+		state ^= state >> 7;
+		state ^= state << 17;
+		return state <= threshold;
+	}
+
+private:
+	uint64_t threshold;
+	uint64_t state;
+};
+
+// Merges binary trace files into one Chrome trace JSON file (chrome://tracing,
+// Perfetto) and prints per-stage latency percentiles to stdout.
+bool convertTraceToChrome(const std::vector<std::string>& inputPaths, const std::string& outputPath);
@@ -0,0 +1,110 @@
+#pragma once
+
+#include "protocol.hpp"
+#include "trace.hpp"
+#include <string>
+#include <string_view>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+using ssize_t = int;
+#else
+#include <sys/types.h>
+#include <sys/socket.h>
+#endif
+
+// Stream socket plumbing shared by the client and both servers.
+//
+// Addresses are a host plus a port. A host of the form "unix:/path" selects
+// an AF_UNIX stream socket at that path and the port is ignored; anything
+// else is a name or an IPv4/IPv6 literal resolved with getaddrinfo. An empty
+// host on the listening side binds every interface, IPv6 and IPv4 alike.
+namespace transport {
+
+const char UNIX_PREFIX[] = "unix:";
+
+bool isUnixAddress(const std::string& host);
+// "host:port", "[v6]:port" or the unix address itself, for log messages.
+std::string formatAddress(const std::string& host, int port);
+
+struct SocketOptions {
+	// TCP_NODELAY: every frame is written with a single send, so Nagle's
+	// algorithm only adds latency to small acknowledgements.
+	bool noDelay = true;
+	// SO_SNDBUF / SO_RCVBUF in bytes, 0 keeps the kernel's autotuning.
+	int sendBufferSize = 0;
+	int receiveBufferSize = 0;
+	// SO_BUSY_POLL in microseconds (Linux), 0 disables it.
+	int busyPollMicros = 0;
+};
+
+// Options applied to every socket returned by connectTo() and accept().
+void setDefaultSocketOptions(const SocketOptions& options);
+SocketOptions defaultSocketOptions();
+// TCP-only options are skipped on unix sockets.
+bool applySocketOptions(int socket, const SocketOptions& options);
+
+// WSAStartup/WSACleanup on Windows, nothing elsewhere.
+void startup();
+void cleanup();
+
+// Each returns -1 and prints the reason on failure.
+int listenOn(const std::string& host, int port);
+int connectTo(const std::string& host, int port);
+int accept(int socket);
+// The port a listening socket was bound to (useful after port 0), 0 for unix
+// sockets.
+int boundPort(int socket);
+
+#ifndef _WIN32
+// Resolves an address for callers that create their own (non-blocking)
+// socket; the family to create it with is address.ss_family.
+bool resolve(const std::string& host, int port, sockaddr_storage& address, socklen_t& length);
+#endif
+
+// Exact-length I/O: false means the peer closed the connection or an error
+// occurred before all bytes were transferred. Interrupted calls are retried
+// and these writes never raise SIGPIPE (SpliceRelay's splices can, see
+// relay.cpp). Sends to a non-blocking socket (one shared with an event loop)
+// wait until it is writable.
+ssize_t receiveSome(int socket, char* buffer, size_t length);
+ssize_t sendSome(int socket, const char* data, size_t length);
+bool receiveExact(int socket, char* buffer, size_t length);
+bool discard(int socket, size_t length);
+bool sendAll(int socket, const char* data, size_t length);
+bool sendVector(int socket, const std::vector<FrameSlice>& slices);
+
+// A frame header as described in protocol.hpp: the length word split into
+// its FRAME_FLAG_* bits and length, and the trace id that follows it when
+// FRAME_FLAG_TRACE is set (0 otherwise).
+struct FrameHeader {
+	uint32_t flags = 0;
+	uint32_t length = 0;
+	uint64_t traceId = 0;
+};
+
+const size_t MAX_FRAME_HEADER_SIZE = sizeof(uint32_t) + TRACE_ID_SIZE;
+
+// Writes the length word, with FRAME_FLAG_TRACE added when traceId is not 0,
+// and the trace id into out (MAX_FRAME_HEADER_SIZE bytes). Returns the size
+// written.
+size_t encodeFrameHeader(uint32_t flags, uint32_t length, uint64_t traceId, char* out);
+// Splits a length word as received; the trace id is left to the caller.
+FrameHeader decodeLengthWord(const char* data);
+// Adds a frame to a scatter-gather write. The header is encoded into
+// headerStorage (MAX_FRAME_HEADER_SIZE bytes), which must outlive the write;
+// an empty payload adds the header alone, as for a batch header.
+void appendFrame(std::vector<FrameSlice>& slices, char* headerStorage, uint32_t flags, std::string_view payload, uint64_t traceId = 0);
+
+bool sendFrame(int socket, uint32_t flags, std::string_view payload, uint64_t traceId = 0);
+bool receiveFrameHeader(int socket, FrameHeader& header);
+
+// Wakes up any thread blocked on the socket.
+void shutdownSocket(int socket);
+void closeSocket(int socket);
+
+}
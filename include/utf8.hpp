@@ -0,0 +1,95 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <cstdint>
+#include <cstddef>
+
+struct TokenizerOptions {
+	// Split on every Unicode White_Space code point (NBSP, EM SPACE, ...)
+	// instead of the ASCII set used by operator>>.
+	bool unicodeWhitespace = false;
+	// Apply simple case folding (Latin, Greek, Cyrillic) before dedup.
+	bool caseFold = false;
+};
+
+bool isValidUtf8(const char* data, size_t length);
+// The byte-at-a-time validator isValidUtf8 falls back to without SSSE3, and
+// the reference its vectorized path is tested against.
+bool isValidUtf8Scalar(const char* data, size_t length);
+bool isAscii(const char* data, size_t length);
+bool isUnicodeWhitespace(uint32_t codePoint);
+uint32_t foldCodePoint(uint32_t codePoint);
+void foldCase(std::string_view word, std::string& out);
+
+inline bool isAsciiWhitespace(unsigned char c) {
+	return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+// Decodes the code point starting at data[position] and advances position.
+// Input is expected to be valid UTF-8; stray bytes decode as themselves.
+inline uint32_t decodeCodePoint(std::string_view text, size_t& position) {
+	unsigned char lead = static_cast<unsigned char>(text[position]);
+	size_t length = lead < 0xE0 ? 2 : lead < 0xF0 ? 3 : 4;
+	if (lead < 0xC0 || position + length > text.size()) {
+		position++;
+		return lead;
+	}
+
+	uint32_t codePoint = lead & (0x7F >> length);
+	for (size_t i = 1; i < length; i++) {
+		codePoint = (codePoint << 6) | (static_cast<unsigned char>(text[position + i]) & 0x3F);
+	}
+	position += length;
+	return codePoint;
+}
+
+// Calls sink(std::string_view) for every whitespace-separated word. Pure
+// ASCII input always takes the byte-wise path, even in Unicode mode.
+template<typename Sink>
+void forEachWord(std::string_view text, bool unicodeWhitespace, Sink&& sink) {
+	size_t position = 0;
+	size_t wordStart = 0;
+	bool inWord = false;
+
+	if (!unicodeWhitespace || isAscii(text.data(), text.size())) {
+		for (; position < text.size(); position++) {
+			bool space = isAsciiWhitespace(static_cast<unsigned char>(text[position]));
+			if (space && inWord) {
+				sink(text.substr(wordStart, position - wordStart));
+				inWord = false;
+			}
+			else if (!space && !inWord) {
+				wordStart = position;
+				inWord = true;
+			}
+		}
+	}
+	else {
+		while (position < text.size()) {
+			size_t start = position;
+			unsigned char c = static_cast<unsigned char>(text[position]);
+			bool space;
+			if (c < 0x80) {
+				space = isAsciiWhitespace(c);
+				position++;
+			}
+			else {
+				space = isUnicodeWhitespace(decodeCodePoint(text, position));
+			}
+
+			if (space && inWord) {
+				sink(text.substr(wordStart, start - wordStart));
+				inWord = false;
+			}
+			else if (!space && !inWord) {
+				wordStart = start;
+				inWord = true;
+			}
+		}
+	}
+
+	if (inWord) {
+		sink(text.substr(wordStart));
+	}
+}
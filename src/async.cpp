@@ -0,0 +1,532 @@
+#include "../include/async.hpp"
+#include "../include/transport.hpp"
+#include <iostream>
+#include <cstring>
+#include <cerrno>
+#include <algorithm>
+
+AsyncMutex::Guard AsyncMutex::lock() {
+	std::mutex mutex;
+	std::condition_variable granted;
+	bool held = false;
+	uint64_t ticket = lockOrQueue([&]() {
+		std::lock_guard<std::mutex> lock(mutex);
+		held = true;
+		granted.notify_one();
+		});
+	if (ticket != 0) {
+		std::unique_lock<std::mutex> lock(mutex);
+		granted.wait(lock, [&held]() { return held; });
+	}
+	return Guard(this);
+}
+
+uint64_t AsyncMutex::lockOrQueue(std::function<void()> wake) {
+	std::lock_guard<std::mutex> lock(stateMutex);
+	if (!locked) {
+		locked = true;
+		owner = 0;
+		return 0;
+	}
+	uint64_t ticket = nextTicket++;
+	waiters.push_back({ ticket, std::move(wake) });
+	return ticket;
+}
+
+void AsyncMutex::abandon(uint64_t ticket) {
+	std::lock_guard<std::mutex> lock(stateMutex);
+	auto it = std::find_if(waiters.begin(), waiters.end(), [ticket](const Waiter& waiter) {
+		return waiter.ticket == ticket;
+		});
+	if (it != waiters.end()) {
+		waiters.erase(it);
+	} else if (locked && owner == ticket) {
+		handOver();
+	}
+}
+
+void AsyncMutex::unlock() {
+	std::lock_guard<std::mutex> lock(stateMutex);
+	handOver();
+}
+
+// The next waiter is woken under stateMutex, so an abandon() racing with it
+// either finds the ticket queued or already the owner.
+void AsyncMutex::handOver() {
+	if (waiters.empty()) {
+		locked = false;
+		owner = 0;
+		return;
+	}
+	Waiter next = std::move(waiters.front());
+	waiters.pop_front();
+	owner = next.ticket;
+	next.wake();
+}
+
+#ifndef _WIN32
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/uio.h>
+#include <climits>
+#include <unistd.h>
+#include <fcntl.h>
+
+struct EventLoop::DetachedTask {
+	struct promise_type {
+		EventLoop& loop;
+
+		promise_type(EventLoop& loop, Task<void>&) : loop(loop) {}
+
+		~promise_type() {
+			std::lock_guard<std::mutex> lock(loop.tasksMutex);
+			loop.liveTasks.erase(std::coroutine_handle<promise_type>::from_promise(*this).address());
+		}
+
+		DetachedTask get_return_object() {
+			std::lock_guard<std::mutex> lock(loop.tasksMutex);
+			loop.liveTasks.insert(std::coroutine_handle<promise_type>::from_promise(*this).address());
+			return {};
+		}
+
+		std::suspend_never initial_suspend() const noexcept { return {}; }
+		std::suspend_never final_suspend() const noexcept { return {}; }
+		void return_void() const noexcept {}
+		void unhandled_exception() const noexcept {}
+	};
+};
+
+EventLoop::DetachedTask EventLoop::runDetached(EventLoop& loop, Task<void> task) {
+	co_await loop.schedule();
+	try {
+		co_await task;
+	}
+	catch (const std::exception& e) {
+		std::cerr << "Async task failed: " << e.what() << std::endl;
+	}
+}
+
+EventLoop::EventLoop()
+	: epollFd(epoll_create1(EPOLL_CLOEXEC)),
+	wakeFd(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)),
+	stopRequested(false) {
+
+	if (epollFd < 0 || wakeFd < 0) {
+		std::cerr << "Failed to create event loop: " << strerror(errno) << std::endl;
+		return;
+	}
+
+	epoll_event event = {};
+	event.events = EPOLLIN;
+	event.data.fd = wakeFd;
+	epoll_ctl(epollFd, EPOLL_CTL_ADD, wakeFd, &event);
+}
+
+EventLoop::~EventLoop() {
+	// Each frame erases itself from liveTasks as it is destroyed. Its
+	// destructors may still forget descriptors, so epoll stays open until
+	// they have run; queued handles belong to the destroyed frames.
+	std::vector<void*> tasks;
+	{
+		std::lock_guard<std::mutex> lock(tasksMutex);
+		tasks.assign(liveTasks.begin(), liveTasks.end());
+	}
+	for (void* task : tasks) {
+		std::coroutine_handle<>::from_address(task).destroy();
+	}
+	readyQueue.clear();
+	waiters.clear();
+	timers.clear();
+
+	if (wakeFd >= 0) {
+		close(wakeFd);
+	}
+	if (epollFd >= 0) {
+		close(epollFd);
+	}
+}
+
+void EventLoop::run() {
+	const int MAX_EVENTS = 256;
+	epoll_event events[MAX_EVENTS];
+
+	while (!stopRequested) {
+		drainReadyQueue();
+		if (stopRequested) {
+			break;
+		}
+
+		int count = epoll_wait(epollFd, events, MAX_EVENTS, timerTimeout());
+		if (count < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			std::cerr << "epoll_wait failed: " << strerror(errno) << std::endl;
+			break;
+		}
+
+		for (int i = 0; i < count; i++) {
+			int fd = events[i].data.fd;
+			if (fd == wakeFd) {
+				uint64_t value;
+				while (read(wakeFd, &value, sizeof(value)) > 0) {
+				}
+				continue;
+			}
+
+			auto it = waiters.find(fd);
+			if (it == waiters.end()) {
+				continue;
+			}
+
+			// Both sides are woken on errors so that pending operations can
+			// observe the failure themselves.
+			bool failed = events[i].events & (EPOLLERR | EPOLLHUP);
+			std::coroutine_handle<> reader;
+			std::coroutine_handle<> writer;
+			if ((events[i].events & (EPOLLIN | EPOLLRDHUP)) || failed) {
+				reader = std::exchange(it->second.reader, nullptr);
+			}
+			if ((events[i].events & EPOLLOUT) || failed) {
+				writer = std::exchange(it->second.writer, nullptr);
+			}
+			if (reader) {
+				reader.resume();
+			}
+			if (writer) {
+				writer.resume();
+			}
+		}
+		resumeDueTimers();
+	}
+	stopRequested = false;
+}
+
+int EventLoop::timerTimeout() const {
+	if (timers.empty()) {
+		return -1;
+	}
+	auto delay = timers.begin()->first - std::chrono::steady_clock::now();
+	if (delay.count() <= 0) {
+		return 0;
+	}
+	// Rounded up so that the timer is due when epoll_wait returns.
+	return static_cast<int>(std::chrono::ceil<std::chrono::milliseconds>(delay).count());
+}
+
+void EventLoop::resumeDueTimers() {
+	auto now = std::chrono::steady_clock::now();
+	std::vector<std::coroutine_handle<>> due;
+	while (!timers.empty() && timers.begin()->first <= now) {
+		due.push_back(timers.begin()->second);
+		timers.erase(timers.begin());
+	}
+	for (auto handle : due) {
+		handle.resume();
+	}
+}
+
+void EventLoop::stop() {
+	stopRequested = true;
+	uint64_t value = 1;
+	if (write(wakeFd, &value, sizeof(value)) < 0 && errno != EAGAIN) {
+		std::cerr << "Failed to wake event loop: " << strerror(errno) << std::endl;
+	}
+}
+
+void EventLoop::spawn(Task<void> task) {
+	runDetached(*this, std::move(task));
+}
+
+void EventLoop::post(std::coroutine_handle<> handle) {
+	{
+		std::lock_guard<std::mutex> lock(queueMutex);
+		readyQueue.push_back(handle);
+	}
+	uint64_t value = 1;
+	if (write(wakeFd, &value, sizeof(value)) < 0 && errno != EAGAIN) {
+		std::cerr << "Failed to wake event loop: " << strerror(errno) << std::endl;
+	}
+}
+
+void EventLoop::drainReadyQueue() {
+	std::deque<std::coroutine_handle<>> ready;
+	{
+		std::lock_guard<std::mutex> lock(queueMutex);
+		ready.swap(readyQueue);
+	}
+	for (auto handle : ready) {
+		handle.resume();
+	}
+}
+
+void EventLoop::waitFor(int fd, bool writing, std::coroutine_handle<> handle) {
+	auto it = waiters.find(fd);
+	if (it == waiters.end()) {
+		// Edge-triggered registration lasts for the lifetime of the descriptor;
+		// callers always attempt the operation before suspending.
+		epoll_event event = {};
+		event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+		event.data.fd = fd;
+		if (epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &event) < 0) {
+			std::cerr << "Failed to watch socket: " << strerror(errno) << std::endl;
+		}
+		it = waiters.emplace(fd, Waiters()).first;
+	}
+
+	if (writing) {
+		it->second.writer = handle;
+	} else {
+		it->second.reader = handle;
+	}
+}
+
+void EventLoop::forget(int fd) {
+	if (waiters.erase(fd) > 0) {
+		epoll_ctl(epollFd, EPOLL_CTL_DEL, fd, NULL);
+	}
+}
+
+bool setNonBlocking(int socket) {
+	int flags = fcntl(socket, F_GETFL, 0);
+	return flags >= 0 && fcntl(socket, F_SETFL, flags | O_NONBLOCK) == 0;
+}
+
+Task<bool> asyncConnect(EventLoop& loop, int socket, const sockaddr* address, socklen_t length) {
+	if (connect(socket, address, length) == 0) {
+		co_return true;
+	}
+	if (errno != EINPROGRESS) {
+		co_return false;
+	}
+
+	co_await loop.writable(socket);
+
+	int error = 0;
+	socklen_t errorLength = sizeof(error);
+	if (getsockopt(socket, SOL_SOCKET, SO_ERROR, &error, &errorLength) < 0 || error != 0) {
+		co_return false;
+	}
+	co_return true;
+}
+
+Task<int> asyncAccept(EventLoop& loop, int socket) {
+	while (true) {
+		int clientSocket = accept4(socket, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if (clientSocket >= 0) {
+			co_return clientSocket;
+		}
+		if (errno == EINTR || errno == ECONNABORTED) {
+			continue;
+		}
+		if (errno != EAGAIN && errno != EWOULDBLOCK) {
+			co_return -1;
+		}
+		co_await loop.readable(socket);
+	}
+}
+
+Task<bool> asyncReceiveExact(EventLoop& loop, int socket, char* buffer, size_t length) {
+	size_t received = 0;
+	while (received < length) {
+		ssize_t bytesReceived = recv(socket, buffer + received, length - received, 0);
+		if (bytesReceived > 0) {
+			received += static_cast<size_t>(bytesReceived);
+			continue;
+		}
+		if (bytesReceived == 0) {
+			co_return false;
+		}
+		if (errno == EINTR) {
+			continue;
+		}
+		if (errno != EAGAIN && errno != EWOULDBLOCK) {
+			co_return false;
+		}
+		co_await loop.readable(socket);
+	}
+	co_return true;
+}
+
+Task<bool> asyncDiscard(EventLoop& loop, int socket, size_t length) {
+	char buffer[4096];
+	while (length > 0) {
+		size_t chunk = std::min(length, sizeof(buffer));
+		bool received = co_await asyncReceiveExact(loop, socket, buffer, chunk);
+		if (!received) {
+			co_return false;
+		}
+		length -= chunk;
+	}
+	co_return true;
+}
+
+Task<bool> asyncSendAll(EventLoop& loop, int socket, const char* data, size_t length) {
+	size_t sent = 0;
+	while (sent < length) {
+		ssize_t bytesSent = send(socket, data + sent, length - sent, MSG_NOSIGNAL);
+		if (bytesSent >= 0) {
+			sent += static_cast<size_t>(bytesSent);
+			continue;
+		}
+		if (errno == EINTR) {
+			continue;
+		}
+		if (errno != EAGAIN && errno != EWOULDBLOCK) {
+			co_return false;
+		}
+		co_await loop.writable(socket);
+	}
+	co_return true;
+}
+
+Task<bool> asyncSendVector(EventLoop& loop, int socket, const std::vector<FrameSlice>& slices) {
+	std::vector<iovec> buffers(slices.size());
+	for (size_t i = 0; i < slices.size(); i++) {
+		buffers[i].iov_base = const_cast<char*>(slices[i].data);
+		buffers[i].iov_len = slices[i].length;
+	}
+
+	size_t current = 0;
+	while (current < buffers.size()) {
+		msghdr message = {};
+		message.msg_iov = &buffers[current];
+		message.msg_iovlen = std::min<size_t>(buffers.size() - current, IOV_MAX);
+		ssize_t bytesSent = sendmsg(socket, &message, MSG_NOSIGNAL);
+		if (bytesSent < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			if (errno != EAGAIN && errno != EWOULDBLOCK) {
+				co_return false;
+			}
+			co_await loop.writable(socket);
+			continue;
+		}
+
+		size_t remaining = static_cast<size_t>(bytesSent);
+		while (current < buffers.size() && remaining >= buffers[current].iov_len) {
+			remaining -= buffers[current].iov_len;
+			current++;
+		}
+		if (remaining > 0) {
+			buffers[current].iov_base = static_cast<char*>(buffers[current].iov_base) + remaining;
+			buffers[current].iov_len -= remaining;
+		}
+	}
+	co_return true;
+}
+
+namespace {
+
+class LockAwaiter {
+public:
+	LockAwaiter(EventLoop& loop, AsyncMutex& mutex) : loop(loop), mutex(mutex), ticket(0), resumed(false) {}
+	LockAwaiter(const LockAwaiter&) = delete;
+	LockAwaiter& operator=(const LockAwaiter&) = delete;
+
+	// A task destroyed while queued must not be handed the lock.
+	~LockAwaiter() {
+		if (ticket != 0 && !resumed) {
+			mutex.abandon(ticket);
+		}
+	}
+
+	bool await_ready() const noexcept { return false; }
+
+	bool await_suspend(std::coroutine_handle<> handle) {
+		EventLoop* target = &loop;
+		ticket = mutex.lockOrQueue([target, handle]() { target->post(handle); });
+		return ticket != 0;
+	}
+
+	AsyncMutex::Guard await_resume() {
+		resumed = true;
+		return AsyncMutex::Guard(&mutex);
+	}
+
+private:
+	EventLoop& loop;
+	AsyncMutex& mutex;
+	uint64_t ticket;
+	bool resumed;
+};
+
+}
+
+Task<AsyncMutex::Guard> asyncLock(EventLoop& loop, AsyncMutex& mutex) {
+	LockAwaiter awaiter(loop, mutex);
+	co_return co_await awaiter;
+}
+
+AsyncClient::AsyncClient(EventLoop& loop, const std::string& serverHost, int serverPort)
+	: loop(loop), serverHost(serverHost), serverPort(serverPort), clientSocket(-1) {
+}
+
+AsyncClient::~AsyncClient() {
+	disconnect();
+}
+
+Task<bool> AsyncClient::connect() {
+	disconnect();
+
+	sockaddr_storage serverAddress;
+	socklen_t addressLength;
+	if (!transport::resolve(serverHost, serverPort, serverAddress, addressLength)) {
+		co_return false;
+	}
+
+	clientSocket = socket(serverAddress.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (clientSocket == -1) {
+		std::cerr << "Failed to create socket" << std::endl;
+		co_return false;
+	}
+
+	if (!co_await asyncConnect(loop, clientSocket,
+		reinterpret_cast<sockaddr*>(&serverAddress), addressLength)) {
+		std::cerr << "Failed to connect to " << transport::formatAddress(serverHost, serverPort) << std::endl;
+		disconnect();
+		co_return false;
+	}
+	transport::applySocketOptions(clientSocket, transport::defaultSocketOptions());
+	co_return true;
+}
+
+Task<bool> AsyncClient::send(std::string_view message) {
+	if (clientSocket == -1) {
+		bool connected = co_await connect();
+		if (!connected) {
+			co_return false;
+		}
+	}
+
+	char header[transport::MAX_FRAME_HEADER_SIZE];
+	std::vector<FrameSlice> slices;
+	transport::appendFrame(slices, header, 0, message);
+
+	// GCC 12 mishandles co_await inside short-circuit operators, so each
+	// step is awaited on its own.
+	char ack[ACK_SIZE];
+	bool sent = co_await asyncSendVector(loop, clientSocket, slices);
+	if (sent) {
+		sent = co_await asyncReceiveExact(loop, clientSocket, ack, sizeof(ack));
+	}
+	if (!sent) {
+		disconnect();
+		co_return false;
+	}
+	co_return isPositiveAcknowledgement(ack);
+}
+
+void AsyncClient::disconnect() {
+	if (clientSocket != -1) {
+		loop.forget(clientSocket);
+		close(clientSocket);
+		clientSocket = -1;
+	}
+}
+
+#endif
@@ -4,12 +4,18 @@
 #include <cstring>
 #include <thread>
 #include <chrono>
+#include <deque>
+#include <algorithm>
+#include <iomanip>
 
 #ifdef _WIN32
 #include <winsock2.h>
 #pragma comment(lib, "ws2_32.lib")
 #else
 #include <sys/socket.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
 #include <netinet/in.h>
 #include <unistd.h>
 #include <arpa/inet.h>
@@ -18,13 +24,7 @@
 Client::Client(const std::string& serverHost, int serverPort)
     : serverHost(serverHost), serverPort(serverPort),
     isRunning(false), clientSocket(-1) {
-
-    #ifdef _WIN32
-    WSADATA wsaData;
-    if (WSAStartup(MAKEWORD(2, 2), &wsaData) != 0) {
-        std::cerr << "WSAStartup failed" << std::endl;
-    }
-    #endif
+    transport::startup();
 }
 
 Client::~Client() {
@@ -32,22 +32,22 @@ Client::~Client() {
 }
 
 bool Client::connectToServer() {
-    clientSocket = createTCPSocket();
+    clientSocket = transport::connectTo(serverHost, serverPort);
     if (clientSocket == -1) {
-        std::cerr << "Failed to create TCP socket" << std::endl;
+        std::cerr << "Failed to connect to server "
+            << transport::formatAddress(serverHost, serverPort) << std::endl;
         return false;
     }
 
-    if (!connectTCPSocket(clientSocket, serverHost, serverPort)) {
-        std::cerr << "Failed to connect to server " << serverHost
-            << ":" << serverPort << std::endl;
-        closeTCPSocket(clientSocket);
+    if (!connectionOptions.empty() && !sendConnectionOptions()) {
+        std::cerr << "Server rejected connection options: " << connectionOptions << std::endl;
+        transport::closeSocket(clientSocket);
         clientSocket = -1;
         return false;
     }
 
-    std::cout << "Connected to processing server at " << serverHost
-        << ":" << serverPort << std::endl;
+    std::cout << "Connected to processing server at "
+        << transport::formatAddress(serverHost, serverPort) << std::endl;
     std::cout << "Client connected to " << std::endl;
     return true;
 }
@@ -87,115 +87,418 @@ void Client::run() {
     }
 }
 
-void Client::disconnect() {
-    isRunning = false;
-    if (clientSocket != -1) {
+bool Client::runInput(const std::string& inputPath) {
+    if (clientSocket == -1 && !connectToServer()) {
+        return false;
+    }
+
+    isRunning = true;
+    InputStats stats = {};
+    auto started = std::chrono::steady_clock::now();
+
+    bool sent = inputPath == "-" ? sendInputStream(stdin, stats)
+        : sendInputFile(inputPath, stats);
+
+    double seconds = std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - started).count();
+    if (seconds <= 0) {
+        seconds = 1e-9;
+    }
+
+    std::cout << std::fixed << std::setprecision(3)
+        << "Sent " << stats.lines << " lines (" << stats.bytes << " bytes) in "
+        << seconds << " s: " << stats.lines / seconds << " lines/s, "
+        << stats.bytes / seconds / (1024.0 * 1024.0) << " MiB/s" << std::endl;
+    if (stats.skipped > 0) {
+        std::cout << "Skipped " << stats.skipped << " empty or oversized lines" << std::endl;
+    }
+    if (stats.rejected > 0) {
+        std::cout << "Server rejected " << stats.rejected << " lines" << std::endl;
+    }
+    if (!sent) {
+        std::cerr << "Input transfer aborted" << std::endl;
+    }
+    return sent;
+}
+
+bool Client::sendInputFile(const std::string& path, InputStats& stats) {
     #ifdef _WIN32
-        shutdown(clientSocket, SD_BOTH);
+    FILE* stream = fopen(path.c_str(), "rb");
+    if (stream == NULL) {
+        std::cerr << "Failed to open input file " << path << std::endl;
+        return false;
+    }
+    bool sent = sendInputStream(stream, stats);
+    fclose(stream);
+    return sent;
     #else
-        shutdown(clientSocket, SHUT_RDWR);
-    #endif
-        closeTCPSocket(clientSocket);
-        clientSocket = -1;
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        std::cerr << "Failed to open input file " << path
+            << " - Error: " << strerror(errno) << std::endl;
+        return false;
     }
 
-    #ifdef _WIN32
-    WSACleanup();
+    struct stat info;
+    if (fstat(fd, &info) < 0 || !S_ISREG(info.st_mode)) {
+        // Pipes and character devices cannot be mapped, read them in blocks.
+        FILE* stream = fdopen(fd, "rb");
+        bool sent = stream != NULL && sendInputStream(stream, stats);
+        if (stream != NULL) {
+            fclose(stream);
+        } else {
+            close(fd);
+        }
+        return sent;
+    }
+
+    size_t length = static_cast<size_t>(info.st_size);
+    if (length == 0) {
+        close(fd);
+        return true;
+    }
+
+    void* mapped = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED) {
+        std::cerr << "Failed to map input file " << path
+            << " - Error: " << strerror(errno) << std::endl;
+        return false;
+    }
+    madvise(mapped, length, MADV_SEQUENTIAL);
+
+    std::vector<std::string_view> pending;
+    size_t consumed = 0;
+    bool sent = queueInputLines(static_cast<const char*>(mapped), length, true,
+        consumed, pending, stats) && flushInputLines(pending, stats);
+
+    munmap(mapped, length);
+    return sent;
     #endif
 }
 
+bool Client::sendInputStream(FILE* stream, InputStats& stats) {
+    const size_t BLOCK_SIZE = 1 << 20;
+    std::vector<char> buffer(BLOCK_SIZE + MAX_MESSAGE_LENGTH + 1);
+    std::vector<std::string_view> pending;
+    size_t buffered = 0;
+    bool discarding = false;
+
+    while (isRunning) {
+        size_t bytesRead = fread(buffer.data() + buffered, 1, buffer.size() - buffered, stream);
+        bool endOfInput = bytesRead == 0;
+        buffered += bytesRead;
+
+        size_t offset = 0;
+        if (discarding) {
+            const char* newline = static_cast<const char*>(
+                std::memchr(buffer.data(), '\n', buffered));
+            if (newline == NULL) {
+                buffered = 0;
+                if (endOfInput) {
+                    break;
+                }
+                continue;
+            }
+            offset = static_cast<size_t>(newline - buffer.data()) + 1;
+            discarding = false;
+        }
+
+        size_t consumed = 0;
+        if (!queueInputLines(buffer.data() + offset, buffered - offset, endOfInput,
+            consumed, pending, stats) || !flushInputLines(pending, stats)) {
+            return false;
+        }
+
+        // Lines in pending point into buffer, so they are always flushed
+        // before the unterminated tail is moved to the front.
+        consumed += offset;
+        buffered -= consumed;
+        std::memmove(buffer.data(), buffer.data() + consumed, buffered);
+        if (endOfInput) {
+            break;
+        }
+        if (buffered > MAX_MESSAGE_LENGTH) {
+            stats.skipped++;
+            buffered = 0;
+            discarding = true;
+        }
+    }
+    return ferror(stream) == 0;
+}
+
+bool Client::queueInputLines(const char* data, size_t length, bool endOfInput, size_t& consumed,
+    std::vector<std::string_view>& pending, InputStats& stats) {
+    const size_t FLUSH_LINES = MAX_BATCH_MESSAGES * 8;
+
+    size_t position = 0;
+    while (position < length) {
+        const char* newline = static_cast<const char*>(
+            std::memchr(data + position, '\n', length - position));
+        if (newline == NULL && !endOfInput) {
+            break;
+        }
+
+        size_t end = newline != NULL ? static_cast<size_t>(newline - data) : length;
+        size_t lineLength = end - position;
+        if (lineLength > 0 && data[end - 1] == '\r') {
+            lineLength--;
+        }
+
+        if (lineLength == 0 || lineLength > MAX_MESSAGE_LENGTH) {
+            if (lineLength > 0) {
+                stats.skipped++;
+            }
+        } else {
+            pending.emplace_back(data + position, lineLength);
+            if (pending.size() >= FLUSH_LINES && !flushInputLines(pending, stats)) {
+                return false;
+            }
+        }
+        position = newline != NULL ? end + 1 : length;
+    }
+
+    consumed = position;
+    return true;
+}
+
+bool Client::flushInputLines(std::vector<std::string_view>& pending, InputStats& stats) {
+    if (pending.empty()) {
+        return true;
+    }
+
+    // The server delivers every valid line of a batch in order and names the
+    // ones it rejected, so nothing is sent twice and the input order holds.
+    // A batch the display server did not get ends the transfer there.
+    std::vector<BatchAck> acknowledged;
+    bool transmitted = transmitBatches(pending, acknowledged);
+    for (size_t batch = 0; batch < acknowledged.size(); batch++) {
+        const BatchAck& ack = acknowledged[batch];
+        size_t first = batch * MAX_BATCH_MESSAGES;
+        size_t count = std::min(MAX_BATCH_MESSAGES, pending.size() - first);
+        if (ack.status == BATCH_UNDELIVERED) {
+            std::cerr << "Display server did not get the batch starting at input line: "
+                << pending[first] << std::endl;
+            stats.lines += ack.delivered;
+            pending.clear();
+            return false;
+        }
+
+        size_t next = 0;
+        for (size_t i = 0; i < count; i++) {
+            if (next < ack.dropped.size() && ack.dropped[next] == i) {
+                std::cerr << "Server rejected input line: " << pending[first + i] << std::endl;
+                stats.rejected++;
+                next++;
+                continue;
+            }
+            stats.lines++;
+            stats.bytes += pending[first + i].size();
+        }
+    }
+    pending.clear();
+    return transmitted;
+}
+
+void Client::disconnect() {
+    isRunning = false;
+    if (clientSocket != -1) {
+        transport::shutdownSocket(clientSocket);
+        transport::closeSocket(clientSocket);
+        clientSocket = -1;
+    }
+    transport::cleanup();
+}
+
 bool Client::sendData(const std::string& data) {
+    unreadAcknowledgement.reset();
     for (int attempt = 0; attempt < 3; attempt++) {
         if (clientSocket == -1 && !connectToServer()) {
             std::this_thread::sleep_for(std::chrono::milliseconds(500));
             continue;
         }
 
-        uint32_t dataLength = static_cast<uint32_t>(data.size());
-        uint32_t networkLength = htonl(dataLength);
+        uint64_t traceId = traceSampler.sample() ? newTraceId() : 0;
 
-        if (sendTCPData(clientSocket, reinterpret_cast<const char*>(&networkLength),
-            sizeof(networkLength)) <= 0 ||
-            sendTCPData(clientSocket, data.c_str(), data.size()) <= 0) {
+        TraceSpan sendSpan(traceId, TRACE_CLIENT_SEND);
+        if (!transport::sendFrame(clientSocket, 0, data, traceId)) {
             disconnect();
             continue;
         }
+        sendSpan.finish();
 
-        return receiveAcknowledgement();
+        TraceSpan ackSpan(traceId, TRACE_CLIENT_ACK);
+        bool acknowledged = readAcknowledgement();
+        unreadAcknowledgement = acknowledged;
+        return acknowledged;
     }
     return false;
 }
 
-bool Client::receiveAcknowledgement() {
-    const int BUFFER_SIZE = 32;
-    char buffer[BUFFER_SIZE];
+bool Client::sendBatch(std::span<const std::string_view> messages) {
+    std::vector<BatchAck> acknowledged;
+    if (!transmitBatches(messages, acknowledged)) {
+        return false;
+    }
+    for (const BatchAck& ack : acknowledged) {
+        if (ack.status != BATCH_DELIVERED) {
+            return false;
+        }
+    }
+    return true;
+}
 
-    int bytesReceived = receiveTCPData(clientSocket, buffer, BUFFER_SIZE - 1);
-    if (bytesReceived <= 0) {
+bool Client::transmitBatches(std::span<const std::string_view> messages, std::vector<BatchAck>& acknowledged) {
+    const size_t MAX_BATCHES_IN_FLIGHT = 8;
+
+    acknowledged.clear();
+    if (messages.empty()) {
+        return true;
+    }
+    if (clientSocket == -1 && !connectToServer()) {
         return false;
     }
 
-    buffer[bytesReceived] = '\0';
-    return std::string(buffer) == "OK";
-}
+    // Batches are pipelined: up to MAX_BATCHES_IN_FLIGHT of them are written
+    // before the first batch-ack is read back.
+    struct InFlightBatch {
+        size_t count;
+        uint64_t sentAt;
+        std::vector<uint64_t> traceIds;
+    };
+    std::deque<InFlightBatch> inFlight;
+    size_t next = 0;
+    bool undelivered = false;
 
+    while ((next < messages.size() && !undelivered) || !inFlight.empty()) {
+        if (next < messages.size() && !undelivered && inFlight.size() < MAX_BATCHES_IN_FLIGHT) {
+            size_t count = std::min(MAX_BATCH_MESSAGES, messages.size() - next);
+            std::vector<uint64_t> traceIds;
+            if (!sendBatchFrames(messages, next, count, traceIds)) {
+                disconnect();
+                return false;
+            }
+            uint64_t sentAt = traceIds.empty() ? 0 : traceClock();
+            inFlight.push_back({ count, sentAt, std::move(traceIds) });
+            next += count;
+            continue;
+        }
+
+        const InFlightBatch& batch = inFlight.front();
+        BatchAck ack;
+        if (!receiveBatchAcknowledgement(batch.count, ack)) {
+            disconnect();
+            return false;
+        }
+        undelivered = undelivered || ack.status == BATCH_UNDELIVERED;
+        acknowledged.push_back(std::move(ack));
 
-int Client::createTCPSocket() {
-    int sock = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
-    if (sock == -1) {
-        std::cerr << "Failed to create TCP socket" << std::endl;
+        if (!batch.traceIds.empty() && isTracing()) {
+            uint64_t now = traceClock();
+            for (uint64_t traceId : batch.traceIds) {
+                recordTraceSpan(traceId, TRACE_CLIENT_ACK, batch.sentAt, now);
+            }
+        }
+        inFlight.pop_front();
     }
-    return sock;
+    return true;
 }
 
-bool Client::connectTCPSocket(int socket, const std::string& host, int port) {
-    #ifdef _WIN32
-    sockaddr_in serverAddress;
-    serverAddress.sin_family = AF_INET;
-    serverAddress.sin_port = htons(port);
-    serverAddress.sin_addr.s_addr = inet_addr(host.c_str());
-    #else
-    sockaddr_in serverAddress = {};
-    serverAddress.sin_family = AF_INET;
-    serverAddress.sin_port = htons(port);
-    inet_pton(AF_INET, host.c_str(), &serverAddress.sin_addr);
-    #endif
+bool Client::sendBatchFrames(std::span<const std::string_view> messages,
+    size_t first, size_t count, std::vector<uint64_t>& traceIds) {
+    std::vector<char> headers((count + 1) * transport::MAX_FRAME_HEADER_SIZE);
+    std::vector<FrameSlice> slices;
+    slices.reserve(count * 2 + 1);
 
-    if (connect(socket, (struct sockaddr*)&serverAddress, sizeof(serverAddress)) < 0) {
-        #ifdef _WIN32
-        std::cerr << "Failed to connect to " << host << ":" << port
-            << " - Error: " << WSAGetLastError() << std::endl;
-        #else
-        std::cerr << "Failed to connect to " << host << ":" << port
-            << " - Error: " << strerror(errno) << std::endl;
-        #endif
+    size_t batchHeaderSize = transport::encodeFrameHeader(FRAME_FLAG_BATCH,
+        static_cast<uint32_t>(count), 0, headers.data());
+    slices.push_back({ headers.data(), batchHeaderSize });
+
+    for (size_t i = 0; i < count; i++) {
+        uint64_t traceId = 0;
+        if (traceSampler.sample()) {
+            traceId = newTraceId();
+            traceIds.push_back(traceId);
+        }
+        char* header = &headers[(i + 1) * transport::MAX_FRAME_HEADER_SIZE];
+        transport::appendFrame(slices, header, 0, messages[first + i], traceId);
+    }
+
+    uint64_t startedAt = !traceIds.empty() && isTracing() ? traceClock() : 0;
+    if (!transport::sendVector(clientSocket, slices)) {
         return false;
     }
+    if (startedAt != 0) {
+        uint64_t now = traceClock();
+        for (uint64_t traceId : traceIds) {
+            recordTraceSpan(traceId, TRACE_CLIENT_SEND, startedAt, now);
+        }
+    }
     return true;
 }
 
-int Client::sendTCPData(int socket, const char* data, size_t length) {
-    #ifdef _WIN32
-    return send(socket, data, static_cast<int>(length), 0);
-    #else
-    return send(socket, data, length, 0);
-    #endif
+bool Client::receiveBatchAcknowledgement(size_t batchSize, BatchAck& ack) {
+    char buffer[BATCH_ACK_SIZE];
+    if (!transport::receiveExact(clientSocket, buffer, BATCH_ACK_SIZE)) {
+        return false;
+    }
+    uint8_t status = static_cast<uint8_t>(buffer[2]);
+    uint32_t networkCount;
+    std::memcpy(&networkCount, buffer + 3, sizeof(networkCount));
+    ack.status = static_cast<BatchAckStatus>(status);
+    ack.delivered = ntohl(networkCount);
+    ack.dropped.clear();
+    if (buffer[0] != BATCH_ACK_TAG[0] || buffer[1] != BATCH_ACK_TAG[1] || status > BATCH_UNDELIVERED ||
+        ack.delivered > batchSize) {
+        std::cerr << "Malformed batch acknowledgement" << std::endl;
+        return false;
+    }
+    if (status != BATCH_INVALID) {
+        return true;
+    }
+
+    std::vector<uint32_t> indices(batchSize - ack.delivered);
+    if (!transport::receiveExact(clientSocket, reinterpret_cast<char*>(indices.data()),
+        indices.size() * sizeof(uint32_t))) {
+        return false;
+    }
+    for (uint32_t index : indices) {
+        index = ntohl(index);
+        if (index >= batchSize || (!ack.dropped.empty() && index <= ack.dropped.back())) {
+            std::cerr << "Malformed batch acknowledgement" << std::endl;
+            return false;
+        }
+        ack.dropped.push_back(index);
+    }
+    return true;
 }
 
-int Client::receiveTCPData(int socket, char* buffer, size_t length) {
-    #ifdef _WIN32
-    return recv(socket, buffer, static_cast<int>(length), 0);
-    #else
-    return recv(socket, buffer, length, 0);
-    #endif
+bool Client::receiveAcknowledgement() {
+    if (unreadAcknowledgement.has_value()) {
+        bool acknowledged = *unreadAcknowledgement;
+        unreadAcknowledgement.reset();
+        return acknowledged;
+    }
+    return readAcknowledgement();
 }
 
-void Client::closeTCPSocket(int socket) {
-    if (socket != -1) {
-    #ifdef _WIN32
-        closesocket(socket);
-    #else
-        close(socket);
-    #endif
+bool Client::readAcknowledgement() {
+    char buffer[ACK_SIZE];
+    if (clientSocket == -1 || !transport::receiveExact(clientSocket, buffer, sizeof(buffer))) {
+        return false;
     }
-}
\ No newline at end of file
+    return isPositiveAcknowledgement(buffer);
+}
+
+void Client::setTraceSampleRate(double rate) {
+    traceSampler.setRate(rate);
+}
+
+void Client::setConnectionOptions(const std::string& options) {
+    connectionOptions = options;
+}
+
+bool Client::sendConnectionOptions() {
+    return transport::sendFrame(clientSocket, FRAME_FLAG_OPTIONS, connectionOptions)
+        && readAcknowledgement();
+}
@@ -0,0 +1,136 @@
+#include "../include/connection.hpp"
+#include "../include/transport.hpp"
+#include <cerrno>
+#include <thread>
+
+Task<bool> Connection::receiveFrameHeader(transport::FrameHeader& header) {
+	char lengthWord[sizeof(uint32_t)];
+	bool received = co_await receiveExact(lengthWord, sizeof(lengthWord));
+	if (!received) {
+		co_return false;
+	}
+	header = transport::decodeLengthWord(lengthWord);
+	if (header.flags & FRAME_FLAG_TRACE) {
+		char encodedTraceId[TRACE_ID_SIZE];
+		received = co_await receiveExact(encodedTraceId, TRACE_ID_SIZE);
+		if (!received) {
+			co_return false;
+		}
+		header.traceId = decodeTraceId(encodedTraceId);
+	}
+	co_return true;
+}
+
+Task<bool> BlockingConnection::receiveExact(char* buffer, size_t length) {
+	co_return transport::receiveExact(clientSocket, buffer, length);
+}
+
+Task<bool> BlockingConnection::discard(size_t length) {
+	co_return transport::discard(clientSocket, length);
+}
+
+Task<bool> BlockingConnection::sendAll(const char* data, size_t length) {
+	co_return transport::sendAll(clientSocket, data, length);
+}
+
+Task<bool> BlockingConnection::fillRelay(SpliceRelay& relay, size_t length) {
+	while (length > 0) {
+		ssize_t moved = relay.fill(clientSocket, length);
+		if (moved <= 0) {
+			co_return false;
+		}
+		length -= static_cast<size_t>(moved);
+	}
+	co_return true;
+}
+
+Task<bool> BlockingConnection::sendVectorTo(int socket, const std::vector<FrameSlice>& slices) {
+	co_return transport::sendVector(socket, slices);
+}
+
+Task<bool> BlockingConnection::drainRelayTo(SpliceRelay& relay, int socket) {
+	co_return relay.drainTo(socket);
+}
+
+Task<AsyncMutex::Guard> BlockingConnection::lock(AsyncMutex& mutex) {
+	co_return mutex.lock();
+}
+
+Task<void> BlockingConnection::sleepFor(std::chrono::milliseconds delay) {
+	std::this_thread::sleep_for(delay);
+	co_return;
+}
+
+Task<void> BlockingConnection::submit(SchedulerSession& session, size_t cost, FairScheduler::Job job) {
+	session.submit(cost, std::move(job));
+	co_return;
+}
+
+Task<void> BlockingConnection::drain(SchedulerSession& session) {
+	session.drain();
+	co_return;
+}
+
+#ifndef _WIN32
+Task<bool> LoopConnection::receiveExact(char* buffer, size_t length) {
+	return asyncReceiveExact(loop, clientSocket, buffer, length);
+}
+
+Task<bool> LoopConnection::discard(size_t length) {
+	return asyncDiscard(loop, clientSocket, length);
+}
+
+Task<bool> LoopConnection::sendAll(const char* data, size_t length) {
+	return asyncSendAll(loop, clientSocket, data, length);
+}
+
+Task<bool> LoopConnection::fillRelay(SpliceRelay& relay, size_t length) {
+	while (length > 0) {
+		ssize_t moved = relay.fill(clientSocket, length);
+		if (moved > 0) {
+			length -= static_cast<size_t>(moved);
+		} else if (moved < 0 && errno == EAGAIN) {
+			co_await loop.readable(clientSocket);
+		} else {
+			co_return false;
+		}
+	}
+	co_return true;
+}
+
+Task<bool> LoopConnection::sendVectorTo(int socket, const std::vector<FrameSlice>& slices) {
+	return asyncSendVector(loop, socket, slices);
+}
+
+Task<bool> LoopConnection::drainRelayTo(SpliceRelay& relay, int socket) {
+	for (;;) {
+		if (!relay.drainSome(socket)) {
+			co_return false;
+		}
+		if (relay.buffered() == 0) {
+			co_return true;
+		}
+		co_await loop.writable(socket);
+	}
+}
+
+Task<AsyncMutex::Guard> LoopConnection::lock(AsyncMutex& mutex) {
+	return asyncLock(loop, mutex);
+}
+
+Task<void> LoopConnection::sleepFor(std::chrono::milliseconds delay) {
+	co_await loop.sleepFor(delay);
+}
+
+Task<void> LoopConnection::submit(SchedulerSession& session, size_t cost, FairScheduler::Job job) {
+	co_await asyncRetry(loop,
+		[&session, cost, &job](std::function<void()> wake) { return session.trySubmit(cost, job, std::move(wake)); },
+		[&session]() { session.cancelWake(); });
+}
+
+Task<void> LoopConnection::drain(SchedulerSession& session) {
+	co_await asyncRetry(loop,
+		[&session](std::function<void()> wake) { return session.tryDrain(std::move(wake)); },
+		[&session]() { session.cancelWake(); });
+}
+#endif
@@ -0,0 +1,161 @@
+#include "../include/dictionary.hpp"
+#include <cstring>
+
+void appendVarint(std::string& out, uint32_t value) {
+	while (value >= 0x80) {
+		out.push_back(static_cast<char>((value & 0x7F) | 0x80));
+		value >>= 7;
+	}
+	out.push_back(static_cast<char>(value));
+}
+
+bool readVarint(const char*& data, const char* end, uint32_t& value) {
+	value = 0;
+	for (int shift = 0; shift < 35 && data < end; shift += 7) {
+		uint8_t byte = static_cast<uint8_t>(*data++);
+		value |= static_cast<uint32_t>(byte & 0x7F) << shift;
+		if ((byte & 0x80) == 0) {
+			return true;
+		}
+	}
+	return false;
+}
+
+WordEncoder::WordEncoder(size_t capacity)
+	: capacity(capacity), committed(0) {
+}
+
+void WordEncoder::encode(std::string_view text, std::string& out) {
+	size_t position = 0;
+	while (position < text.size()) {
+		size_t end = text.find(' ', position);
+		if (end == std::string_view::npos) {
+			end = text.size();
+		}
+
+		std::string_view word = text.substr(position, end - position);
+		position = end + 1;
+		if (word.empty()) {
+			continue;
+		}
+
+		auto it = ids.find(word);
+		if (it != ids.end()) {
+			appendVarint(out, it->second + DICTIONARY_FIRST_ID_TOKEN);
+			continue;
+		}
+
+		if (ids.size() < capacity) {
+			ids.emplace(std::string(word), static_cast<uint32_t>(ids.size()));
+			appendVarint(out, DICTIONARY_TOKEN_DEFINE);
+		} else {
+			appendVarint(out, DICTIONARY_TOKEN_LITERAL);
+		}
+		appendVarint(out, static_cast<uint32_t>(word.size()));
+		out.append(word.data(), word.size());
+	}
+}
+
+void WordEncoder::commit() {
+	committed = ids.size();
+}
+
+// Failed sends are rare, so the staged words are found by scanning the map
+// rather than tracked on every encode().
+void WordEncoder::rollback() {
+	if (ids.size() == committed) {
+		return;
+	}
+	for (auto it = ids.begin(); it != ids.end();) {
+		if (it->second >= committed) {
+			it = ids.erase(it);
+		} else {
+			++it;
+		}
+	}
+}
+
+void WordEncoder::reset() {
+	ids.clear();
+	committed = 0;
+}
+
+WordTable::WordTable(size_t capacity)
+	: capacity(capacity),
+	chunks(new std::atomic<std::string*>[(capacity + CHUNK_SIZE - 1) / CHUNK_SIZE]),
+	count(0) {
+
+	for (size_t i = 0; i < (capacity + CHUNK_SIZE - 1) / CHUNK_SIZE; i++) {
+		chunks[i].store(nullptr, std::memory_order_relaxed);
+	}
+}
+
+WordTable::~WordTable() {
+	for (size_t i = 0; i < (capacity + CHUNK_SIZE - 1) / CHUNK_SIZE; i++) {
+		delete[] chunks[i].load(std::memory_order_relaxed);
+	}
+}
+
+bool WordTable::add(std::string_view word) {
+	size_t id = count.load(std::memory_order_relaxed);
+	if (id >= capacity) {
+		return false;
+	}
+
+	std::string* chunk = chunks[id >> CHUNK_BITS].load(std::memory_order_relaxed);
+	if (chunk == nullptr) {
+		chunk = new std::string[CHUNK_SIZE];
+		chunks[id >> CHUNK_BITS].store(chunk, std::memory_order_release);
+	}
+	chunk[id & (CHUNK_SIZE - 1)].assign(word.data(), word.size());
+	count.store(id + 1, std::memory_order_release);
+	return true;
+}
+
+bool WordTable::lookup(uint32_t id, std::string_view& word) const {
+	if (id >= count.load(std::memory_order_acquire)) {
+		return false;
+	}
+	const std::string* chunk = chunks[id >> CHUNK_BITS].load(std::memory_order_acquire);
+	word = chunk[id & (CHUNK_SIZE - 1)];
+	return true;
+}
+
+bool WordTable::decode(const char* data, size_t length, std::string& out) {
+	const char* end = data + length;
+	out.clear();
+
+	while (data < end) {
+		uint32_t token;
+		if (!readVarint(data, end, token)) {
+			return false;
+		}
+
+		if (!out.empty()) {
+			out.push_back(' ');
+		}
+
+		if (token >= DICTIONARY_FIRST_ID_TOKEN) {
+			std::string_view word;
+			if (!lookup(token - DICTIONARY_FIRST_ID_TOKEN, word)) {
+				return false;
+			}
+			out.append(word.data(), word.size());
+			continue;
+		}
+
+		uint32_t wordLength;
+		if (!readVarint(data, end, wordLength) || wordLength == 0 ||
+			wordLength > static_cast<size_t>(end - data)) {
+			return false;
+		}
+
+		std::string_view word(data, wordLength);
+		data += wordLength;
+		if (token == DICTIONARY_TOKEN_DEFINE && !add(word)) {
+			return false;
+		}
+		out.append(word.data(), word.size());
+	}
+	return true;
+}
@@ -1,6 +1,7 @@
 #include "../include/servers.hpp"
 #include <iostream>
 #include <cstring>
+#include <charconv>
 
 #ifdef _WIN32
 #include <winsock2.h>
@@ -12,15 +13,15 @@
 #include <arpa/inet.h>
 #endif
 
-DisplayServer::DisplayServer(int port)
-	: serverPort(port), isRunning(false), serverSocket(-1) {
+// Words printed by each periodic snapshot.
+const size_t SNAPSHOT_WORDS = 10;
+// Longest query line accepted before the connection is dropped.
+const size_t QUERY_MAX_LINE = 1024;
 
-	#ifdef _WIN32
-	WSADATA wsaData;
-	if (WSAStartup(MAKEWORD(2, 2), &wsaData) != 0) {
-		std::cerr << "WSAStartup failed" << std::endl;
-	}
-	#endif
+DisplayServer::DisplayServer(int port)
+	: serverPort(port), isRunning(false), serverSocket(-1), activeClientSocket(-1),
+	snapshotInterval(0), queryServerPort(-1), querySocket(-1), activeQuerySocket(-1) {
+	transport::startup();
 }
 
 DisplayServer::~DisplayServer() {
@@ -28,146 +29,256 @@ DisplayServer::~DisplayServer() {
 }
 
 void DisplayServer::start() {
-	serverSocket = createTCPSocket();
+	serverSocket = transport::listenOn(listenHost, serverPort);
 	if (serverSocket == -1) {
-		std::cerr << "Failed to create TCP socket" << std::endl;
-	}
-
-	if (!bindTCPSocket(serverSocket, serverPort)) {
-		std::cerr << "Failed to bind TCP socket to port " << serverPort << std::endl;
-		closeTCPSocket(serverSocket);
 		return;
 	}
 
-	if (!startTCPListening(serverSocket)) {
-		std::cerr << "Failed to start TCP listening" << std::endl;
-		closeTCPSocket(serverSocket);
-		return;
+	if (statistics && queryServerPort >= 0) {
+		querySocket = transport::listenOn(queryHost, queryServerPort);
+		if (querySocket == -1) {
+			transport::closeSocket(serverSocket);
+			return;
+		}
+		queryServerPort = transport::boundPort(querySocket);
 	}
 
+	serverPort = transport::boundPort(serverSocket);
 	isRunning = true;
-	std::cout << "TCP Display Server started on port " << serverPort << std::endl;
+	std::cout << "Display Server listening on " << transport::formatAddress(listenHost, serverPort) << std::endl;
+
+	std::thread queryThread;
+	std::thread snapshotThread;
+	if (querySocket != -1) {
+		std::cout << "Word statistics queries on " << transport::formatAddress(queryHost, queryServerPort) << std::endl;
+		queryThread = std::thread(&DisplayServer::serveQueries, this);
+	}
+	if (statistics && snapshotInterval.count() > 0) {
+		snapshotThread = std::thread(&DisplayServer::printSnapshots, this);
+	}
+	if (readyCallback) {
+		readyCallback(serverPort);
+	}
 
 	while (isRunning) {
-		int clientSocket = acceptTCPConnection(serverSocket);
+		int clientSocket = transport::accept(serverSocket);
 		if (clientSocket == -1) {
 			if (isRunning) {
-				std::cerr << "Failed to accept TCP connection" << std::endl;
+				std::cerr << "Failed to accept connection" << std::endl;
 			}
 			continue;
 		}
 
-		handleClient(clientSocket);
-		closeTCPSocket(clientSocket);
+		activeClientSocket = clientSocket;
+		if (isRunning) {
+			handleClient(clientSocket);
+		} else {
+			transport::closeSocket(clientSocket);
+		}
+		activeClientSocket = -1;
 	}
 
-	closeTCPSocket(serverSocket);
-
-	#ifdef _WIN32
-	WSACleanup();
-	#endif
+	if (queryThread.joinable()) {
+		queryThread.join();
+	}
+	if (snapshotThread.joinable()) {
+		snapshotThread.join();
+	}
+	transport::closeSocket(querySocket);
+	querySocket = -1;
+	transport::closeSocket(serverSocket);
+	transport::cleanup();
 }
 
 void DisplayServer::stop() {
 	isRunning = false;
-	#ifdef _WIN32
-	shutdown(serverSocket, SD_BOTH);
-	#else 
-	shutdown(serverSocket, SD_RDWR);
-	#endif
+	{
+		std::lock_guard<std::mutex> lock(snapshotMutex);
+	}
+	snapshotWakeup.notify_all();
+	transport::shutdownSocket(serverSocket);
+	transport::shutdownSocket(activeClientSocket.exchange(-1));
+	transport::shutdownSocket(querySocket);
+	transport::shutdownSocket(activeQuerySocket.exchange(-1));
 }
 
-void DisplayServer::handleClient(int clientSocket) {
-	while (isRunning) {
-		try {
-			uint32_t dataLength;
-			int bytesReceived = receiveTCPData(clientSocket,
-				reinterpret_cast<char*>(&dataLength), sizeof(dataLength));
+std::shared_ptr<const WordTable> DisplayServer::wordTable() const {
+	return std::atomic_load(&currentWordTable);
+}
 
-			if (bytesReceived <= 0) break;
+void DisplayServer::setReadyCallback(ReadyCallback callback) {
+	readyCallback = std::move(callback);
+}
 
-			dataLength = ntohl(dataLength);
-			std::vector<char> buffer(dataLength + 1);
+void DisplayServer::setMessageHandler(MessageHandler handler) {
+	messageHandler = std::move(handler);
+}
+
+void DisplayServer::setListenAddress(const std::string& host) {
+	listenHost = host;
+}
 
-			bytesReceived = receiveTCPData(clientSocket, buffer.data(), dataLength);
-			if (bytesReceived <= 0) break;
+void DisplayServer::enableWordStatistics(const SketchConfig& config) {
+	statistics = std::make_shared<WordFrequencySketch>(config);
+}
+
+std::shared_ptr<const WordFrequencySketch> DisplayServer::wordStatistics() const {
+	return statistics;
+}
+
+void DisplayServer::setSnapshotInterval(std::chrono::seconds interval) {
+	snapshotInterval = interval;
+}
 
-			buffer[bytesReceived] = '\0';
-			std::cout << "Received: " << buffer.data() << std::endl;
+void DisplayServer::setQueryAddress(const std::string& host, int port) {
+	queryHost = host;
+	queryServerPort = port;
+}
+
+int DisplayServer::queryPort() const {
+	return queryServerPort;
+}
+
+void DisplayServer::countWords(std::string_view text) {
+	forEachWord(text, false, [this](std::string_view word) {
+		statistics->add(word);
+	});
+}
+
+std::string DisplayServer::answerQuery(const WordFrequencySketch& statistics, std::string_view query) {
+	while (!query.empty() && isAsciiWhitespace(static_cast<unsigned char>(query.back()))) {
+		query.remove_suffix(1);
+	}
+	size_t space = query.find(' ');
+	std::string_view command = query.substr(0, space);
+	std::string_view argument = space == std::string_view::npos ? std::string_view() : query.substr(space + 1);
+
+	std::string answer;
+	if (command == "TOP") {
+		size_t count = statistics.config().topK;
+		if (!argument.empty()) {
+			auto parsed = std::from_chars(argument.data(), argument.data() + argument.size(), count);
+			if (parsed.ec != std::errc() || parsed.ptr != argument.data() + argument.size()) {
+				return "ERROR expected TOP [n]\n";
+			}
 		}
-		catch (...) {
-			break;
+		for (const WordCount& entry : statistics.top(count)) {
+			answer += entry.word + " " + std::to_string(entry.count) + "\n";
 		}
+		answer += "END\n";
+	}
+	else if (command == "COUNT" && !argument.empty()) {
+		answer = std::string(argument) + " " + std::to_string(statistics.estimate(argument)) + "\n";
+	}
+	else if (command == "TOTAL" && argument.empty()) {
+		answer = std::to_string(statistics.total()) + "\n";
+	}
+	else {
+		answer = "ERROR expected TOP [n], COUNT <word> or TOTAL\n";
 	}
-	closeTCPSocket(clientSocket);
+	return answer;
 }
 
-int DisplayServer::createTCPSocket() {
-	int sock = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
-	if (sock == -1) {
-		std::cerr << "Failed to create TCP socket" << std::endl;
+void DisplayServer::serveQueries() {
+	while (isRunning) {
+		int clientSocket = transport::accept(querySocket);
+		if (clientSocket == -1) {
+			if (isRunning) {
+				std::cerr << "Failed to accept query connection" << std::endl;
+			}
+			continue;
+		}
+
+		activeQuerySocket = clientSocket;
+		if (isRunning) {
+			handleQueryClient(clientSocket);
+		}
+		activeQuerySocket = -1;
+		transport::closeSocket(clientSocket);
 	}
-	return sock;
 }
 
-bool DisplayServer::bindTCPSocket(int socket, int port) {
-	#ifdef _WIN32
-	sockaddr_in serverAddress;
-	serverAddress.sin_family = AF_INET;
-	serverAddress.sin_port = htons(port);
-	serverAddress.sin_addr.s_addr = INADDR_ANY;
-	#else
-	sockaddr_in serverAddress = {};
-	serverAddress.sin_family = AF_INET;
-	serverAddress.sin_port = htons(port);
-	serverAddress.sin_addr.s_addr = INADDR_ANY;
-	#endif
+void DisplayServer::handleQueryClient(int clientSocket) {
+	std::string pending;
+	char buffer[512];
+	while (isRunning) {
+		ssize_t received = transport::receiveSome(clientSocket, buffer, sizeof(buffer));
+		if (received <= 0) {
+			return;
+		}
+		pending.append(buffer, static_cast<size_t>(received));
 
-	if (bind(socket, (struct sockaddr*)&serverAddress, sizeof(serverAddress)) < 0) {
-		std::cerr << "Failed to bind TCP socket to port " << port << std::endl;
-		return false;
+		size_t end;
+		while ((end = pending.find('\n')) != std::string::npos) {
+			std::string answer = answerQuery(*statistics, std::string_view(pending).substr(0, end));
+			pending.erase(0, end + 1);
+			if (!transport::sendAll(clientSocket, answer.data(), answer.size())) {
+				return;
+			}
+		}
+		if (pending.size() > QUERY_MAX_LINE) {
+			std::cerr << "Query line too long, closing query connection" << std::endl;
+			return;
+		}
 	}
-	return true;
 }
 
-bool DisplayServer::startTCPListening(int socket) {
-	if (listen(socket, SOMAXCONN) < 0) {
-		std::cerr << "Failed to start TCP listening" << std::endl;
-		return false;
+void DisplayServer::printSnapshots() {
+	std::unique_lock<std::mutex> lock(snapshotMutex);
+	while (!snapshotWakeup.wait_for(lock, snapshotInterval, [this] { return !isRunning; })) {
+		std::string line = "Top words of " + std::to_string(statistics->total()) + ":";
+		for (const WordCount& entry : statistics->top(SNAPSHOT_WORDS)) {
+			line += " " + entry.word + "=" + std::to_string(entry.count);
+		}
+		std::cout << line << std::endl;
 	}
-	return true;
 }
 
-int DisplayServer::acceptTCPConnection(int socket) {
-	#ifdef _WIN32
-	sockaddr_in clientAddress;
-	int clientAddressSize = sizeof(clientAddress);
-	#else
-	sockaddr_in clientAddress = {};
-	socklen_t clientAddressSize = sizeof(clientAddress);
-	#endif
+void DisplayServer::handleClient(int clientSocket) {
+	auto table = std::make_shared<WordTable>();
+	std::atomic_store(&currentWordTable, std::shared_ptr<const WordTable>(table));
+	std::string decoded;
 
-	int clientSocket = accept(socket, (struct sockaddr*)&clientAddress, &clientAddressSize);
-	if (clientSocket < 0) {
-		std::cerr << "Failed to accept TCP connection" << std::endl;
-	}
-	return clientSocket;
-}
+	while (isRunning) {
+		try {
+			transport::FrameHeader header;
+			if (!transport::receiveFrameHeader(clientSocket, header)) {
+				break;
+			}
+			uint32_t dataLength = header.length;
+			uint64_t traceId = header.traceId;
 
-int DisplayServer::receiveTCPData(int socket, char* buffer, size_t length) {
-	#ifdef _WIN32
-	return recv(socket, buffer, static_cast<int>(length), 0);
-	#else
-	return recv(socket, buffer, length, 0);
-	#endif
-}
+			TraceSpan receiveSpan(traceId, TRACE_DISPLAY_RECEIVE);
+			std::vector<char> buffer(dataLength + 1);
+			if (!transport::receiveExact(clientSocket, buffer.data(), dataLength)) {
+				break;
+			}
 
-void DisplayServer::closeTCPSocket(int socket) {
-	if (socket != -1) {
-		#ifdef _WIN32
-		closesocket(socket);
-		#else
-		close(socket);
-		#endif
+			buffer[dataLength] = '\0';
+			std::string_view text(buffer.data(), dataLength);
+			if (header.flags & FRAME_FLAG_DICTIONARY) {
+				if (!table->decode(buffer.data(), dataLength, decoded)) {
+					std::cerr << "Malformed dictionary-encoded frame" << std::endl;
+					break;
+				}
+				text = decoded;
+			}
+			receiveSpan.finish();
+
+			if (statistics) {
+				countWords(text);
+			}
+
+			TraceSpan outputSpan(traceId, TRACE_DISPLAY_OUTPUT);
+			if (messageHandler) {
+				messageHandler(text);
+			} else {
+				std::cout << "Received: " << text << std::endl;
+			}
+		}
+		catch (...) {
+			break;
+		}
 	}
-}
\ No newline at end of file
+	transport::closeSocket(clientSocket);
+}
@@ -0,0 +1,92 @@
+#include "../include/lifecycle.hpp"
+#include <iostream>
+#include <cstring>
+#include <cstdlib>
+#include <string>
+#include <algorithm>
+#include <cstddef>
+#include <cerrno>
+
+#ifndef _WIN32
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+ReadinessLatch::ReadinessLatch()
+	: signaled(false), readyPort(0) {
+}
+
+void ReadinessLatch::signal(int port) {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		signaled = true;
+		readyPort = port;
+	}
+	ready.notify_all();
+}
+
+bool ReadinessLatch::waitFor(std::chrono::milliseconds timeout) {
+	std::unique_lock<std::mutex> lock(mutex);
+	return ready.wait_for(lock, timeout, [this]() { return signaled; });
+}
+
+int ReadinessLatch::port() const {
+	std::lock_guard<std::mutex> lock(mutex);
+	return readyPort;
+}
+
+Backoff::Backoff(std::chrono::milliseconds initial, std::chrono::milliseconds maximum)
+	: initial(initial), maximum(maximum), current(initial), random(std::random_device()()) {
+}
+
+std::chrono::milliseconds Backoff::next() {
+	long long window = current.count();
+	std::uniform_int_distribution<long long> jitter(window / 2, window);
+	std::chrono::milliseconds delay(jitter(random));
+
+	current = std::min(current * 2, maximum);
+	return delay;
+}
+
+void Backoff::reset() {
+	current = initial;
+}
+
+bool notifyServiceManager(const char* state) {
+	#ifdef _WIN32
+	(void)state;
+	return false;
+	#else
+	const char* path = std::getenv("NOTIFY_SOCKET");
+	if (path == NULL || path[0] == '\0') {
+		return false;
+	}
+
+	sockaddr_un address = {};
+	address.sun_family = AF_UNIX;
+	size_t length = std::strlen(path);
+	if (length >= sizeof(address.sun_path)) {
+		return false;
+	}
+	std::memcpy(address.sun_path, path, length);
+	if (address.sun_path[0] == '@') {
+		// Abstract namespace socket.
+		address.sun_path[0] = '\0';
+	}
+
+	int sock = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+	if (sock < 0) {
+		return false;
+	}
+
+	socklen_t addressLength = static_cast<socklen_t>(offsetof(sockaddr_un, sun_path) + length);
+	bool sent = sendto(sock, state, std::strlen(state), MSG_NOSIGNAL,
+		reinterpret_cast<sockaddr*>(&address), addressLength) >= 0;
+	if (!sent) {
+		std::cerr << "Failed to notify service manager: " << strerror(errno) << std::endl;
+	}
+	close(sock);
+	return sent;
+	#endif
+}
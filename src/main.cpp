@@ -2,10 +2,12 @@
 #include "../include/servers.hpp"
 #include <iostream>
 #include <string>
+#include <vector>
 #include <thread>
 #include <memory>
 #include <csignal>
 #include <atomic>
+#include <chrono>
 
 #ifdef _WIN32
 #include <windows.h>
@@ -24,45 +26,340 @@ void setupSignalHandlers() {
         }, TRUE);
     #else
     signal(SIGINT, [](int) { isRunning = false; });
+    // A peer that disconnects must fail the write, not end the process.
+    signal(SIGPIPE, SIG_IGN);
     #endif
 }
 
-void runDisplayServer(int port) {
+const std::chrono::milliseconds RESTART_INITIAL_DELAY(50);
+const std::chrono::milliseconds RESTART_MAX_DELAY(5000);
+const std::chrono::seconds HEALTHY_RUN_TIME(30);
+const std::chrono::seconds READY_TIMEOUT(10);
+
+void notifyReady(int) {
+    notifyServiceManager("READY=1");
+}
+
+// Sleeps before the next restart attempt. A server that stayed up for a while
+// starts over from the shortest delay.
+void waitBeforeRestart(const char* name, Backoff& backoff,
+    std::chrono::steady_clock::time_point startedAt) {
+    if (std::chrono::steady_clock::now() - startedAt >= HEALTHY_RUN_TIME) {
+        backoff.reset();
+    }
+    std::chrono::milliseconds delay = backoff.next();
+    std::cerr << "Restarting " << name << " in " << delay.count() << " ms..." << std::endl;
+    std::this_thread::sleep_for(delay);
+}
+
+struct Endpoint {
+    std::string host;
+    int port = 0;
+};
+
+// Servers listen on a port (every interface) or on "unix:/path".
+Endpoint parseListenEndpoint(const std::string& argument) {
+    if (transport::isUnixAddress(argument)) {
+        return { argument, 0 };
+    }
+    return { "", std::stoi(argument) };
+}
+
+// Peers are "<host> <port>" or a single "unix:/path" argument. Returns the
+// index of the first argument after the endpoint, or -1 if it is incomplete.
+int parseRemoteEndpoint(int argc, char* argv[], int index, Endpoint& endpoint) {
+    endpoint.host = argv[index];
+    if (transport::isUnixAddress(endpoint.host)) {
+        return index + 1;
+    }
+    if (index + 1 >= argc) {
+        return -1;
+    }
+    endpoint.port = std::stoi(argv[index + 1]);
+    return index + 2;
+}
+
+struct DisplayOptions {
+    bool wordStatistics = false;
+    SketchConfig sketch;
+    int snapshotSeconds = 0;
+    bool query = false;
+    Endpoint queryEndpoint;
+};
+
+bool parseDisplayOptions(int argc, char* argv[], int first, DisplayOptions& options) {
+    for (int i = first; i < argc; i++) {
+        std::string option = argv[i];
+        if (option == "--top-k" && i + 1 < argc) {
+            options.sketch.topK = static_cast<size_t>(std::stoul(argv[++i]));
+        }
+        else if (option == "--sketch-width" && i + 1 < argc) {
+            options.sketch.width = static_cast<size_t>(std::stoul(argv[++i]));
+        }
+        else if (option == "--sketch-depth" && i + 1 < argc) {
+            options.sketch.depth = static_cast<size_t>(std::stoul(argv[++i]));
+        }
+        else if (option == "--snapshot" && i + 1 < argc) {
+            options.snapshotSeconds = std::stoi(argv[++i]);
+        }
+        else if (option == "--query" && i + 1 < argc) {
+            options.query = true;
+            options.queryEndpoint = parseListenEndpoint(argv[++i]);
+        }
+        else {
+            return false;
+        }
+        options.wordStatistics = true;
+    }
+    return true;
+}
+
+void runDisplayServer(Endpoint endpoint, DisplayOptions options, ReadyCallback onReady) {
+    Backoff backoff(RESTART_INITIAL_DELAY, RESTART_MAX_DELAY);
     while (isRunning) {
+        auto startedAt = std::chrono::steady_clock::now();
         try {
-            DisplayServer server(port);
-            std::cout << "Display Server started on port " << port << std::endl;
+            DisplayServer server(endpoint.port);
+            server.setListenAddress(endpoint.host);
+            server.setReadyCallback(onReady);
+            if (options.wordStatistics) {
+                server.enableWordStatistics(options.sketch);
+                server.setSnapshotInterval(std::chrono::seconds(options.snapshotSeconds));
+                if (options.query) {
+                    server.setQueryAddress(options.queryEndpoint.host, options.queryEndpoint.port);
+                }
+            }
+            std::cout << "Display Server started on "
+                << transport::formatAddress(endpoint.host, endpoint.port) << std::endl;
             server.start();
         }
         catch (const std::exception& e) {
             std::cerr << "Display Server error: " << e.what() << std::endl;
-            std::cerr << "Restarting Display Server in 3 seconds..." << std::endl;
-            std::this_thread::sleep_for(std::chrono::seconds(3));
         }
+        if (isRunning) {
+            waitBeforeRestart("Display Server", backoff, startedAt);
+        }
+    }
+}
+
+struct ProcessingOptions {
+    size_t asyncThreads = 0;
+    bool dictionaryEncoding = false;
+    bool passthrough = false;
+    PipelineConfig pipeline;
+    bool fairScheduling = false;
+    SchedulerConfig scheduler;
+};
+
+// Parses "<interactive>,<normal>,<bulk>".
+bool parseClassValues(const std::string& text, uint64_t values[PRIORITY_CLASS_COUNT]) {
+    size_t start = 0;
+    for (uint32_t i = 0; i < PRIORITY_CLASS_COUNT; i++) {
+        size_t end = text.find(',', start);
+        if ((end == std::string::npos) != (i + 1 == PRIORITY_CLASS_COUNT)) {
+            return false;
+        }
+        values[i] = std::stoull(text.substr(start, end - start));
+        start = end + 1;
     }
+    return true;
 }
 
-void runProcessingServer(int port, const std::string& displayHost, int displayPort) {
+bool parseProcessingOptions(int argc, char* argv[], int first, ProcessingOptions& options) {
+    for (int i = first; i < argc; i++) {
+        std::string option = argv[i];
+        if (option == "--async" && i + 1 < argc) {
+            options.asyncThreads = static_cast<size_t>(std::stoul(argv[++i]));
+        }
+        else if (option == "--dictionary") {
+            options.dictionaryEncoding = true;
+        }
+        else if (option == "--passthrough") {
+            options.passthrough = true;
+        }
+        else if (option == "--unicode") {
+            options.pipeline.unicodeWhitespace = true;
+        }
+        else if (option == "--casefold") {
+            options.pipeline.stages |= PIPELINE_LOWERCASE;
+        }
+        else if (option == "--stop-words" && i + 1 < argc) {
+            std::string words = argv[++i];
+            size_t start = 0;
+            while (start <= words.size()) {
+                size_t end = words.find(',', start);
+                if (end == std::string::npos) {
+                    end = words.size();
+                }
+                if (end > start) {
+                    options.pipeline.stopWords.insert(words.substr(start, end - start));
+                }
+                start = end + 1;
+            }
+            options.pipeline.stages |= PIPELINE_STOP_WORDS;
+        }
+        else if (option == "--keep-duplicates") {
+            options.pipeline.stages &= ~PIPELINE_DEDUP;
+        }
+        else if (option == "--truncate" && i + 1 < argc) {
+            options.pipeline.truncateLimit = static_cast<size_t>(std::stoul(argv[++i]));
+            options.pipeline.stages |= PIPELINE_TRUNCATE;
+        }
+        else if (option == "--fair") {
+            options.fairScheduling = true;
+        }
+        else if (option == "--fair-workers" && i + 1 < argc) {
+            options.scheduler.workerThreads = static_cast<size_t>(std::stoul(argv[++i]));
+            options.fairScheduling = true;
+        }
+        else if (option == "--queue-depth" && i + 1 < argc) {
+            options.scheduler.maxQueueDepth = static_cast<size_t>(std::stoul(argv[++i]));
+            options.fairScheduling = true;
+        }
+        else if ((option == "--class-weights" || option == "--class-rates") && i + 1 < argc) {
+            uint64_t values[PRIORITY_CLASS_COUNT];
+            if (!parseClassValues(argv[++i], values)) {
+                return false;
+            }
+            for (uint32_t c = 0; c < PRIORITY_CLASS_COUNT; c++) {
+                if (option == "--class-weights") {
+                    options.scheduler.classes[c].weight = static_cast<uint32_t>(values[c]);
+                } else {
+                    options.scheduler.classes[c].rateLimit = values[c];
+                }
+            }
+            options.fairScheduling = true;
+        }
+        else if (option == "--scheduler-stats" && i + 1 < argc) {
+            options.scheduler.reportInterval = std::chrono::seconds(std::stoi(argv[++i]));
+            options.fairScheduling = true;
+        }
+        else {
+            return false;
+        }
+    }
+    return true;
+}
+
+void runProcessingServer(Endpoint endpoint, Endpoint display,
+    ProcessingOptions options, ReadyCallback onReady) {
+    Backoff backoff(RESTART_INITIAL_DELAY, RESTART_MAX_DELAY);
     while (isRunning) {
+        auto startedAt = std::chrono::steady_clock::now();
         try {
-            ProcessingServer server(port, displayHost, displayPort);
-            std::cout << "Processing Server started on port " << port
-                << ", connected to display server at " << displayHost
-                << ":" << displayPort << std::endl;
-            server.start();
+            ProcessingServer server(endpoint.port, display.host, display.port);
+            server.setListenAddress(endpoint.host);
+            server.setDictionaryEncoding(options.dictionaryEncoding);
+            server.setPassthrough(options.passthrough);
+            server.setPipelineConfig(options.pipeline);
+            if (options.fairScheduling) {
+                server.setFairScheduling(options.scheduler);
+            }
+            server.setReadyCallback(onReady);
+            std::cout << "Processing Server started on "
+                << transport::formatAddress(endpoint.host, endpoint.port)
+                << ", connected to display server at "
+                << transport::formatAddress(display.host, display.port) << std::endl;
+            if (options.asyncThreads > 0) {
+                server.startAsync(options.asyncThreads);
+            } else {
+                server.start();
+            }
         }
         catch (const std::exception& e) {
             std::cerr << "Processing Server error: " << e.what() << std::endl;
-            std::cerr << "Restarting Processing Server in 3 seconds..." << std::endl;
-            std::this_thread::sleep_for(std::chrono::seconds(3));
+        }
+        if (isRunning) {
+            waitBeforeRestart("Processing Server", backoff, startedAt);
+        }
+    }
+}
+
+struct TraceOptions {
+    std::string path;
+    double sampleRate = -1;
+
+    // Clients trace 1% of their messages by default once a trace file is set.
+    double clientSampleRate() const {
+        if (sampleRate >= 0) {
+            return sampleRate;
+        }
+        return path.empty() ? 0.0 : 0.01;
+    }
+};
+
+// Tracing options are accepted by every mode, so they are taken out of argv
+// before the mode-specific arguments are matched.
+void extractTraceOptions(int& argc, char* argv[], TraceOptions& options) {
+    int kept = 1;
+    for (int i = 1; i < argc; i++) {
+        std::string option = argv[i];
+        if (option == "--trace" && i + 1 < argc) {
+            options.path = argv[++i];
+        }
+        else if (option == "--trace-rate" && i + 1 < argc) {
+            options.sampleRate = std::stod(argv[++i]);
+        }
+        else {
+            argv[kept++] = argv[i];
+        }
+    }
+    argc = kept;
+}
+
+// Socket options are accepted by every mode as well and apply to every
+// connection the process makes or accepts.
+void extractSocketOptions(int& argc, char* argv[], transport::SocketOptions& options) {
+    int kept = 1;
+    for (int i = 1; i < argc; i++) {
+        std::string option = argv[i];
+        if (option == "--nagle") {
+            options.noDelay = false;
+        }
+        else if (option == "--sndbuf" && i + 1 < argc) {
+            options.sendBufferSize = std::stoi(argv[++i]);
+        }
+        else if (option == "--rcvbuf" && i + 1 < argc) {
+            options.receiveBufferSize = std::stoi(argv[++i]);
+        }
+        else if (option == "--busy-poll" && i + 1 < argc) {
+            options.busyPollMicros = std::stoi(argv[++i]);
+        }
+        else {
+            argv[kept++] = argv[i];
+        }
+    }
+    argc = kept;
+}
+
+struct ClientOptions {
+    std::string inputPath;
+    std::string connectionOptions;
+    double traceSampleRate = 0;
+};
+
+bool parseClientOptions(int argc, char* argv[], int first, ClientOptions& options) {
+    for (int i = first; i < argc; i++) {
+        std::string option = argv[i];
+        if (option == "--input" && i + 1 < argc) {
+            options.inputPath = argv[++i];
+        }
+        else if (option == "--options" && i + 1 < argc) {
+            options.connectionOptions = argv[++i];
+        }
+        else {
+            return false;
         }
     }
+    return true;
 }
 
-void runClient(const std::string& host, int port) {
+void runClient(Endpoint server, const ClientOptions& options) {
     try {
-        Client client(host, port);
-        std::cout << "Client connected to " << host << ":" << port << std::endl;
+        Client client(server.host, server.port);
+        client.setTraceSampleRate(options.traceSampleRate);
+        client.setConnectionOptions(options.connectionOptions);
+        std::cout << "Client connected to " << transport::formatAddress(server.host, server.port) << std::endl;
         std::cout << "Enter messages (type 'exit' to quit):" << std::endl;
         client.run();
     }
@@ -71,13 +368,68 @@ void runClient(const std::string& host, int port) {
     }
 }
 
+void runClientInput(Endpoint server, const ClientOptions& options) {
+    try {
+        Client client(server.host, server.port);
+        client.setTraceSampleRate(options.traceSampleRate);
+        client.setConnectionOptions(options.connectionOptions);
+        if (!client.runInput(options.inputPath)) {
+            std::cerr << "Client failed to send input " << options.inputPath << std::endl;
+        }
+    }
+    catch (const std::exception& e) {
+        std::cerr << "Client error: " << e.what() << std::endl;
+    }
+}
+
 void printUsage() {
     std::cout << "Client-Server Application\n\n";
     std::cout << "Usage:\n";
-    std::cout << "  To run Display Server:    ./app display <port>\n";
-    std::cout << "  To run Processing Server: ./app processing <port> <display_host> <display_port>\n";
-    std::cout << "  To run Client:            ./app client <server_host> <server_port>\n";
-    std::cout << "  To run all components:    ./app all <client_port> <processing_port> <display_port>\n\n";
+    std::cout << "  To run Display Server:    ./app display <port> [options]\n";
+    std::cout << "  To run Processing Server: ./app processing <port> <display_host> <display_port> [options]\n";
+    std::cout << "  To run Client:            ./app client <server_host> <server_port> [--options <list>]\n";
+    std::cout << "  To send a file or stdin:  ./app client <server_host> <server_port> --input <file|->\n";
+    std::cout << "  To run all components:    ./app all <client_port> <processing_port> <display_port>\n";
+    std::cout << "  To convert traces:        ./app trace-convert <output.json> <trace files...>\n\n";
+    std::cout << "Client options:\n";
+    std::cout << "  --options <list>    Connection options, e.g. passthrough=1,class=bulk\n\n";
+    std::cout << "Addresses:\n";
+    std::cout << "  A <port> may be unix:<path> to listen on a Unix domain socket, and a\n";
+    std::cout << "  <host> <port> pair may be unix:<path> to connect to one. Hosts may be\n";
+    std::cout << "  names or IPv4/IPv6 literals.\n\n";
+    std::cout << "Socket options (any mode):\n";
+    std::cout << "  --nagle             Leave Nagle's algorithm on (TCP_NODELAY is set by default)\n";
+    std::cout << "  --sndbuf <bytes>    Socket send buffer size\n";
+    std::cout << "  --rcvbuf <bytes>    Socket receive buffer size\n";
+    std::cout << "  --busy-poll <us>    Busy-poll the receive queue (SO_BUSY_POLL, Linux)\n\n";
+    std::cout << "Tracing options (any mode):\n";
+    std::cout << "  --trace <file>      Record per-message stage timings to <file>\n";
+    std::cout << "  --trace-rate <r>    Fraction of client messages to trace (default 0.01)\n\n";
+    std::cout << "Display Server options (any of them enables word statistics):\n";
+    std::cout << "  --top-k <k>         Track the <k> most frequent words (default 32)\n";
+    std::cout << "  --sketch-width <w>  Counters per count-min sketch row (default 65536)\n";
+    std::cout << "  --sketch-depth <d>  Count-min sketch rows (default 4)\n";
+    std::cout << "  --snapshot <s>      Print the top words every <s> seconds\n";
+    std::cout << "  --query <port>      Answer TOP [n], COUNT <word> and TOTAL queries on <port>\n";
+    std::cout << "                      or unix:/path\n\n";
+    std::cout << "Processing Server options:\n";
+    std::cout << "  --async <threads>   Serve clients with coroutines on <threads> event loops\n";
+    std::cout << "  --dictionary        Send dictionary-encoded word ids to the display server\n";
+    std::cout << "  --passthrough       Relay messages unchanged (splice on Linux), no dedup\n";
+    std::cout << "  --unicode           Split words on Unicode whitespace\n";
+    std::cout << "  --casefold          Case-fold words before removing duplicates\n";
+    std::cout << "  --stop-words <list> Drop the comma-separated words\n";
+    std::cout << "  --keep-duplicates   Do not remove duplicate words\n";
+    std::cout << "  --truncate <n>      Keep at most <n> words per message\n";
+    std::cout << "  --fair              Schedule clients fairly by priority class\n";
+    std::cout << "  --fair-workers <n>  Scheduler worker threads (default: hardware threads)\n";
+    std::cout << "  --queue-depth <n>   Messages a client may have queued (default 64)\n";
+    std::cout << "  --class-weights <i,n,b>\n";
+    std::cout << "                      Weights of interactive, normal, bulk (default 8,4,1)\n";
+    std::cout << "  --class-rates <i,n,b>\n";
+    std::cout << "                      Bytes per second per class, 0 = unlimited (default)\n";
+    std::cout << "  --scheduler-stats <s>\n";
+    std::cout << "                      Print per-client queue depth and wait every <s> seconds\n\n";
     std::cout << "Example:\n";
     std::cout << "  ./app all 8080 9090 7070\n";
 }
@@ -91,51 +443,94 @@ int main(int argc, char* argv[]) {
     }
 
     std::string mode = argv[1];
+    DisplayOptions displayOptions;
+    ProcessingOptions processingOptions;
+    ClientOptions clientOptions;
+    TraceOptions traceOptions;
+    transport::SocketOptions socketOptions;
 
     try {
-        if (mode == "display" && argc == 3) {
-            int port = std::stoi(argv[2]);
-            runDisplayServer(port);
+        if (mode == "trace-convert" && argc >= 4) {
+            std::vector<std::string> inputs(argv + 3, argv + argc);
+            return convertTraceToChrome(inputs, argv[2]) ? 0 : 1;
         }
-        else if (mode == "processing" && argc == 5) {
-            int port = std::stoi(argv[2]);
-            std::string displayHost = argv[3];
-            int displayPort = std::stoi(argv[4]);
-            runProcessingServer(port, displayHost, displayPort);
+
+        extractTraceOptions(argc, argv, traceOptions);
+        if (!traceOptions.path.empty() && !startTraceWriter(traceOptions.path)) {
+            return 1;
+        }
+        clientOptions.traceSampleRate = traceOptions.clientSampleRate();
+        extractSocketOptions(argc, argv, socketOptions);
+        transport::setDefaultSocketOptions(socketOptions);
+        Endpoint server;
+        Endpoint display;
+        int next = -1;
+
+        if (mode == "display" && argc >= 3 &&
+            parseDisplayOptions(argc, argv, 3, displayOptions)) {
+            runDisplayServer(parseListenEndpoint(argv[2]), displayOptions, notifyReady);
+        }
+        else if (mode == "processing" && argc >= 4 &&
+            (next = parseRemoteEndpoint(argc, argv, 3, display)) > 0 &&
+            parseProcessingOptions(argc, argv, next, processingOptions)) {
+            runProcessingServer(parseListenEndpoint(argv[2]), display, processingOptions, notifyReady);
         }
-        else if (mode == "client" && argc == 4) {
-            std::string host = argv[2];
-            int port = std::stoi(argv[3]);
-            runClient(host, port);
+        else if (mode == "client" && argc >= 3 &&
+            (next = parseRemoteEndpoint(argc, argv, 2, server)) > 0 &&
+            parseClientOptions(argc, argv, next, clientOptions)) {
+            if (clientOptions.inputPath.empty()) {
+                runClient(server, clientOptions);
+            } else {
+                runClientInput(server, clientOptions);
+            }
         }
         else if (mode == "all" && argc == 5) {
             int clientPort = std::stoi(argv[2]);
             int processingPort = std::stoi(argv[3]);
             int displayPort = std::stoi(argv[4]);
 
-            std::thread displayThread(runDisplayServer, displayPort);
+            // Each component is started as soon as the one it depends on is
+            // listening. The latches outlive main() for the detached threads.
+            auto displayReady = std::make_shared<ReadinessLatch>();
+            std::thread displayThread(runDisplayServer, Endpoint{ "", displayPort }, displayOptions,
+                ReadyCallback([displayReady](int port) { displayReady->signal(port); }));
             displayThread.detach();
 
-            std::this_thread::sleep_for(std::chrono::seconds(3));
+            if (!displayReady->waitFor(READY_TIMEOUT)) {
+                std::cerr << "Display Server did not become ready" << std::endl;
+                stopTraceWriter();
+                return 1;
+            }
 
+            auto processingReady = std::make_shared<ReadinessLatch>();
             std::thread processingThread(runProcessingServer,
-                processingPort, "127.0.0.1", displayPort);
+                Endpoint{ "", processingPort }, Endpoint{ "127.0.0.1", displayReady->port() }, processingOptions,
+                ReadyCallback([processingReady](int port) { processingReady->signal(port); }));
             processingThread.detach();
 
-            std::this_thread::sleep_for(std::chrono::seconds(3));
+            if (!processingReady->waitFor(READY_TIMEOUT)) {
+                std::cerr << "Processing Server did not become ready" << std::endl;
+                stopTraceWriter();
+                return 1;
+            }
+            processingPort = processingReady->port();
+            notifyServiceManager("READY=1");
 
-            runClient("127.0.0.1", processingPort);
+            runClient(Endpoint{ "127.0.0.1", processingPort }, clientOptions);
         }
         else {
+            stopTraceWriter();
             printUsage();
             return 1;
         }
     }
     catch (const std::exception& e) {
         std::cerr << "Error: " << e.what() << std::endl;
+        stopTraceWriter();
         printUsage();
         return 1;
     }
 
+    stopTraceWriter();
     return 0;
 }
\ No newline at end of file
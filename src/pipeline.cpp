@@ -0,0 +1,186 @@
+#include "../include/pipeline.hpp"
+#include <array>
+#include <algorithm>
+#include <vector>
+#include <thread>
+#include <cstdint>
+
+namespace {
+
+using PipelineFunction = std::string(*)(const PipelineConfig&, std::string_view);
+
+template<size_t... Masks>
+constexpr std::array<PipelineFunction, sizeof...(Masks)> makePipelineTable(std::index_sequence<Masks...>) {
+	return { &runFusedPipeline<static_cast<unsigned>(Masks)>... };
+}
+
+constexpr std::array<PipelineFunction, PIPELINE_STAGE_COMBINATIONS> PIPELINES =
+	makePipelineTable(std::make_index_sequence<PIPELINE_STAGE_COMBINATIONS>());
+
+// Below this many bytes per thread, starting threads costs more than the
+// dedup they take over.
+const size_t PARALLEL_MIN_CHUNK = 64 * 1024;
+
+// A word with its hash computed once in the chunk pass and reused by the
+// partitioned merge.
+struct HashedWord {
+	std::string word;
+	size_t hash;
+};
+
+struct HashedWordHash {
+	size_t operator()(const HashedWord& word) const { return word.hash; }
+	size_t operator()(const HashedWord* word) const { return word->hash; }
+};
+
+struct HashedWordEqual {
+	bool operator()(const HashedWord& a, const HashedWord& b) const { return a.word == b.word; }
+	bool operator()(const HashedWord* a, const HashedWord* b) const { return a->word == b->word; }
+};
+
+struct DedupChunk {
+	std::string_view text;
+	// Set nodes never move, so words can point into it.
+	std::unordered_set<HashedWord, HashedWordHash, HashedWordEqual> seen;
+	// First occurrences within the chunk, in text order.
+	std::vector<const HashedWord*> words;
+	// Indices into words, grouped by the partition that owns their hash.
+	std::vector<std::vector<uint32_t>> partitions;
+	// Set by the owning partition when no earlier chunk has the word.
+	std::vector<char> kept;
+};
+
+size_t partitionOf(size_t hash, size_t partitionCount) {
+	return static_cast<size_t>((static_cast<uint64_t>(hash >> 32) * partitionCount) >> 32);
+}
+
+void dedupChunk(const PipelineConfig& config, DedupChunk& chunk, size_t partitionCount) {
+	bool lowercase = (config.stages & PIPELINE_LOWERCASE) != 0;
+	bool stopWords = (config.stages & PIPELINE_STOP_WORDS) != 0;
+	chunk.partitions.resize(partitionCount);
+
+	std::string folded;
+	forEachWord(chunk.text, config.unicodeWhitespace, [&](std::string_view word) {
+		HashedWord token{ std::string(word), 0 };
+		if (lowercase) {
+			foldCase(token.word, folded);
+			token.word.swap(folded);
+		}
+		if (stopWords && config.stopWords.find(token.word) != config.stopWords.end()) {
+			return;
+		}
+		token.hash = std::hash<std::string>()(token.word);
+
+		auto inserted = chunk.seen.insert(std::move(token));
+		if (inserted.second) {
+			uint32_t index = static_cast<uint32_t>(chunk.words.size());
+			chunk.words.push_back(&*inserted.first);
+			chunk.partitions[partitionOf(inserted.first->hash, partitionCount)].push_back(index);
+		}
+	});
+	chunk.kept.assign(chunk.words.size(), 0);
+}
+
+// Chunks are visited in text order, so the first insert of a word is its
+// earliest occurrence overall.
+void mergePartition(std::vector<DedupChunk>& chunks, size_t partition) {
+	std::unordered_set<const HashedWord*, HashedWordHash, HashedWordEqual> seen;
+	for (DedupChunk& chunk : chunks) {
+		for (uint32_t index : chunk.partitions[partition]) {
+			if (seen.insert(chunk.words[index]).second) {
+				chunk.kept[index] = 1;
+			}
+		}
+	}
+}
+
+// Cuts text into about count pieces, each ending just before an ASCII
+// whitespace byte. Those bytes separate words in both tokenizer modes and
+// never occur inside a multi-byte UTF-8 sequence.
+std::vector<std::string_view> splitAtWhitespace(std::string_view text, size_t count) {
+	std::vector<std::string_view> pieces;
+	size_t start = 0;
+	for (size_t i = 1; i < count && start < text.size(); i++) {
+		size_t end = std::max(start, text.size() * i / count);
+		while (end < text.size() && !isAsciiWhitespace(static_cast<unsigned char>(text[end]))) {
+			end++;
+		}
+		if (end > start) {
+			pieces.push_back(text.substr(start, end - start));
+			start = end;
+		}
+	}
+	if (start < text.size()) {
+		pieces.push_back(text.substr(start));
+	}
+	return pieces;
+}
+
+// Threads are started per call: inputs here are megabytes, so starting them
+// costs far less than the work, and no pool idles in the servers.
+template<typename Function>
+void runOnThreads(size_t count, Function function) {
+	std::vector<std::thread> threads;
+	threads.reserve(count - 1);
+	for (size_t i = 1; i < count; i++) {
+		threads.emplace_back(function, i);
+	}
+	function(0);
+	for (auto& thread : threads) {
+		thread.join();
+	}
+}
+
+}
+
+std::string runPipeline(const PipelineConfig& config, std::string_view text) {
+	if ((config.stages & PIPELINE_DEDUP) && config.parallelThreshold > 0 &&
+		text.size() >= config.parallelThreshold) {
+		return runParallelDedupPipeline(config, text);
+	}
+	return PIPELINES[config.stages & (PIPELINE_STAGE_COMBINATIONS - 1)](config, text);
+}
+
+std::string runParallelDedupPipeline(const PipelineConfig& config, std::string_view text) {
+	// An explicit thread count is taken as is; the automatic one leaves
+	// every thread at least PARALLEL_MIN_CHUNK bytes.
+	size_t threadCount = config.parallelThreads;
+	if (threadCount == 0) {
+		threadCount = std::min<size_t>(std::max(std::thread::hardware_concurrency(), 1u),
+			std::max<size_t>(text.size() / PARALLEL_MIN_CHUNK, 1));
+	}
+
+	std::vector<std::string_view> pieces = splitAtWhitespace(text, threadCount);
+	if (pieces.size() < 2 || !(config.stages & PIPELINE_DEDUP)) {
+		return PIPELINES[config.stages & (PIPELINE_STAGE_COMBINATIONS - 1)](config, text);
+	}
+
+	std::vector<DedupChunk> chunks(pieces.size());
+	for (size_t i = 0; i < pieces.size(); i++) {
+		chunks[i].text = pieces[i];
+	}
+	size_t partitionCount = chunks.size();
+
+	runOnThreads(chunks.size(), [&](size_t i) { dedupChunk(config, chunks[i], partitionCount); });
+	runOnThreads(partitionCount, [&](size_t partition) { mergePartition(chunks, partition); });
+
+	bool truncate = (config.stages & PIPELINE_TRUNCATE) != 0;
+	size_t emitted = 0;
+	std::string result;
+	for (const DedupChunk& chunk : chunks) {
+		for (size_t i = 0; i < chunk.words.size(); i++) {
+			if (!chunk.kept[i]) {
+				continue;
+			}
+			if (truncate && emitted == config.truncateLimit) {
+				return result;
+			}
+			if (!result.empty()) {
+				result += ' ';
+			}
+			result += chunk.words[i]->word;
+			emitted++;
+		}
+	}
+	return result;
+}
@@ -1,11 +1,11 @@
 #include "../include/servers.hpp"
+#include "../include/connection.hpp"
 #include <iostream>
 #include <sstream>
 #include <algorithm>
 #include <cstring>
 #include <thread>
 #include <chrono>
-#include <algorithm>
 
 #ifdef _WIN32
 #include <winsock2.h>
@@ -21,55 +21,80 @@
 using ssize_t = int;
 #endif
 
+namespace {
+
+// Passthrough frames are forwarded with the client's header (minus the
+// dictionary flag, which the client never sets), so the relay pipe holds
+// complete display frames.
+bool appendRelayHeader(SpliceRelay& relay, uint32_t dataLength, uint64_t traceId) {
+	char header[transport::MAX_FRAME_HEADER_SIZE];
+	size_t headerSize = transport::encodeFrameHeader(0, dataLength, traceId, header);
+	return relay.append(header, headerSize);
+}
+
+size_t relayFrameSize(uint32_t dataLength, uint64_t traceId) {
+	return sizeof(uint32_t) + (traceId != 0 ? TRACE_ID_SIZE : 0) + dataLength;
+}
+
+// A client message frame may carry a trace id and no other flag; one that
+// does is rejected like an oversized one.
+bool oversizedMessage(const transport::FrameHeader& header) {
+	return (header.flags & ~FRAME_FLAG_TRACE) != 0 || header.length > MAX_MESSAGE_LENGTH;
+}
+
+// A failed display send is retried this many times before the client gets
+// a negative acknowledgement.
+const int DISPLAY_SEND_ATTEMPTS = 3;
+const std::chrono::milliseconds DISPLAY_RETRY_DELAY(100);
+
+}
+
 ProcessingServer::ProcessingServer(int port, const std::string& displayHost, int displayPort)
 	: serverPort(port), displayServerHost(displayHost),
 	displayServerPort(displayPort), isRunning(false),
-	serverSocket(-1), displayServerSocket(-1) {
-
-	#ifdef _WIN32
-	WSADATA wsaData;
-	if (WSAStartup(MAKEWORD(2, 2), &wsaData) != 0) {
-		std::cerr << "WSAStartup failed" << std::endl;
-	}
-	#endif
+	serverSocket(-1), displayServerSocket(-1), dictionaryEncoding(false), passthrough(false),
+	fairScheduling(false) {
+	transport::startup();
 }
 
 ProcessingServer::~ProcessingServer() {
 	stop();
 }
 
-void ProcessingServer::start() {
-	serverSocket = createTCPSocket();
+bool ProcessingServer::openSockets() {
+	serverSocket = transport::listenOn(listenHost, serverPort);
 	if (serverSocket < 0) {
-		std::cerr << "Failed to create server TCP socket" << std::endl;
-		return;
+		return false;
 	}
 
-	if (!bindTCPSocket(serverSocket, serverPort)) {
-		std::cerr << "Failed to bind TCP socket to port " << serverPort << std::endl;
-		closeTCPSocket(serverSocket);
-		return;
+	if (!connectToDisplayServer()) {
+		std::cerr << "Failed to establish connection to display server" << std::endl;
+		transport::closeSocket(serverSocket);
+		return false;
 	}
 
-	if (!startTCPListening(serverSocket)) {
-		std::cerr << "Failed to start TCP listening" << std::endl;
-		closeTCPSocket(serverSocket);
-		return;
-	}
+	serverPort = transport::boundPort(serverSocket);
+	return true;
+}
 
-	if (!connectToDisplayServer()) {
-		std::cerr << "Failed to establish TCP connection to display server" << std::endl;
-		closeTCPSocket(serverSocket);
+void ProcessingServer::start() {
+	if (!openSockets()) {
 		return;
 	}
 
 	isRunning = true;
-	std::cout << "TCP Processing server started on port " << serverPort << std::endl;
-	std::cout << "TCP Connected to display server at " << displayServerHost
-		<< ":" << displayServerPort << std::endl;
+	if (fairScheduling) {
+		std::atomic_store(&scheduler, std::make_shared<FairScheduler>(schedulerConfig));
+	}
+	std::cout << "Processing server listening on " << transport::formatAddress(listenHost, serverPort) << std::endl;
+	std::cout << "Connected to display server at "
+		<< transport::formatAddress(displayServerHost, displayServerPort) << std::endl;
+	if (readyCallback) {
+		readyCallback(serverPort);
+	}
 
 	while (isRunning) {
-		int clientSocket = acceptTCPConnection(serverSocket);
+		int clientSocket = transport::accept(serverSocket);
 		if (clientSocket < 0) {
 			if (isRunning) {
 				std::cerr << "Accept error, retrying..." << std::endl;
@@ -78,218 +103,750 @@ void ProcessingServer::start() {
 			continue;
 		}
 
+		{
+			std::lock_guard<std::mutex> lock(clientsMutex);
+			clientSockets.insert(clientSocket);
+		}
 		std::thread([this, clientSocket]() {
-			while (true) {
-				if (!handleClient(clientSocket)) {
-					break;
-				}
-			}
-			closeTCPSocket(clientSocket);
+			BlockingConnection connection(clientSocket);
+			runBlocking(handleClient(connection));
+			releaseClient(clientSocket);
 			}).detach();
 	}
 
-	closeTCPSocket(serverSocket);
-	closeTCPSocket(displayServerSocket);
+	// Client threads use this object, wait until stop() has ended them all.
+	{
+		std::unique_lock<std::mutex> lock(clientsMutex);
+		clientsFinished.wait(lock, [this]() { return clientSockets.empty(); });
+	}
+	std::atomic_store(&scheduler, std::shared_ptr<FairScheduler>());
+
+	transport::closeSocket(serverSocket);
+	transport::closeSocket(displayServerSocket);
+
+	transport::cleanup();
+}
 
+void ProcessingServer::startAsync(size_t threadCount) {
 	#ifdef _WIN32
-	WSACleanup();
+	std::cerr << "Async mode is not supported on Windows, using threads" << std::endl;
+	start();
+	#else
+	if (!openSockets()) {
+		return;
+	}
+	setNonBlocking(serverSocket);
+	// Loops wait for the display link on epoll, scheduler workers in poll().
+	setNonBlocking(displayServerSocket);
+	if (fairScheduling) {
+		std::atomic_store(&scheduler, std::make_shared<FairScheduler>(schedulerConfig));
+	}
+
+	std::vector<EventLoop*> loops;
+	{
+		std::lock_guard<std::mutex> lock(loopsMutex);
+		for (size_t i = 0; i < std::max<size_t>(threadCount, 1); i++) {
+			eventLoops.push_back(std::make_unique<EventLoop>());
+			loops.push_back(eventLoops.back().get());
+		}
+		isRunning = true;
+	}
+
+	std::cout << "Processing server listening on " << transport::formatAddress(listenHost, serverPort)
+		<< " with " << loops.size() << " event loop threads" << std::endl;
+	std::cout << "Connected to display server at "
+		<< transport::formatAddress(displayServerHost, displayServerPort) << std::endl;
+	if (readyCallback) {
+		readyCallback(serverPort);
+	}
+
+	// The calling thread runs the first loop, which also owns the acceptor.
+	std::vector<std::thread> workers;
+	for (size_t i = 1; i < loops.size(); i++) {
+		EventLoop* loop = loops[i];
+		workers.emplace_back([loop]() { loop->run(); });
+	}
+
+	loops[0]->spawn(acceptConnectionsAsync(*loops[0], loops));
+	loops[0]->run();
+
+	std::vector<std::unique_ptr<EventLoop>> stopped;
+	{
+		std::lock_guard<std::mutex> lock(loopsMutex);
+		isRunning = false;
+		stopped.swap(eventLoops);
+	}
+	for (EventLoop* loop : loops) {
+		loop->stop();
+	}
+	for (auto& worker : workers) {
+		worker.join();
+	}
+	// Destroys the connections still suspended on the loops.
+	stopped.clear();
+
+	// The destroyed connections leave their sockets behind, they are closed
+	// here so that their clients see the end of the stream.
+	{
+		std::lock_guard<std::mutex> lock(clientsMutex);
+		for (int clientSocket : clientSockets) {
+			transport::closeSocket(clientSocket);
+		}
+		clientSockets.clear();
+	}
+	std::atomic_store(&scheduler, std::shared_ptr<FairScheduler>());
+
+	transport::closeSocket(serverSocket);
+	transport::closeSocket(displayServerSocket);
 	#endif
 }
 
 void ProcessingServer::stop() {
-	isRunning = false;
-	#ifdef _WIN32
-	shutdown(serverSocket, SD_BOTH);
+	#ifndef _WIN32
+	{
+		std::lock_guard<std::mutex> lock(loopsMutex);
+		isRunning = false;
+		for (auto& loop : eventLoops) {
+			loop->stop();
+		}
+	}
 	#else
-	shutdown(serverSocket, SHUT_RDWR);
+	isRunning = false;
 	#endif
+	std::lock_guard<std::mutex> lock(clientsMutex);
+	transport::shutdownSocket(serverSocket);
+	for (int clientSocket : clientSockets) {
+		transport::shutdownSocket(clientSocket);
+	}
 }
 
-bool ProcessingServer::handleClient(int clientSocket) {
-	while (isRunning) {
+// The socket is closed under the lock so that a new connection reusing its
+// descriptor is only registered after this one is gone.
+void ProcessingServer::releaseClient(int clientSocket) {
+	std::lock_guard<std::mutex> lock(clientsMutex);
+	transport::closeSocket(clientSocket);
+	clientSockets.erase(clientSocket);
+	clientsFinished.notify_all();
+}
+
+Task<void> ProcessingServer::handleClient(Connection& connection) {
+	ConnectionOptions options;
+	options.passthrough = passthrough;
+	std::unique_ptr<SpliceRelay> relay;
+	// Jobs queued for this connection have run by the time it returns. Any
+	// reply sent directly from here first drains the queue to stay in order.
+	std::shared_ptr<FairScheduler> fair = std::atomic_load(&scheduler);
+	SchedulerSession session(fair.get(), options.priority);
+
+	bool open = true;
+	while (open && isRunning) {
 		try {
-			const int BUFFER_SIZE = 4096;
-			char buffer[BUFFER_SIZE];
+			open = co_await handleFrame(connection, options, relay, session);
+		}
+		catch (...) {
+			open = false;
+		}
+	}
+	// Without this the session's destructor would wait on the loop thread.
+	co_await connection.drain(session);
+}
+
+Task<bool> ProcessingServer::handleFrame(Connection& connection, ConnectionOptions& options,
+	std::unique_ptr<SpliceRelay>& relay, SchedulerSession& session) {
+	transport::FrameHeader header;
+	bool received = co_await connection.receiveFrameHeader(header);
+	if (!received) {
+		co_return false;
+	}
+
+	if (header.flags & FRAME_FLAG_BATCH) {
+		// The count sizes the batch buffers, so an out of range one ends
+		// the connection before anything is allocated.
+		uint32_t messageCount = header.length;
+		if (!validBatchSize(messageCount)) {
+			co_await connection.drain(session);
+			co_await sendNegativeAcknowledgement(connection);
+			co_return false;
+		}
+		if (!options.passthrough) {
+			co_return co_await handleBatch(connection, messageCount, session);
+		}
+		if (!relay) {
+			relay = std::make_unique<SpliceRelay>();
+		}
+		co_return co_await relayBatch(connection, messageCount, *relay, session);
+	}
+	if (header.flags & FRAME_FLAG_OPTIONS) {
+		co_await connection.drain(session);
+		bool handled = co_await handleOptions(connection, header.length, options);
+		session.setClass(options.priority);
+		co_return handled;
+	}
+
+	uint32_t dataLength = header.length;
+	uint64_t traceId = header.traceId;
+	TraceSpan receiveSpan(traceId, TRACE_PROCESSING_RECEIVE);
+
+	if (dataLength == 0 || oversizedMessage(header)) {
+		std::cerr << "Invalid data length" << std::endl;
+		co_await connection.drain(session);
+		bool discarded = co_await connection.discard(dataLength);
+		if (!discarded) {
+			co_return false;
+		}
+		co_return co_await sendNegativeAcknowledgement(connection);
+	}
 
-			uint32_t dataLength;
-			int bytesReceived = receiveTCPData(clientSocket,
-				reinterpret_cast<char*>(&dataLength), sizeof(dataLength));
+	if (options.passthrough) {
+		if (!relay) {
+			relay = std::make_unique<SpliceRelay>();
+		}
+		bool filled = appendRelayHeader(*relay, dataLength, traceId);
+		if (filled) {
+			filled = co_await connection.fillRelay(*relay, dataLength);
+		}
+		if (!filled) {
+			co_return false;
+		}
+		receiveSpan.finish();
 
-			if (bytesReceived <= 0) break;
+		std::vector<uint64_t> traceIds(1, traceId);
+		bool relayed = co_await relayBuffered(connection, *relay, traceIds, session);
+		if (!relayed) {
+			co_return co_await sendNegativeAcknowledgement(connection);
+		}
+		co_return co_await sendAcknowledgement(connection);
+	}
+
+	std::string data(dataLength, '\0');
+	received = co_await connection.receiveExact(&data[0], dataLength);
+	if (!received) {
+		co_return false;
+	}
+	receiveSpan.finish();
+
+	if (!session.active()) {
+		co_return co_await deliverMessage(connection, data, traceId);
+	}
+	// A failed reply from the worker shows up as a failed read here. Jobs
+	// are built before the co_await, GCC 12 destroys lambda temporaries in
+	// its operand twice.
+	int clientSocket = connection.socket();
+	FairScheduler::Job job = [this, clientSocket, data = std::move(data), traceId]() {
+		BlockingConnection worker(clientSocket);
+		runBlocking(deliverMessage(worker, data, traceId));
+		};
+	co_await connection.submit(session, dataLength, std::move(job));
+	co_return true;
+}
 
-			dataLength = ntohl(dataLength);
-			if (dataLength == 0 || dataLength > BUFFER_SIZE - 1) {
-				std::cerr << "Invalid data length" << std::endl;
-				continue;
+Task<bool> ProcessingServer::deliverMessage(Connection& connection, const std::string& data, uint64_t traceId) {
+	TraceSpan pipelineSpan(traceId, TRACE_PROCESSING_PIPELINE);
+	if (!validateData(data)) {
+		std::cerr << "Invalid UTF-8 data" << std::endl;
+		co_return co_await sendNegativeAcknowledgement(connection);
+	}
+	std::string processedData = processData(data);
+	pipelineSpan.finish();
+
+	bool delivered = false;
+	for (int attempt = 0; attempt < DISPLAY_SEND_ATTEMPTS && !delivered; attempt++) {
+		if (attempt > 0) {
+			co_await connection.sleepFor(DISPLAY_RETRY_DELAY);
+		}
+		delivered = co_await sendToDisplayServer(connection, processedData, traceId);
+	}
+	if (!delivered) {
+		co_return co_await sendNegativeAcknowledgement(connection);
+	}
+	co_return co_await sendAcknowledgement(connection);
+}
+
+Task<bool> ProcessingServer::handleBatch(Connection& connection, uint32_t messageCount, SchedulerSession& session) {
+	std::vector<std::string> messages;
+	std::vector<uint64_t> traceIds;
+	messages.reserve(messageCount);
+	traceIds.reserve(messageCount);
+	size_t bytes = 0;
+
+	// An oversized frame is skipped and stands in the batch as an empty
+	// message, which deliverBatch() drops like any other invalid one.
+	for (uint32_t i = 0; i < messageCount; i++) {
+		transport::FrameHeader header;
+		bool received = co_await connection.receiveFrameHeader(header);
+		if (!received) {
+			co_return false;
+		}
+		uint32_t dataLength = header.length;
+		uint64_t traceId = header.traceId;
+		TraceSpan receiveSpan(traceId, TRACE_PROCESSING_RECEIVE);
+
+		if (oversizedMessage(header)) {
+			std::cerr << "Invalid data length in batch" << std::endl;
+			bool discarded = co_await connection.discard(dataLength);
+			if (!discarded) {
+				co_return false;
 			}
+			dataLength = 0;
+		}
 
-			bytesReceived = receiveTCPData(clientSocket, buffer, dataLength);
-			if (bytesReceived <= 0) break;
+		std::string data(dataLength, '\0');
+		if (dataLength > 0) {
+			received = co_await connection.receiveExact(&data[0], dataLength);
+			if (!received) {
+				co_return false;
+			}
+		}
+		messages.push_back(std::move(data));
+		traceIds.push_back(traceId);
+		bytes += dataLength;
+	}
 
-			buffer[bytesReceived] = '\0';
-			std::string processedData = processData(buffer);
+	if (!session.active()) {
+		co_return co_await deliverBatch(connection, messages, traceIds);
+	}
+	int clientSocket = connection.socket();
+	FairScheduler::Job job = [this, clientSocket, messages = std::move(messages), traceIds = std::move(traceIds)]() {
+		BlockingConnection worker(clientSocket);
+		runBlocking(deliverBatch(worker, messages, traceIds));
+		};
+	co_await connection.submit(session, bytes, std::move(job));
+	co_return true;
+}
 
-			for (int i = 0; i < 3; i++) {
-				if (sendToDisplayServer(processedData) &&
-					sendAcknowledgement(clientSocket)) {
-					break;
-				}
-				std::this_thread::sleep_for(std::chrono::milliseconds(100));
+// Invalid messages are dropped and named in the ack while the rest of the
+// batch is delivered, so a client never has to resend part of a batch behind
+// the ones it already has in flight.
+Task<bool> ProcessingServer::deliverBatch(Connection& connection, const std::vector<std::string>& messages,
+	const std::vector<uint64_t>& traceIds) {
+	std::vector<std::string> processed;
+	std::vector<uint64_t> processedTraceIds;
+	std::vector<uint32_t> dropped;
+	processed.reserve(messages.size());
+	processedTraceIds.reserve(messages.size());
+	for (size_t i = 0; i < messages.size(); i++) {
+		TraceSpan pipelineSpan(traceIds[i], TRACE_PROCESSING_PIPELINE);
+		if (!validateData(messages[i])) {
+			dropped.push_back(static_cast<uint32_t>(i));
+			continue;
+		}
+		processed.push_back(processData(messages[i]));
+		processedTraceIds.push_back(traceIds[i]);
+	}
+
+	bool delivered = false;
+	for (int attempt = 0; attempt < DISPLAY_SEND_ATTEMPTS && !processed.empty() && !delivered; attempt++) {
+		if (attempt > 0) {
+			co_await connection.sleepFor(DISPLAY_RETRY_DELAY);
+		}
+		delivered = co_await sendBatchToDisplayServer(connection, processed, processedTraceIds);
+	}
+
+	if (!processed.empty() && !delivered) {
+		co_return co_await sendBatchAcknowledgement(connection, BATCH_UNDELIVERED, 0, {});
+	}
+	BatchAckStatus status = dropped.empty() ? BATCH_DELIVERED : BATCH_INVALID;
+	co_return co_await sendBatchAcknowledgement(connection, status, static_cast<uint32_t>(processed.size()), dropped);
+}
+
+// Passthrough batches are spliced frame by frame into the relay and sent to
+// the display server whenever the pipe is full, so a batch costs a few
+// splices instead of a copy of every payload.
+Task<bool> ProcessingServer::relayBatch(Connection& connection, uint32_t messageCount, SpliceRelay& relay,
+	SchedulerSession& session) {
+	std::vector<uint64_t> traceIds;
+	std::vector<uint32_t> dropped;
+	uint32_t acknowledged = 0;
+	// Cleared once the display server could not be reached: the rest of the
+	// batch is read and discarded.
+	bool linked = true;
+
+	for (uint32_t i = 0; i < messageCount; i++) {
+		transport::FrameHeader header;
+		bool received = co_await connection.receiveFrameHeader(header);
+		if (!received) {
+			co_return false;
+		}
+		uint32_t dataLength = header.length;
+		uint64_t traceId = header.traceId;
+
+		bool valid = dataLength > 0 && !oversizedMessage(header);
+		if (!valid) {
+			std::cerr << "Invalid data length in batch" << std::endl;
+			dropped.push_back(i);
+		}
+		if (valid && linked && relay.buffered() + relayFrameSize(dataLength, traceId) > relay.capacity()) {
+			bool relayed = co_await relayBuffered(connection, relay, traceIds, session);
+			if (relayed) {
+				acknowledged += static_cast<uint32_t>(traceIds.size());
+			} else {
+				linked = false;
 			}
+			traceIds.clear();
 		}
-		catch (...) {
-			return false;
+		if (!valid || !linked) {
+			bool discarded = co_await connection.discard(dataLength);
+			if (!discarded) {
+				co_return false;
+			}
+			continue;
+		}
+
+		TraceSpan receiveSpan(traceId, TRACE_PROCESSING_RECEIVE);
+		bool filled = appendRelayHeader(relay, dataLength, traceId);
+		if (filled) {
+			filled = co_await connection.fillRelay(relay, dataLength);
 		}
+		if (!filled) {
+			relay.reset();
+			co_return false;
+		}
+		traceIds.push_back(traceId);
 	}
-	return true;
+
+	if (!traceIds.empty()) {
+		bool relayed = co_await relayBuffered(connection, relay, traceIds, session);
+		if (relayed) {
+			acknowledged += static_cast<uint32_t>(traceIds.size());
+		} else {
+			linked = false;
+		}
+	}
+	if (!linked) {
+		co_return co_await sendBatchAcknowledgement(connection, BATCH_UNDELIVERED, acknowledged, {});
+	}
+	BatchAckStatus status = dropped.empty() ? BATCH_DELIVERED : BATCH_INVALID;
+	co_return co_await sendBatchAcknowledgement(connection, status, acknowledged, dropped);
+}
+
+// With a scheduler the relay is sent by a worker like any other job of the
+// connection, and waited for since the next frames refill the same relay.
+Task<bool> ProcessingServer::relayBuffered(Connection& connection, SpliceRelay& relay,
+	const std::vector<uint64_t>& traceIds, SchedulerSession& session) {
+	if (!session.active()) {
+		co_return co_await relayToDisplayServer(connection, relay, traceIds);
+	}
+
+	auto relayed = std::make_shared<bool>(false);
+	int clientSocket = connection.socket();
+	SpliceRelay* pending = &relay;
+	FairScheduler::Job job = [this, clientSocket, pending, traceIds, relayed]() {
+		BlockingConnection worker(clientSocket);
+		*relayed = runBlocking(relayToDisplayServer(worker, *pending, traceIds));
+		};
+	co_await connection.submit(session, relay.buffered(), std::move(job));
+	co_await connection.drain(session);
+	co_return *relayed;
+}
+
+Task<bool> ProcessingServer::handleOptions(Connection& connection, uint32_t dataLength, ConnectionOptions& options) {
+	if (dataLength > MAX_MESSAGE_LENGTH) {
+		std::cerr << "Invalid options length" << std::endl;
+		bool discarded = co_await connection.discard(dataLength);
+		if (!discarded) {
+			co_return false;
+		}
+		co_return co_await sendNegativeAcknowledgement(connection);
+	}
+
+	std::string text(dataLength, '\0');
+	if (dataLength > 0) {
+		bool received = co_await connection.receiveExact(&text[0], dataLength);
+		if (!received) {
+			co_return false;
+		}
+	}
+	if (!parseConnectionOptions(text, options)) {
+		std::cerr << "Invalid connection options: " << text << std::endl;
+		co_return co_await sendNegativeAcknowledgement(connection);
+	}
+	co_return co_await sendAcknowledgement(connection);
 }
 
-bool ProcessingServer::sendToDisplayServer(const std::string& processedData) {
+#ifndef _WIN32
+Task<void> ProcessingServer::acceptConnectionsAsync(EventLoop& loop, std::vector<EventLoop*> targets) {
+	size_t next = 0;
+	while (isRunning) {
+		int clientSocket = co_await asyncAccept(loop, serverSocket);
+		if (clientSocket < 0) {
+			if (isRunning) {
+				std::cerr << "Accept error: " << strerror(errno) << std::endl;
+				co_await loop.readable(serverSocket);
+			}
+			continue;
+		}
+		transport::applySocketOptions(clientSocket, transport::defaultSocketOptions());
+
+		{
+			std::lock_guard<std::mutex> lock(clientsMutex);
+			clientSockets.insert(clientSocket);
+		}
+		EventLoop& target = *targets[next++ % targets.size()];
+		target.spawn(handleClientAsync(target, clientSocket));
+	}
+	loop.forget(serverSocket);
+
+	// stop() has shut down every client socket, the loops keep running
+	// until the connections have noticed and finished.
+	for (;;) {
+		{
+			std::lock_guard<std::mutex> lock(clientsMutex);
+			if (clientSockets.empty()) {
+				break;
+			}
+		}
+		co_await loop.sleepFor(std::chrono::milliseconds(10));
+	}
+	loop.stop();
+}
+
+Task<void> ProcessingServer::handleClientAsync(EventLoop& loop, int clientSocket) {
+	// Also runs when the loop is destroyed with the connection suspended.
+	struct Release {
+		ProcessingServer& server;
+		EventLoop& loop;
+		int clientSocket;
+
+		~Release() {
+			loop.forget(clientSocket);
+			server.releaseClient(clientSocket);
+		}
+	} release{ *this, loop, clientSocket };
+
+	LoopConnection connection(loop, clientSocket);
+	co_await handleClient(connection);
+}
+#endif
+
+Task<bool> ProcessingServer::sendToDisplayServer(Connection& connection, const std::string& processedData,
+	uint64_t traceId) {
+	TraceSpan sendSpan(traceId, TRACE_PROCESSING_DISPLAY_SEND);
+	AsyncMutex::Guard guard = co_await connection.lock(displayLock);
 	if (displayServerSocket == -1) {
 		std::cerr << "Not connected to display server" << std::endl;
-		return false;
+		co_return false;
 	}
 
-	uint32_t dataLength = static_cast<uint32_t>(processedData.size());
-	uint32_t networkLength = htonl(dataLength);
-	if (sendTCPData(displayServerSocket, reinterpret_cast<const char*>(&networkLength), sizeof(networkLength)) <= 0) {
-		std::cerr << "Failed to send data length to display server" << std::endl;
-		return false;
+	const std::string* payload = &processedData;
+	uint32_t flags = 0;
+	std::string encoded;
+	if (dictionaryEncoding) {
+		displayEncoder.encode(processedData, encoded);
+		payload = &encoded;
+		flags = FRAME_FLAG_DICTIONARY;
 	}
 
-	if (sendTCPData(displayServerSocket, processedData.c_str(), processedData.size()) <= 0) {
+	char header[transport::MAX_FRAME_HEADER_SIZE];
+	std::vector<FrameSlice> slices;
+	transport::appendFrame(slices, header, flags, *payload, traceId);
+
+	bool sent = co_await connection.sendVectorTo(displayServerSocket, slices);
+	if (!sent) {
 		std::cerr << "Failed to send data to display server" << std::endl;
-		return false;
+		displayEncoder.rollback();
+		co_return false;
 	}
-
-	return true;
+	displayEncoder.commit();
+	co_return true;
 }
 
-bool ProcessingServer::connectToDisplayServer() {
-	displayServerSocket = createTCPSocket();
+Task<bool> ProcessingServer::sendBatchToDisplayServer(Connection& connection,
+	const std::vector<std::string>& processedData, const std::vector<uint64_t>& traceIds) {
+	uint64_t startedAt = isTracing() ? traceClock() : 0;
+	AsyncMutex::Guard guard = co_await connection.lock(displayLock);
 	if (displayServerSocket == -1) {
-		return false;
+		std::cerr << "Not connected to display server" << std::endl;
+		co_return false;
 	}
 
-	#ifdef _WIN32
-	sockaddr_in serverAddress;
-	serverAddress.sin_family = AF_INET;
-	serverAddress.sin_port = htons(displayServerPort);
-	serverAddress.sin_addr.s_addr = inet_addr(displayServerHost.c_str());
-	#else
-	sockaddr_in serverAddress = {};
-	serverAddress.sin_family = AF_INET;
-	serverAddress.sin_port = htons(displayServerPort);
-	inet_pton(AF_INET, displayServerHost.c_str(), &serverAddress.sin_addr);
-	#endif
+	const std::vector<std::string>* payloads = &processedData;
+	uint32_t flags = 0;
+	std::vector<std::string> encoded;
+	if (dictionaryEncoding) {
+		encoded.resize(processedData.size());
+		for (size_t i = 0; i < processedData.size(); i++) {
+			displayEncoder.encode(processedData[i], encoded[i]);
+		}
+		payloads = &encoded;
+		flags = FRAME_FLAG_DICTIONARY;
+	}
 
-	if (connect(displayServerSocket, (struct sockaddr*)&serverAddress, sizeof(serverAddress)) == SOCKET_ERROR) {
-	#ifdef _WIN32
-		std::cerr << "Connection failed. Error: " << WSAGetLastError() << std::endl;
-	#else
-		std::cerr << "Connection failed. Error: " << strerror(errno) << std::endl;
-	#endif
-		closeTCPSocket(displayServerSocket);
-		displayServerSocket = -1;
-		return false;
+	std::vector<char> headers(payloads->size() * transport::MAX_FRAME_HEADER_SIZE);
+	std::vector<FrameSlice> slices;
+	slices.reserve(payloads->size() * 2);
+
+	for (size_t i = 0; i < payloads->size(); i++) {
+		uint64_t traceId = i < traceIds.size() ? traceIds[i] : 0;
+		char* header = &headers[i * transport::MAX_FRAME_HEADER_SIZE];
+		transport::appendFrame(slices, header, flags, (*payloads)[i], traceId);
 	}
-	return true;
-}
 
-bool ProcessingServer::validateData(const std::string& data) {
-	return !data.empty();
+	bool sent = co_await connection.sendVectorTo(displayServerSocket, slices);
+	if (!sent) {
+		std::cerr << "Failed to send batch to display server" << std::endl;
+		displayEncoder.rollback();
+		co_return false;
+	}
+	displayEncoder.commit();
+
+	if (startedAt != 0) {
+		uint64_t now = traceClock();
+		for (uint64_t traceId : traceIds) {
+			if (traceId != 0) {
+				recordTraceSpan(traceId, TRACE_PROCESSING_DISPLAY_SEND, startedAt, now);
+			}
+		}
+	}
+	co_return true;
 }
 
-std::string ProcessingServer::processData(const std::string& data) {
-	std::istringstream iss(data);
-	std::unordered_set<std::string> uniqueWords;
-	std::string word;
+Task<bool> ProcessingServer::relayToDisplayServer(Connection& connection, SpliceRelay& relay,
+	const std::vector<uint64_t>& traceIds) {
+	uint64_t startedAt = isTracing() ? traceClock() : 0;
+	AsyncMutex::Guard guard = co_await connection.lock(displayLock);
+	if (displayServerSocket == -1) {
+		std::cerr << "Not connected to display server" << std::endl;
+		relay.reset();
+		co_return false;
+	}
 
-	while (iss >> word) {
-		uniqueWords.insert(word);
+	bool drained = co_await connection.drainRelayTo(relay, displayServerSocket);
+	if (!drained) {
+		std::cerr << "Failed to relay data to display server" << std::endl;
+		relay.reset();
+		co_return false;
 	}
 
-	std::string result;
-	for (const auto& w : uniqueWords) {
-		if (!result.empty()) {
-			result += " ";
+	if (startedAt != 0) {
+		uint64_t now = traceClock();
+		for (uint64_t traceId : traceIds) {
+			if (traceId != 0) {
+				recordTraceSpan(traceId, TRACE_PROCESSING_DISPLAY_SEND, startedAt, now);
+			}
 		}
-		result += w;
 	}
+	co_return true;
+}
 
-	return result;
+bool ProcessingServer::connectToDisplayServer() {
+	AsyncMutex::Guard guard = displayLock.lock();
+	displayEncoder.reset();
+	displayServerSocket = transport::connectTo(displayServerHost, displayServerPort);
+	return displayServerSocket != -1;
 }
 
+void ProcessingServer::setListenAddress(const std::string& host) {
+	listenHost = host;
+}
 
-bool ProcessingServer::sendAcknowledgement(int clientSocket) {
-	const std::string ack = "OK";
-	return sendTCPData(clientSocket, ack.c_str(), ack.size()) > 0;
+void ProcessingServer::setDictionaryEncoding(bool enabled) {
+	AsyncMutex::Guard guard = displayLock.lock();
+	dictionaryEncoding = enabled;
 }
 
-int ProcessingServer::createTCPSocket() {
-	int sock = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
-	if (sock == -1) {
-		std::cerr << "Failed to create TCP socket" << std::endl;
+void ProcessingServer::setTokenizerOptions(const TokenizerOptions& options) {
+	pipelineConfig.unicodeWhitespace = options.unicodeWhitespace;
+	if (options.caseFold) {
+		pipelineConfig.stages |= PIPELINE_LOWERCASE;
+	} else {
+		pipelineConfig.stages &= ~PIPELINE_LOWERCASE;
 	}
-	return sock;
 }
 
-bool ProcessingServer::bindTCPSocket(int socket, int port) {
-	#ifdef _WIN32
-	sockaddr_in serverAddress;
-	serverAddress.sin_family = AF_INET;
-	serverAddress.sin_port = htons(port);
-	serverAddress.sin_addr.s_addr = INADDR_ANY;
-	#else
-	sockaddr_in serverAddress = {};
-	serverAddress.sin_family = AF_INET;
-	serverAddress.sin_port = htons(port);
-	serverAddress.sin_addr.s_addr = INADDR_ANY;
-	#endif
-
-	return bind(socket, (struct sockaddr*)&serverAddress, sizeof(serverAddress)) == 0;
+void ProcessingServer::setPipelineConfig(const PipelineConfig& config) {
+	pipelineConfig = config;
 }
 
-bool ProcessingServer::startTCPListening(int socket) {
-	return listen(socket, SOMAXCONN) == 0;
+void ProcessingServer::setReadyCallback(ReadyCallback callback) {
+	readyCallback = std::move(callback);
 }
 
-int ProcessingServer::acceptTCPConnection(int socket) {
-	#ifdef _WIN32
-	sockaddr_in clientAddress;
-	int clientAddressSize = sizeof(clientAddress);
-	#else
-	sockaddr_in clientAddress = {};
-	socklen_t clientAddressSize = sizeof(clientAddress);
-	#endif
+void ProcessingServer::setPassthrough(bool enabled) {
+	passthrough = enabled;
+}
 
-	return accept(socket, (struct sockaddr*)&clientAddress, &clientAddressSize);
+void ProcessingServer::setFairScheduling(const SchedulerConfig& config) {
+	fairScheduling = true;
+	schedulerConfig = config;
 }
 
-int ProcessingServer::receiveTCPData(int socket, char* buffer, size_t length) {
-	#ifdef _WIN32
-	return recv(socket, buffer, length, 0);
-	#else
-	return recv(socket, buffer, length, 0);
-	#endif
+std::vector<ClientSchedulingStats> ProcessingServer::schedulingStatistics() const {
+	std::shared_ptr<FairScheduler> fair = std::atomic_load(&scheduler);
+	return fair ? fair->statistics() : std::vector<ClientSchedulingStats>();
 }
 
+bool ProcessingServer::parseConnectionOptions(std::string_view text, ConnectionOptions& options) {
+	ConnectionOptions parsed = options;
+	size_t position = 0;
+	while (position < text.size()) {
+		size_t end = text.find_first_of(" ,", position);
+		if (end == std::string_view::npos) {
+			end = text.size();
+		}
+		std::string_view option = text.substr(position, end - position);
+		position = end + 1;
+		if (option.empty()) {
+			continue;
+		}
 
-int ProcessingServer::sendTCPData(int socket, const char* data, size_t length) {
-	#ifdef _WIN32
-	return send(socket, data, length, 0);
-	#else
-	return send(socket, data, length, 0);
-	#endif
+		size_t separator = option.find('=');
+		if (separator == std::string_view::npos) {
+			return false;
+		}
+		std::string_view key = option.substr(0, separator);
+		std::string_view value = option.substr(separator + 1);
+		if (key == "passthrough" && (value == "0" || value == "1")) {
+			parsed.passthrough = value == "1";
+		}
+		else if (key == "class") {
+			if (!parsePriorityClass(value, parsed.priority)) {
+				return false;
+			}
+		}
+		else {
+			return false;
+		}
+	}
+
+	options = parsed;
+	return true;
 }
 
-void ProcessingServer::closeTCPSocket(int socket) {
-	if (socket != -1) {
-		#ifdef _WIN32
-		closesocket(socket);
-		#else
-		close(socket);
-		#endif
+bool ProcessingServer::validBatchSize(uint32_t messageCount) {
+	if (messageCount == 0 || messageCount > MAX_BATCH_MESSAGES) {
+		std::cerr << "Invalid batch size " << messageCount << std::endl;
+		return false;
 	}
+	return true;
+}
+
+bool ProcessingServer::validateData(const std::string& data) {
+	return !data.empty() && isValidUtf8(data.data(), data.size());
+}
+
+std::string ProcessingServer::processData(const std::string& data) {
+	return runPipeline(pipelineConfig, data);
+}
+
+Task<bool> ProcessingServer::sendAcknowledgement(Connection& connection) {
+	return connection.sendAll(ACK_POSITIVE, ACK_SIZE);
 }
 
+Task<bool> ProcessingServer::sendNegativeAcknowledgement(Connection& connection) {
+	return connection.sendAll(ACK_NEGATIVE, ACK_SIZE);
+}
+
+Task<bool> ProcessingServer::sendBatchAcknowledgement(Connection& connection, BatchAckStatus status,
+	uint32_t delivered, const std::vector<uint32_t>& dropped) {
+	std::vector<char> ack(BATCH_ACK_SIZE + dropped.size() * sizeof(uint32_t));
+	uint32_t networkCount = htonl(delivered);
+	ack[0] = BATCH_ACK_TAG[0];
+	ack[1] = BATCH_ACK_TAG[1];
+	ack[2] = static_cast<char>(status);
+	std::memcpy(&ack[3], &networkCount, sizeof(networkCount));
+	for (size_t i = 0; i < dropped.size(); i++) {
+		uint32_t networkIndex = htonl(dropped[i]);
+		std::memcpy(&ack[BATCH_ACK_SIZE + i * sizeof(uint32_t)], &networkIndex, sizeof(networkIndex));
+	}
+	co_return co_await connection.sendAll(ack.data(), ack.size());
+}
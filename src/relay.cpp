@@ -0,0 +1,264 @@
+#include "../include/relay.hpp"
+#include "../include/transport.hpp"
+#include <iostream>
+#include <cstring>
+#include <cerrno>
+#include <algorithm>
+
+#ifdef _WIN32
+#include <winsock2.h>
+#else
+#include <sys/socket.h>
+#include <poll.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <csignal>
+#include <pthread.h>
+#endif
+
+// A larger pipe lets a whole batch go out in one splice. Linux caps
+// unprivileged pipes at /proc/sys/fs/pipe-max-size (1 MiB by default).
+const int RELAY_PIPE_SIZE = 1 << 20;
+const size_t RELAY_COPY_CAPACITY = 1 << 20;
+
+#ifdef __linux__
+namespace {
+
+// splice() has no MSG_NOSIGNAL, so writing to a socket whose peer is gone
+// raises SIGPIPE, which would kill the process. The signal is blocked on the
+// calling thread while splicing, and one raised by the splices is consumed
+// before the old mask is restored.
+class SigpipeBlock {
+public:
+	SigpipeBlock() {
+		sigemptyset(&pipeSignal);
+		sigaddset(&pipeSignal, SIGPIPE);
+		sigset_t pending;
+		sigpending(&pending);
+		alreadyPending = sigismember(&pending, SIGPIPE) == 1;
+		pthread_sigmask(SIG_BLOCK, &pipeSignal, &previousMask);
+	}
+
+	~SigpipeBlock() {
+		int savedErrno = errno;
+		if (raised && !alreadyPending) {
+			timespec noWait = { 0, 0 };
+			while (sigtimedwait(&pipeSignal, nullptr, &noWait) < 0 && errno == EINTR) {
+			}
+		}
+		pthread_sigmask(SIG_SETMASK, &previousMask, nullptr);
+		errno = savedErrno;
+	}
+
+	void sawBrokenPipe() { raised = true; }
+
+private:
+	sigset_t pipeSignal;
+	sigset_t previousMask;
+	bool alreadyPending = false;
+	bool raised = false;
+};
+
+}
+#endif
+
+SpliceRelay::SpliceRelay()
+	: pipeFds{ -1, -1 }, pending(0), pipeCapacity(0), overflowing(false), spliceUnsupported(false), copySent(0) {
+	openPipe();
+}
+
+SpliceRelay::~SpliceRelay() {
+	closePipe();
+}
+
+bool SpliceRelay::openPipe() {
+	#ifdef __linux__
+	if (pipe2(pipeFds, O_CLOEXEC) == 0) {
+		// Only the write end is non-blocking: a full pipe must not stall the
+		// reader, while the read end always holds what drainTo() splices.
+		fcntl(pipeFds[1], F_SETFL, O_NONBLOCK);
+		fcntl(pipeFds[1], F_SETPIPE_SZ, RELAY_PIPE_SIZE);
+		int size = fcntl(pipeFds[1], F_GETPIPE_SZ);
+		pipeCapacity = size > 0 ? static_cast<size_t>(size) : 65536;
+		return true;
+	}
+	std::cerr << "Failed to create relay pipe, copying instead: " << strerror(errno) << std::endl;
+	#endif
+	pipeFds[0] = -1;
+	pipeFds[1] = -1;
+	return false;
+}
+
+void SpliceRelay::closePipe() {
+	#ifndef _WIN32
+	for (int& fd : pipeFds) {
+		if (fd != -1) {
+			close(fd);
+			fd = -1;
+		}
+	}
+	#endif
+}
+
+bool SpliceRelay::isZeroCopy() const {
+	return pipeFds[0] != -1 && !spliceUnsupported;
+}
+
+size_t SpliceRelay::buffered() const {
+	return pending + copyBuffer.size() - copySent;
+}
+
+size_t SpliceRelay::capacity() const {
+	return isZeroCopy() ? pipeCapacity : RELAY_COPY_CAPACITY;
+}
+
+// Pipes are limited in buffers rather than bytes, and every spliced skb
+// fragment takes a buffer of its own, so fullness is asked of the kernel.
+bool SpliceRelay::pipeFull() const {
+	#ifndef _WIN32
+	pollfd writable = { pipeFds[1], POLLOUT, 0 };
+	return poll(&writable, 1, 0) == 0;
+	#else
+	return true;
+	#endif
+}
+
+bool SpliceRelay::append(const char* data, size_t length) {
+	#ifndef _WIN32
+	while (pipeFds[1] != -1 && !overflowing && length > 0) {
+		ssize_t written = write(pipeFds[1], data, length);
+		if (written < 0 && errno == EINTR) {
+			continue;
+		}
+		if (written <= 0) {
+			overflowing = true;
+			break;
+		}
+		pending += static_cast<size_t>(written);
+		data += written;
+		length -= static_cast<size_t>(written);
+	}
+	#endif
+	copyBuffer.insert(copyBuffer.end(), data, data + length);
+	return true;
+}
+
+ssize_t SpliceRelay::fill(int socket, size_t length) {
+	#ifdef __linux__
+	while (pipeFds[1] != -1 && !overflowing) {
+		ssize_t moved = splice(socket, NULL, pipeFds[1], NULL, length, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+		if (moved >= 0) {
+			pending += static_cast<size_t>(moved);
+			return moved;
+		}
+		if (errno == EINTR) {
+			continue;
+		}
+		if (errno == EAGAIN) {
+			if (pipeFull()) {
+				overflowing = true;
+				break;
+			}
+			// SPLICE_F_NONBLOCK also applies to the socket, so a blocking
+			// socket with nothing to read is waited on here.
+			if (fcntl(socket, F_GETFL) & O_NONBLOCK) {
+				return -1;
+			}
+			pollfd readable = { socket, POLLIN, 0 };
+			poll(&readable, 1, -1);
+			continue;
+		}
+		// Sockets that do not support splice (or kernels without it) switch
+		// this relay to copying for good once the pipe is drained.
+		if (errno == EINVAL || errno == ENOSYS) {
+			spliceUnsupported = true;
+			overflowing = true;
+			break;
+		}
+		return -1;
+	}
+	#endif
+	return copyFrom(socket, length);
+}
+
+ssize_t SpliceRelay::copyFrom(int socket, size_t length) {
+	size_t offset = copyBuffer.size();
+	copyBuffer.resize(offset + length);
+	ssize_t received = transport::receiveSome(socket, copyBuffer.data() + offset, length);
+	copyBuffer.resize(offset + std::max<ssize_t>(received, 0));
+	return received;
+}
+
+bool SpliceRelay::drainTo(int socket) {
+	for (;;) {
+		if (!drainSome(socket)) {
+			return false;
+		}
+		if (buffered() == 0) {
+			return true;
+		}
+		#ifndef _WIN32
+		pollfd writable = { socket, POLLOUT, 0 };
+		if (poll(&writable, 1, -1) < 0 && errno != EINTR) {
+			return false;
+		}
+		#endif
+	}
+}
+
+bool SpliceRelay::drainSome(int socket) {
+	#ifdef __linux__
+	if (pending > 0) {
+		SigpipeBlock sigpipe;
+		while (pending > 0) {
+			ssize_t moved = splice(pipeFds[0], NULL, socket, NULL, pending, SPLICE_F_MOVE);
+			if (moved < 0 && errno == EINTR) {
+				continue;
+			}
+			if (moved < 0 && errno == EAGAIN) {
+				return true;
+			}
+			if (moved < 0 && errno == EPIPE) {
+				sigpipe.sawBrokenPipe();
+			}
+			if (moved <= 0) {
+				return false;
+			}
+			pending -= static_cast<size_t>(moved);
+		}
+	}
+	#endif
+
+	while (copySent < copyBuffer.size()) {
+		ssize_t sent = transport::sendSome(socket, copyBuffer.data() + copySent, copyBuffer.size() - copySent);
+		#ifndef _WIN32
+		if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+			return true;
+		}
+		#endif
+		if (sent <= 0) {
+			return false;
+		}
+		copySent += static_cast<size_t>(sent);
+	}
+	copyBuffer.clear();
+	copySent = 0;
+	overflowing = spliceUnsupported;
+	if (spliceUnsupported) {
+		closePipe();
+	}
+	return true;
+}
+
+void SpliceRelay::reset() {
+	copyBuffer.clear();
+	copySent = 0;
+	if (pending > 0) {
+		closePipe();
+		if (!spliceUnsupported) {
+			openPipe();
+		}
+	}
+	pending = 0;
+	overflowing = spliceUnsupported;
+}
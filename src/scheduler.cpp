@@ -0,0 +1,370 @@
+#include "../include/scheduler.hpp"
+#include <iostream>
+#include <sstream>
+#include <iomanip>
+#include <algorithm>
+#include <utility>
+
+const char* priorityClassName(PriorityClass priority) {
+	switch (priority) {
+	case PRIORITY_INTERACTIVE: return "interactive";
+	case PRIORITY_NORMAL: return "normal";
+	case PRIORITY_BULK: return "bulk";
+	default: return "unknown";
+	}
+}
+
+bool parsePriorityClass(std::string_view name, PriorityClass& priority) {
+	for (uint32_t i = 0; i < PRIORITY_CLASS_COUNT; i++) {
+		if (name == priorityClassName(static_cast<PriorityClass>(i))) {
+			priority = static_cast<PriorityClass>(i);
+			return true;
+		}
+	}
+	return false;
+}
+
+FairScheduler::FairScheduler(const SchedulerConfig& config)
+	: settings(config), nextClientId(1), stopping(false) {
+	auto now = std::chrono::steady_clock::now();
+	for (uint32_t i = 0; i < PRIORITY_CLASS_COUNT; i++) {
+		settings.classes[i].weight = std::max<uint32_t>(settings.classes[i].weight, 1);
+		buckets[i].tokens = static_cast<double>(settings.classes[i].rateLimit);
+		buckets[i].refilledAt = now;
+	}
+	settings.maxQueueDepth = std::max<size_t>(settings.maxQueueDepth, 1);
+
+	size_t workerCount = settings.workerThreads;
+	if (workerCount == 0) {
+		workerCount = std::max(std::thread::hardware_concurrency(), 1u);
+	}
+	for (size_t i = 0; i < workerCount; i++) {
+		workers.emplace_back(&FairScheduler::runWorker, this);
+	}
+	if (settings.reportInterval.count() > 0) {
+		reporter = std::thread(&FairScheduler::printReports, this);
+	}
+}
+
+FairScheduler::~FairScheduler() {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	workAvailable.notify_all();
+	progress.notify_all();
+	reportWakeup.notify_all();
+	for (auto& worker : workers) {
+		worker.join();
+	}
+	if (reporter.joinable()) {
+		reporter.join();
+	}
+}
+
+uint64_t FairScheduler::addClient(PriorityClass priority) {
+	std::lock_guard<std::mutex> lock(mutex);
+	auto client = std::make_unique<ClientQueue>();
+	client->id = nextClientId++;
+	client->priority = priority;
+	uint64_t id = client->id;
+	clients.emplace(id, std::move(client));
+	return id;
+}
+
+void FairScheduler::setClientClass(uint64_t client, PriorityClass priority) {
+	std::lock_guard<std::mutex> lock(mutex);
+	auto it = clients.find(client);
+	if (it != clients.end()) {
+		it->second->priority = priority;
+	}
+}
+
+void FairScheduler::removeClient(uint64_t client) {
+	std::unique_lock<std::mutex> lock(mutex);
+	auto it = clients.find(client);
+	if (it == clients.end()) {
+		return;
+	}
+	ClientQueue* queue = it->second.get();
+	progress.wait(lock, [queue]() { return queue->jobs.empty() && !queue->busy; });
+	clients.erase(client);
+}
+
+bool FairScheduler::submit(uint64_t client, size_t cost, Job job) {
+	std::unique_lock<std::mutex> lock(mutex);
+	auto it = clients.find(client);
+	if (it == clients.end()) {
+		return false;
+	}
+	ClientQueue* queue = it->second.get();
+	progress.wait(lock, [this, queue]() { return queue->jobs.size() < settings.maxQueueDepth; });
+
+	queue->jobs.push_back({ std::max<size_t>(cost, 1), std::move(job), std::chrono::steady_clock::now() });
+	queue->maxQueued = std::max(queue->maxQueued, queue->jobs.size());
+	if (queue->jobs.size() == 1) {
+		ring.push_back(queue);
+	}
+	workAvailable.notify_one();
+	return true;
+}
+
+void FairScheduler::drain(uint64_t client) {
+	std::unique_lock<std::mutex> lock(mutex);
+	auto it = clients.find(client);
+	if (it == clients.end()) {
+		return;
+	}
+	ClientQueue* queue = it->second.get();
+	progress.wait(lock, [queue]() { return queue->jobs.empty() && !queue->busy; });
+}
+
+bool FairScheduler::trySubmit(uint64_t client, size_t cost, Job& job, std::function<void()> wake) {
+	std::lock_guard<std::mutex> lock(mutex);
+	auto it = clients.find(client);
+	if (it == clients.end()) {
+		job = nullptr;
+		return true;
+	}
+	ClientQueue* queue = it->second.get();
+	if (queue->jobs.size() >= settings.maxQueueDepth) {
+		queue->wake = std::move(wake);
+		return false;
+	}
+
+	queue->jobs.push_back({ std::max<size_t>(cost, 1), std::move(job), std::chrono::steady_clock::now() });
+	queue->maxQueued = std::max(queue->maxQueued, queue->jobs.size());
+	if (queue->jobs.size() == 1) {
+		ring.push_back(queue);
+	}
+	workAvailable.notify_one();
+	return true;
+}
+
+bool FairScheduler::tryDrain(uint64_t client, std::function<void()> wake) {
+	std::lock_guard<std::mutex> lock(mutex);
+	auto it = clients.find(client);
+	if (it == clients.end()) {
+		return true;
+	}
+	ClientQueue* queue = it->second.get();
+	if (queue->jobs.empty() && !queue->busy) {
+		return true;
+	}
+	queue->wake = std::move(wake);
+	return false;
+}
+
+void FairScheduler::cancelWake(uint64_t client) {
+	std::lock_guard<std::mutex> lock(mutex);
+	auto it = clients.find(client);
+	if (it != clients.end()) {
+		it->second->wake = nullptr;
+	}
+}
+
+std::vector<ClientSchedulingStats> FairScheduler::statistics() const {
+	std::lock_guard<std::mutex> lock(mutex);
+	std::vector<ClientSchedulingStats> result;
+	for (const auto& entry : clients) {
+		const ClientQueue& queue = *entry.second;
+		result.push_back({ queue.id, queue.priority, queue.jobs.size(), queue.maxQueued,
+			queue.completed, queue.totalWait, queue.maxWait });
+	}
+	std::sort(result.begin(), result.end(), [](const ClientSchedulingStats& a, const ClientSchedulingStats& b) {
+		return a.client < b.client;
+	});
+	return result;
+}
+
+void FairScheduler::runWorker() {
+	std::unique_lock<std::mutex> lock(mutex);
+	for (;;) {
+		QueuedJob job;
+		ClientQueue* client = nullptr;
+		auto wakeAt = std::chrono::steady_clock::time_point::max();
+		if (dispatch(job, client, wakeAt)) {
+			lock.unlock();
+			try {
+				job.work();
+			}
+			catch (const std::exception& e) {
+				std::cerr << "Scheduled job failed: " << e.what() << std::endl;
+			}
+			catch (...) {
+				std::cerr << "Scheduled job failed" << std::endl;
+			}
+			job.work = nullptr;
+			lock.lock();
+
+			client->busy = false;
+			client->completed++;
+			if (client->wake) {
+				std::exchange(client->wake, nullptr)();
+			}
+			// Once stopping, idle workers must notice an empty ring to exit.
+			if (stopping) {
+				workAvailable.notify_all();
+			} else if (!client->jobs.empty()) {
+				workAvailable.notify_one();
+			}
+			progress.notify_all();
+			continue;
+		}
+
+		if (stopping && ring.empty()) {
+			return;
+		}
+		if (wakeAt == std::chrono::steady_clock::time_point::max()) {
+			workAvailable.wait(lock);
+		} else {
+			workAvailable.wait_until(lock, wakeAt);
+		}
+	}
+}
+
+void FairScheduler::printReports() {
+	std::unique_lock<std::mutex> lock(mutex);
+	while (!reportWakeup.wait_for(lock, settings.reportInterval, [this]() { return stopping; })) {
+		lock.unlock();
+		for (const ClientSchedulingStats& stats : statistics()) {
+			std::ostringstream line;
+			line << std::fixed << std::setprecision(2) << "Client " << stats.client
+				<< " (" << priorityClassName(stats.priority) << "): queued " << stats.queued
+				<< ", max " << stats.maxQueued << ", served " << stats.completed
+				<< ", wait avg " << std::chrono::duration<double, std::milli>(stats.averageWait()).count()
+				<< " ms, max " << std::chrono::duration<double, std::milli>(stats.maxWait).count() << " ms";
+			std::cout << line.str() << std::endl;
+		}
+		lock.lock();
+	}
+}
+
+void FairScheduler::refill(std::chrono::steady_clock::time_point now) {
+	for (uint32_t i = 0; i < PRIORITY_CLASS_COUNT; i++) {
+		uint64_t rate = settings.classes[i].rateLimit;
+		if (rate == 0) {
+			continue;
+		}
+		// Up to one second of unused rate is kept as burst.
+		double elapsed = std::chrono::duration<double>(now - buckets[i].refilledAt).count();
+		buckets[i].tokens = std::min(static_cast<double>(rate), buckets[i].tokens + elapsed * static_cast<double>(rate));
+		buckets[i].refilledAt = now;
+	}
+}
+
+void FairScheduler::endTurn(size_t position) {
+	ClientQueue* client = ring[position];
+	client->inTurn = false;
+	ring.erase(ring.begin() + static_cast<std::ptrdiff_t>(position));
+	ring.push_back(client);
+}
+
+// Picks the next job in deficit round robin order. A client is granted its
+// quantum once per turn and served while its deficit covers the next job,
+// then its turn ends and it moves to the back of the ring. Clients that are
+// busy or whose class is out of tokens are passed over in place, keeping
+// their position, deficit and turn, so with several workers a client waiting
+// for its running job is not handed extra quanta. Jobs may cost more than a
+// quantum, their client then waits for several turns. When nothing can run
+// because of rate limits, wakeAt is set to the earliest refill.
+bool FairScheduler::dispatch(QueuedJob& job, ClientQueue*& client,
+	std::chrono::steady_clock::time_point& wakeAt) {
+	auto now = std::chrono::steady_clock::now();
+	refill(now);
+
+	size_t position = 0;
+	while (position < ring.size()) {
+		ClientQueue* candidate = ring[position];
+		const ClassPolicy& policy = settings.classes[candidate->priority];
+		TokenBucket& bucket = buckets[candidate->priority];
+		bool limited = !stopping && policy.rateLimit > 0 && bucket.tokens <= 0;
+		if (candidate->busy || limited) {
+			if (limited) {
+				auto refillTime = std::chrono::duration<double>(-bucket.tokens / static_cast<double>(policy.rateLimit));
+				wakeAt = std::min(wakeAt, now + std::chrono::duration_cast<std::chrono::steady_clock::duration>(refillTime) +
+					std::chrono::milliseconds(1));
+			}
+			position++;
+			continue;
+		}
+
+		if (!candidate->inTurn) {
+			candidate->deficit += policy.weight * SCHEDULER_QUANTUM;
+			candidate->inTurn = true;
+		}
+		if (candidate->deficit < candidate->jobs.front().cost) {
+			endTurn(position);
+			continue;
+		}
+
+		job = std::move(candidate->jobs.front());
+		candidate->jobs.pop_front();
+		candidate->deficit -= job.cost;
+		candidate->busy = true;
+		if (policy.rateLimit > 0) {
+			bucket.tokens -= static_cast<double>(job.cost);
+		}
+
+		auto waited = std::chrono::duration_cast<std::chrono::nanoseconds>(now - job.enqueuedAt);
+		candidate->totalWait += waited;
+		candidate->maxWait = std::max(candidate->maxWait, waited);
+
+		if (candidate->jobs.empty()) {
+			candidate->deficit = 0;
+			candidate->inTurn = false;
+			ring.erase(ring.begin() + static_cast<std::ptrdiff_t>(position));
+		}
+		client = candidate;
+		return true;
+	}
+	return false;
+}
+
+SchedulerSession::SchedulerSession(FairScheduler* scheduler, PriorityClass priority)
+	: scheduler(scheduler), client(scheduler ? scheduler->addClient(priority) : 0) {
+}
+
+SchedulerSession::~SchedulerSession() {
+	if (scheduler) {
+		scheduler->removeClient(client);
+	}
+}
+
+void SchedulerSession::setClass(PriorityClass priority) {
+	if (scheduler) {
+		scheduler->setClientClass(client, priority);
+	}
+}
+
+bool SchedulerSession::submit(size_t cost, FairScheduler::Job job) {
+	if (!scheduler) {
+		job();
+		return true;
+	}
+	return scheduler->submit(client, cost, std::move(job));
+}
+
+void SchedulerSession::drain() {
+	if (scheduler) {
+		scheduler->drain(client);
+	}
+}
+
+bool SchedulerSession::trySubmit(size_t cost, FairScheduler::Job& job, std::function<void()> wake) {
+	if (!scheduler) {
+		std::exchange(job, nullptr)();
+		return true;
+	}
+	return scheduler->trySubmit(client, cost, job, std::move(wake));
+}
+
+bool SchedulerSession::tryDrain(std::function<void()> wake) {
+	return !scheduler || scheduler->tryDrain(client, std::move(wake));
+}
+
+void SchedulerSession::cancelWake() {
+	if (scheduler) {
+		scheduler->cancelWake(client);
+	}
+}
@@ -0,0 +1,188 @@
+#include "../include/sketch.hpp"
+#include <algorithm>
+#include <cstring>
+
+WordFrequencySketch::WordFrequencySketch(const SketchConfig& config)
+	: settings(config), totalCount(0), usedSlots(0) {
+	settings.width = std::max<size_t>(settings.width, 1);
+	settings.depth = std::max<size_t>(settings.depth, 1);
+	settings.topK = std::max<size_t>(settings.topK, 1);
+
+	counters.reset(new std::atomic<uint64_t>[settings.width * settings.depth]());
+	slots.reset(new Slot[settings.topK]());
+	heap.reserve(settings.topK);
+	heapPosition.resize(settings.topK);
+	slotCounts.resize(settings.topK);
+	slotWords.resize(settings.topK);
+	slotOf.reserve(settings.topK);
+}
+
+size_t WordFrequencySketch::memoryBytes() const {
+	size_t counterBytes = settings.width * settings.depth * sizeof(uint64_t);
+	size_t slotBytes = settings.topK * (sizeof(Slot) + 2 * sizeof(uint32_t) + sizeof(uint64_t) +
+		sizeof(std::string) + SKETCH_MAX_WORD_LENGTH);
+	return counterBytes + slotBytes;
+}
+
+// Rows use double hashing over one 64-bit hash instead of depth independent
+// hash functions.
+size_t WordFrequencySketch::counterIndex(size_t row, uint64_t hash) const {
+	uint32_t first = static_cast<uint32_t>(hash);
+	uint32_t step = static_cast<uint32_t>(hash >> 32) | 1;
+	uint32_t mixed = first + static_cast<uint32_t>(row) * step;
+	return row * settings.width + static_cast<size_t>((static_cast<uint64_t>(mixed) * settings.width) >> 32);
+}
+
+void WordFrequencySketch::add(std::string_view word, uint64_t occurrences) {
+	uint64_t hash = static_cast<uint64_t>(std::hash<std::string_view>()(word)) * 0x9E3779B97F4A7C15ull;
+	uint64_t estimate = UINT64_MAX;
+	for (size_t row = 0; row < settings.depth; row++) {
+		uint64_t count = counters[counterIndex(row, hash)].fetch_add(occurrences, std::memory_order_relaxed) + occurrences;
+		estimate = std::min(estimate, count);
+	}
+	totalCount.fetch_add(occurrences, std::memory_order_relaxed);
+
+	if (word.empty() || word.size() > SKETCH_MAX_WORD_LENGTH) {
+		return;
+	}
+
+	auto it = slotOf.find(word);
+	if (it != slotOf.end()) {
+		uint32_t slot = it->second;
+		publish(slot, word, estimate);
+		siftDown(heapPosition[slot]);
+		return;
+	}
+
+	uint32_t slot;
+	if (heap.size() < settings.topK) {
+		slot = static_cast<uint32_t>(heap.size());
+		heap.push_back(slot);
+		heapPosition[slot] = slot;
+	}
+	else if (estimate > slotCounts[heap[0]]) {
+		slot = heap[0];
+		slotOf.erase(slotWords[slot]);
+	}
+	else {
+		return;
+	}
+
+	slotWords[slot].assign(word);
+	slotOf.emplace(slotWords[slot], slot);
+	publish(slot, word, estimate);
+	if (slot == usedSlots.load(std::memory_order_relaxed)) {
+		usedSlots.store(slot + 1, std::memory_order_release);
+		siftUp(heapPosition[slot]);
+	} else {
+		siftDown(heapPosition[slot]);
+	}
+}
+
+void WordFrequencySketch::publish(uint32_t slot, std::string_view word, uint64_t count) {
+	Slot& target = slots[slot];
+	slotCounts[slot] = count;
+
+	uint32_t sequence = target.sequence.load(std::memory_order_relaxed);
+	target.sequence.store(sequence + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+
+	target.count.store(count, std::memory_order_relaxed);
+	target.length.store(static_cast<uint32_t>(word.size()), std::memory_order_relaxed);
+	for (size_t chunk = 0; chunk * sizeof(uint64_t) < word.size(); chunk++) {
+		uint64_t value = 0;
+		size_t offset = chunk * sizeof(uint64_t);
+		memcpy(&value, word.data() + offset, std::min(sizeof(uint64_t), word.size() - offset));
+		target.bytes[chunk].store(value, std::memory_order_relaxed);
+	}
+
+	target.sequence.store(sequence + 2, std::memory_order_release);
+}
+
+bool WordFrequencySketch::readSlot(size_t slot, WordCount& out) const {
+	const Slot& source = slots[slot];
+	char word[SKETCH_MAX_WORD_LENGTH];
+	for (;;) {
+		uint32_t before = source.sequence.load(std::memory_order_acquire);
+		if (before & 1) {
+			continue;
+		}
+
+		uint64_t count = source.count.load(std::memory_order_relaxed);
+		size_t length = std::min<size_t>(source.length.load(std::memory_order_relaxed), SKETCH_MAX_WORD_LENGTH);
+		for (size_t chunk = 0; chunk * sizeof(uint64_t) < length; chunk++) {
+			uint64_t value = source.bytes[chunk].load(std::memory_order_relaxed);
+			size_t offset = chunk * sizeof(uint64_t);
+			memcpy(word + offset, &value, std::min(sizeof(uint64_t), length - offset));
+		}
+
+		std::atomic_thread_fence(std::memory_order_acquire);
+		if (source.sequence.load(std::memory_order_relaxed) == before) {
+			out.word.assign(word, length);
+			out.count = count;
+			return length > 0;
+		}
+	}
+}
+
+uint64_t WordFrequencySketch::estimate(std::string_view word) const {
+	uint64_t hash = static_cast<uint64_t>(std::hash<std::string_view>()(word)) * 0x9E3779B97F4A7C15ull;
+	uint64_t estimate = UINT64_MAX;
+	for (size_t row = 0; row < settings.depth; row++) {
+		estimate = std::min<uint64_t>(estimate, counters[counterIndex(row, hash)].load(std::memory_order_relaxed));
+	}
+	return estimate;
+}
+
+std::vector<WordCount> WordFrequencySketch::top(size_t count) const {
+	std::vector<WordCount> words;
+	size_t used = usedSlots.load(std::memory_order_acquire);
+	words.reserve(used);
+	for (size_t slot = 0; slot < used; slot++) {
+		WordCount entry;
+		if (readSlot(slot, entry)) {
+			words.push_back(std::move(entry));
+		}
+	}
+
+	std::sort(words.begin(), words.end(), [](const WordCount& a, const WordCount& b) {
+		return a.count != b.count ? a.count > b.count : a.word < b.word;
+	});
+	if (words.size() > count) {
+		words.resize(count);
+	}
+	return words;
+}
+
+void WordFrequencySketch::swapHeap(size_t a, size_t b) {
+	std::swap(heap[a], heap[b]);
+	heapPosition[heap[a]] = static_cast<uint32_t>(a);
+	heapPosition[heap[b]] = static_cast<uint32_t>(b);
+}
+
+void WordFrequencySketch::siftUp(size_t position) {
+	while (position > 0) {
+		size_t parent = (position - 1) / 2;
+		if (slotCounts[heap[parent]] <= slotCounts[heap[position]]) {
+			break;
+		}
+		swapHeap(parent, position);
+		position = parent;
+	}
+}
+
+void WordFrequencySketch::siftDown(size_t position) {
+	for (;;) {
+		size_t smallest = position;
+		for (size_t child = 2 * position + 1; child <= 2 * position + 2 && child < heap.size(); child++) {
+			if (slotCounts[heap[child]] < slotCounts[heap[smallest]]) {
+				smallest = child;
+			}
+		}
+		if (smallest == position) {
+			return;
+		}
+		swapHeap(position, smallest);
+		position = smallest;
+	}
+}
@@ -0,0 +1,366 @@
+#include "../include/trace.hpp"
+#include <iostream>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <random>
+#include <algorithm>
+#include <unordered_map>
+
+#ifdef _WIN32
+#include <process.h>
+#else
+#include <unistd.h>
+#endif
+
+std::atomic<bool> traceWriterActive(false);
+
+namespace {
+
+const char TRACE_FILE_MAGIC[8] = { 'C', 'S', 'T', 'R', 'A', 'C', 'E', '1' };
+const size_t TRACE_RING_CAPACITY = 4096;
+const std::chrono::milliseconds TRACE_FLUSH_INTERVAL(100);
+
+// Single-producer single-consumer ring: the owning thread pushes, the
+// writer thread drains.
+class TraceRing {
+public:
+	explicit TraceRing(uint32_t threadId)
+		: threadId(threadId), retired(false), dropped(0), head(0), tail(0) {}
+
+	bool push(const TraceRecord& record) {
+		size_t position = head.load(std::memory_order_relaxed);
+		if (position - tail.load(std::memory_order_acquire) == TRACE_RING_CAPACITY) {
+			dropped.fetch_add(1, std::memory_order_relaxed);
+			return false;
+		}
+		records[position & (TRACE_RING_CAPACITY - 1)] = record;
+		head.store(position + 1, std::memory_order_release);
+		return true;
+	}
+
+	void drain(std::vector<TraceRecord>& out) {
+		size_t position = tail.load(std::memory_order_relaxed);
+		size_t end = head.load(std::memory_order_acquire);
+		for (; position != end; position++) {
+			out.push_back(records[position & (TRACE_RING_CAPACITY - 1)]);
+		}
+		tail.store(position, std::memory_order_release);
+	}
+
+	const uint32_t threadId;
+	std::atomic<bool> retired;
+	std::atomic<uint64_t> dropped;
+
+private:
+	alignas(64) std::atomic<size_t> head;
+	alignas(64) std::atomic<size_t> tail;
+	TraceRecord records[TRACE_RING_CAPACITY];
+};
+
+struct TraceRegistry {
+	std::mutex mutex;
+	std::vector<std::shared_ptr<TraceRing>> rings;
+	uint32_t nextThreadId = 1;
+	uint64_t droppedByRetired = 0;
+};
+
+TraceRegistry& traceRegistry() {
+	static TraceRegistry registry;
+	return registry;
+}
+
+// Rings outlive their threads until the writer has drained them.
+struct LocalTraceRing {
+	std::shared_ptr<TraceRing> ring;
+
+	~LocalTraceRing() {
+		if (ring) {
+			ring->retired = true;
+		}
+	}
+};
+
+thread_local LocalTraceRing localTraceRing;
+
+TraceRing& currentTraceRing() {
+	if (!localTraceRing.ring) {
+		TraceRegistry& registry = traceRegistry();
+		std::lock_guard<std::mutex> lock(registry.mutex);
+		localTraceRing.ring = std::make_shared<TraceRing>(registry.nextThreadId++);
+		registry.rings.push_back(localTraceRing.ring);
+	}
+	return *localTraceRing.ring;
+}
+
+struct TraceWriter {
+	std::mutex mutex;
+	std::condition_variable wake;
+	bool stopping = false;
+	std::thread thread;
+	FILE* file = NULL;
+	std::vector<TraceRecord> buffer;
+};
+
+TraceWriter traceWriter;
+std::mutex traceWriterControl;
+
+void flushTraceRings(TraceWriter& writer) {
+	TraceRegistry& registry = traceRegistry();
+	writer.buffer.clear();
+	{
+		std::lock_guard<std::mutex> lock(registry.mutex);
+		auto& rings = registry.rings;
+		for (size_t i = 0; i < rings.size();) {
+			// Read the flag first: a retired ring gets no more pushes, so it
+			// is empty once drained.
+			bool retired = rings[i]->retired.load();
+			rings[i]->drain(writer.buffer);
+			if (retired) {
+				registry.droppedByRetired += rings[i]->dropped.load();
+				rings[i] = rings.back();
+				rings.pop_back();
+				continue;
+			}
+			i++;
+		}
+	}
+
+	if (!writer.buffer.empty()) {
+		fwrite(writer.buffer.data(), sizeof(TraceRecord), writer.buffer.size(), writer.file);
+		fflush(writer.file);
+	}
+}
+
+uint64_t droppedTraceSpans() {
+	TraceRegistry& registry = traceRegistry();
+	std::lock_guard<std::mutex> lock(registry.mutex);
+	uint64_t dropped = registry.droppedByRetired;
+	for (const auto& ring : registry.rings) {
+		dropped += ring->dropped.load();
+	}
+	return dropped;
+}
+
+uint32_t currentProcessId() {
+	#ifdef _WIN32
+	return static_cast<uint32_t>(_getpid());
+	#else
+	return static_cast<uint32_t>(getpid());
+	#endif
+}
+
+uint64_t mixBits(uint64_t value) {
+	value += 0x9E3779B97F4A7C15ull;
+	value = (value ^ (value >> 30)) * 0xBF58476D1CE4E5B9ull;
+	value = (value ^ (value >> 27)) * 0x94D049BB133111EBull;
+	return value ^ (value >> 31);
+}
+
+uint64_t randomSeed() {
+	std::random_device device;
+	return (static_cast<uint64_t>(device()) << 32) ^ device() ^ traceClock();
+}
+
+}
+
+const char* traceStageName(uint32_t stage) {
+	static const char* const NAMES[TRACE_STAGE_COUNT] = {
+		"client.send",
+		"client.ack",
+		"processing.receive",
+		"processing.pipeline",
+		"processing.display_send",
+		"display.receive",
+		"display.output"
+	};
+	return stage < TRACE_STAGE_COUNT ? NAMES[stage] : "unknown";
+}
+
+void recordTraceSpan(uint64_t traceId, TraceStage stage, uint64_t startNanos, uint64_t endNanos) {
+	TraceRing& ring = currentTraceRing();
+	ring.push({ traceId, startNanos, endNanos, ring.threadId, stage });
+}
+
+bool startTraceWriter(const std::string& path) {
+	std::lock_guard<std::mutex> control(traceWriterControl);
+	if (traceWriter.file != NULL) {
+		std::cerr << "Trace writer is already running" << std::endl;
+		return false;
+	}
+
+	FILE* file = fopen(path.c_str(), "wb");
+	if (file == NULL) {
+		std::cerr << "Failed to open trace file " << path << std::endl;
+		return false;
+	}
+
+	uint32_t header[2] = { currentProcessId(), 0 };
+	if (fwrite(TRACE_FILE_MAGIC, sizeof(TRACE_FILE_MAGIC), 1, file) != 1 ||
+		fwrite(header, sizeof(header), 1, file) != 1) {
+		std::cerr << "Failed to write trace file header" << std::endl;
+		fclose(file);
+		return false;
+	}
+
+	traceWriter.file = file;
+	traceWriter.stopping = false;
+	traceWriter.thread = std::thread([]() {
+		std::unique_lock<std::mutex> lock(traceWriter.mutex);
+		while (!traceWriter.stopping) {
+			traceWriter.wake.wait_for(lock, TRACE_FLUSH_INTERVAL);
+			flushTraceRings(traceWriter);
+		}
+	});
+	traceWriterActive = true;
+	return true;
+}
+
+void stopTraceWriter() {
+	std::lock_guard<std::mutex> control(traceWriterControl);
+	if (traceWriter.file == NULL) {
+		return;
+	}
+
+	traceWriterActive = false;
+	{
+		std::lock_guard<std::mutex> lock(traceWriter.mutex);
+		traceWriter.stopping = true;
+	}
+	traceWriter.wake.notify_all();
+	traceWriter.thread.join();
+
+	flushTraceRings(traceWriter);
+	fclose(traceWriter.file);
+	traceWriter.file = NULL;
+
+	uint64_t dropped = droppedTraceSpans();
+	if (dropped > 0) {
+		std::cerr << "Trace buffers overflowed, " << dropped << " spans dropped" << std::endl;
+	}
+}
+
+uint64_t newTraceId() {
+	static const uint64_t seed = randomSeed();
+	static std::atomic<uint64_t> counter(0);
+	uint64_t traceId = mixBits(seed + counter.fetch_add(1, std::memory_order_relaxed));
+	return traceId != 0 ? traceId : 1;
+}
+
+TraceSampler::TraceSampler(double rate)
+	: threshold(0), state(randomSeed() | 1) {
+	setRate(rate);
+}
+
+void TraceSampler::setRate(double rate) {
+	if (rate <= 0.0) {
+		threshold = 0;
+	}
+	else if (rate >= 1.0) {
+		threshold = UINT64_MAX;
+	}
+	else {
+		threshold = std::max<uint64_t>(1, static_cast<uint64_t>(rate * 18446744073709551615.0));
+	}
+}
+
+bool convertTraceToChrome(const std::vector<std::string>& inputPaths, const std::string& outputPath) {
+	struct ProcessRecord {
+		uint32_t processId;
+		TraceRecord record;
+	};
+	std::vector<ProcessRecord> records;
+
+	for (const auto& path : inputPaths) {
+		FILE* file = fopen(path.c_str(), "rb");
+		if (file == NULL) {
+			std::cerr << "Failed to open trace file " << path << std::endl;
+			return false;
+		}
+
+		char magic[sizeof(TRACE_FILE_MAGIC)];
+		uint32_t header[2];
+		if (fread(magic, sizeof(magic), 1, file) != 1 ||
+			std::memcmp(magic, TRACE_FILE_MAGIC, sizeof(magic)) != 0 ||
+			fread(header, sizeof(header), 1, file) != 1) {
+			std::cerr << "Not a trace file: " << path << std::endl;
+			fclose(file);
+			return false;
+		}
+
+		TraceRecord record;
+		while (fread(&record, sizeof(record), 1, file) == 1) {
+			records.push_back({ header[0], record });
+		}
+		fclose(file);
+	}
+
+	std::sort(records.begin(), records.end(), [](const ProcessRecord& a, const ProcessRecord& b) {
+		return a.record.startNanos < b.record.startNanos;
+	});
+
+	FILE* output = fopen(outputPath.c_str(), "w");
+	if (output == NULL) {
+		std::cerr << "Failed to open " << outputPath << std::endl;
+		return false;
+	}
+
+	uint64_t origin = records.empty() ? 0 : records.front().record.startNanos;
+	fprintf(output, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+	for (size_t i = 0; i < records.size(); i++) {
+		const TraceRecord& record = records[i].record;
+		fprintf(output, "%s\n{\"name\":\"%s\",\"cat\":\"message\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,"
+			"\"pid\":%u,\"tid\":%u,\"args\":{\"trace_id\":\"%016llx\"}}",
+			i == 0 ? "" : ",", traceStageName(record.stage),
+			(record.startNanos - origin) / 1000.0, (record.endNanos - record.startNanos) / 1000.0,
+			records[i].processId, record.threadId, static_cast<unsigned long long>(record.traceId));
+	}
+	fprintf(output, "\n]}\n");
+	bool written = fclose(output) == 0;
+
+	// Latency breakdown per stage, plus client send to display output for
+	// traces that were recorded at both ends.
+	std::vector<std::vector<uint64_t>> durations(TRACE_STAGE_COUNT + 1);
+	std::unordered_map<uint64_t, std::pair<uint64_t, uint64_t>> endToEnd;
+	for (const auto& entry : records) {
+		const TraceRecord& record = entry.record;
+		if (record.stage >= TRACE_STAGE_COUNT) {
+			continue;
+		}
+		durations[record.stage].push_back(record.endNanos - record.startNanos);
+		if (record.stage == TRACE_CLIENT_SEND) {
+			endToEnd[record.traceId].first = record.startNanos;
+		}
+		else if (record.stage == TRACE_DISPLAY_OUTPUT) {
+			endToEnd[record.traceId].second = record.endNanos;
+		}
+	}
+	for (const auto& trace : endToEnd) {
+		if (trace.second.first != 0 && trace.second.second > trace.second.first) {
+			durations[TRACE_STAGE_COUNT].push_back(trace.second.second - trace.second.first);
+		}
+	}
+
+	printf("%-26s %8s %10s %10s %10s %10s\n", "stage", "count", "mean us", "p50 us", "p99 us", "max us");
+	for (size_t stage = 0; stage <= TRACE_STAGE_COUNT; stage++) {
+		std::vector<uint64_t>& values = durations[stage];
+		if (values.empty()) {
+			continue;
+		}
+		std::sort(values.begin(), values.end());
+		double total = 0;
+		for (uint64_t value : values) {
+			total += static_cast<double>(value);
+		}
+		printf("%-26s %8zu %10.1f %10.1f %10.1f %10.1f\n",
+			stage == TRACE_STAGE_COUNT ? "end-to-end" : traceStageName(static_cast<uint32_t>(stage)),
+			values.size(), total / values.size() / 1000.0,
+			values[values.size() / 2] / 1000.0,
+			values[std::min(values.size() - 1, values.size() * 99 / 100)] / 1000.0,
+			values.back() / 1000.0);
+	}
+	return written;
+}
@@ -0,0 +1,539 @@
+#include "../include/transport.hpp"
+#include <iostream>
+#include <cstring>
+#include <cerrno>
+#include <algorithm>
+#include <mutex>
+
+#ifdef _WIN32
+#pragma comment(lib, "ws2_32.lib")
+#else
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <climits>
+#include <poll.h>
+#include <unistd.h>
+#endif
+
+namespace transport {
+
+namespace {
+
+#ifdef _WIN32
+const int SEND_FLAGS = 0;
+#else
+const int SEND_FLAGS = MSG_NOSIGNAL;
+#endif
+
+std::mutex optionsMutex;
+SocketOptions defaultOptions;
+
+#ifndef _WIN32
+bool waitUntilWritable(int socket) {
+	pollfd writable = { socket, POLLOUT, 0 };
+	int ready;
+	do {
+		ready = poll(&writable, 1, -1);
+	} while (ready < 0 && errno == EINTR);
+	return ready > 0;
+}
+#endif
+
+std::string lastError() {
+	#ifdef _WIN32
+	return "error " + std::to_string(WSAGetLastError());
+	#else
+	return strerror(errno);
+	#endif
+}
+
+#ifndef _WIN32
+bool makeUnixAddress(const std::string& host, sockaddr_storage& address, socklen_t& length) {
+	std::string path = host.substr(sizeof(UNIX_PREFIX) - 1);
+	sockaddr_un* unixAddress = reinterpret_cast<sockaddr_un*>(&address);
+	if (path.empty() || path.size() >= sizeof(unixAddress->sun_path)) {
+		std::cerr << "Invalid unix socket path: " << host << std::endl;
+		return false;
+	}
+	std::memset(&address, 0, sizeof(address));
+	unixAddress->sun_family = AF_UNIX;
+	std::memcpy(unixAddress->sun_path, path.c_str(), path.size() + 1);
+	length = static_cast<socklen_t>(offsetof(sockaddr_un, sun_path) + path.size() + 1);
+	return true;
+}
+#endif
+
+// Binds and listens on one resolved address; -1 leaves errno set.
+int listenOnAddress(const sockaddr* address, socklen_t length) {
+	int sock = static_cast<int>(socket(address->sa_family, SOCK_STREAM, 0));
+	if (sock < 0) {
+		return -1;
+	}
+
+	#ifndef _WIN32
+	if (address->sa_family != AF_UNIX) {
+		// Lets a restarted server bind again while old connections sit in TIME_WAIT.
+		int reuse = 1;
+		setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+	}
+	#endif
+	if (address->sa_family == AF_INET6) {
+		// Dual-stack: IPv4 clients arrive as v4-mapped addresses.
+		int v6Only = 0;
+		setsockopt(sock, IPPROTO_IPV6, IPV6_V6ONLY, reinterpret_cast<const char*>(&v6Only), sizeof(v6Only));
+	}
+
+	if (bind(sock, address, length) < 0 || listen(sock, SOMAXCONN) < 0) {
+		int error = errno;
+		closeSocket(sock);
+		errno = error;
+		return -1;
+	}
+	return sock;
+}
+
+}
+
+bool isUnixAddress(const std::string& host) {
+	return host.compare(0, sizeof(UNIX_PREFIX) - 1, UNIX_PREFIX) == 0;
+}
+
+std::string formatAddress(const std::string& host, int port) {
+	if (isUnixAddress(host)) {
+		return host;
+	}
+	if (host.find(':') != std::string::npos) {
+		return "[" + host + "]:" + std::to_string(port);
+	}
+	return (host.empty() ? "*" : host) + ":" + std::to_string(port);
+}
+
+void setDefaultSocketOptions(const SocketOptions& options) {
+	std::lock_guard<std::mutex> lock(optionsMutex);
+	defaultOptions = options;
+}
+
+SocketOptions defaultSocketOptions() {
+	std::lock_guard<std::mutex> lock(optionsMutex);
+	return defaultOptions;
+}
+
+bool applySocketOptions(int socket, const SocketOptions& options) {
+	sockaddr_storage address = {};
+	socklen_t length = sizeof(address);
+	if (getsockname(socket, reinterpret_cast<sockaddr*>(&address), &length) < 0) {
+		return false;
+	}
+
+	bool applied = true;
+	if (address.ss_family == AF_INET || address.ss_family == AF_INET6) {
+		int noDelay = options.noDelay ? 1 : 0;
+		applied &= setsockopt(socket, IPPROTO_TCP, TCP_NODELAY,
+			reinterpret_cast<const char*>(&noDelay), sizeof(noDelay)) == 0;
+	}
+	if (options.sendBufferSize > 0) {
+		applied &= setsockopt(socket, SOL_SOCKET, SO_SNDBUF,
+			reinterpret_cast<const char*>(&options.sendBufferSize), sizeof(options.sendBufferSize)) == 0;
+	}
+	if (options.receiveBufferSize > 0) {
+		applied &= setsockopt(socket, SOL_SOCKET, SO_RCVBUF,
+			reinterpret_cast<const char*>(&options.receiveBufferSize), sizeof(options.receiveBufferSize)) == 0;
+	}
+	#ifdef SO_BUSY_POLL
+	if (options.busyPollMicros > 0) {
+		applied &= setsockopt(socket, SOL_SOCKET, SO_BUSY_POLL,
+			&options.busyPollMicros, sizeof(options.busyPollMicros)) == 0;
+	}
+	#endif
+
+	if (!applied) {
+		std::cerr << "Failed to apply socket options: " << lastError() << std::endl;
+	}
+	return applied;
+}
+
+void startup() {
+	#ifdef _WIN32
+	WSADATA wsaData;
+	if (WSAStartup(MAKEWORD(2, 2), &wsaData) != 0) {
+		std::cerr << "WSAStartup failed" << std::endl;
+	}
+	#endif
+}
+
+void cleanup() {
+	#ifdef _WIN32
+	WSACleanup();
+	#endif
+}
+
+int listenOn(const std::string& host, int port) {
+	if (isUnixAddress(host)) {
+		#ifdef _WIN32
+		std::cerr << "Unix domain sockets are not supported on this platform" << std::endl;
+		return -1;
+		#else
+		sockaddr_storage address;
+		socklen_t length;
+		if (!makeUnixAddress(host, address, length)) {
+			return -1;
+		}
+		// A socket file left behind by a previous run would make bind fail.
+		const char* path = reinterpret_cast<sockaddr_un*>(&address)->sun_path;
+		struct stat status;
+		if (stat(path, &status) == 0 && S_ISSOCK(status.st_mode)) {
+			unlink(path);
+		}
+		int sock = listenOnAddress(reinterpret_cast<sockaddr*>(&address), length);
+		if (sock < 0) {
+			std::cerr << "Failed to listen on " << host << ": " << lastError() << std::endl;
+		}
+		return sock;
+		#endif
+	}
+
+	if (host.empty()) {
+		sockaddr_in6 anyV6 = {};
+		anyV6.sin6_family = AF_INET6;
+		anyV6.sin6_port = htons(static_cast<uint16_t>(port));
+		anyV6.sin6_addr = in6addr_any;
+		int sock = listenOnAddress(reinterpret_cast<sockaddr*>(&anyV6), sizeof(anyV6));
+		if (sock >= 0) {
+			return sock;
+		}
+
+		// Hosts without IPv6 only get the IPv4 wildcard.
+		sockaddr_in anyV4 = {};
+		anyV4.sin_family = AF_INET;
+		anyV4.sin_port = htons(static_cast<uint16_t>(port));
+		anyV4.sin_addr.s_addr = INADDR_ANY;
+		sock = listenOnAddress(reinterpret_cast<sockaddr*>(&anyV4), sizeof(anyV4));
+		if (sock < 0) {
+			std::cerr << "Failed to listen on port " << port << ": " << lastError() << std::endl;
+		}
+		return sock;
+	}
+
+	addrinfo hints = {};
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = AI_PASSIVE;
+	addrinfo* results = nullptr;
+	std::string service = std::to_string(port);
+	int status = getaddrinfo(host.c_str(), service.c_str(), &hints, &results);
+	if (status != 0) {
+		std::cerr << "Failed to resolve " << host << ": " << gai_strerror(status) << std::endl;
+		return -1;
+	}
+
+	int sock = -1;
+	for (addrinfo* result = results; result != nullptr && sock < 0; result = result->ai_next) {
+		sock = listenOnAddress(result->ai_addr, static_cast<socklen_t>(result->ai_addrlen));
+	}
+	freeaddrinfo(results);
+	if (sock < 0) {
+		std::cerr << "Failed to listen on " << formatAddress(host, port) << ": " << lastError() << std::endl;
+	}
+	return sock;
+}
+
+int connectTo(const std::string& host, int port) {
+	int sock = -1;
+	if (isUnixAddress(host)) {
+		#ifdef _WIN32
+		std::cerr << "Unix domain sockets are not supported on this platform" << std::endl;
+		return -1;
+		#else
+		sockaddr_storage address;
+		socklen_t length;
+		if (!makeUnixAddress(host, address, length)) {
+			return -1;
+		}
+		sock = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (sock >= 0 && connect(sock, reinterpret_cast<sockaddr*>(&address), length) < 0) {
+			int error = errno;
+			closeSocket(sock);
+			errno = error;
+			sock = -1;
+		}
+		#endif
+	} else {
+		addrinfo hints = {};
+		hints.ai_family = AF_UNSPEC;
+		hints.ai_socktype = SOCK_STREAM;
+		addrinfo* results = nullptr;
+		std::string service = std::to_string(port);
+		int status = getaddrinfo(host.c_str(), service.c_str(), &hints, &results);
+		if (status != 0) {
+			std::cerr << "Failed to resolve " << host << ": " << gai_strerror(status) << std::endl;
+			return -1;
+		}
+
+		for (addrinfo* result = results; result != nullptr && sock < 0; result = result->ai_next) {
+			sock = static_cast<int>(socket(result->ai_family, result->ai_socktype, result->ai_protocol));
+			if (sock >= 0 && connect(sock, result->ai_addr, static_cast<socklen_t>(result->ai_addrlen)) < 0) {
+				int error = errno;
+				closeSocket(sock);
+				errno = error;
+				sock = -1;
+			}
+		}
+		freeaddrinfo(results);
+	}
+
+	if (sock < 0) {
+		std::cerr << "Failed to connect to " << formatAddress(host, port) << ": " << lastError() << std::endl;
+		return -1;
+	}
+	applySocketOptions(sock, defaultSocketOptions());
+	return sock;
+}
+
+int accept(int socket) {
+	sockaddr_storage address = {};
+	socklen_t length = sizeof(address);
+	int clientSocket = static_cast<int>(::accept(socket, reinterpret_cast<sockaddr*>(&address), &length));
+	if (clientSocket >= 0) {
+		applySocketOptions(clientSocket, defaultSocketOptions());
+	}
+	return clientSocket;
+}
+
+int boundPort(int socket) {
+	sockaddr_storage address = {};
+	socklen_t length = sizeof(address);
+	if (getsockname(socket, reinterpret_cast<sockaddr*>(&address), &length) < 0) {
+		return -1;
+	}
+	if (address.ss_family == AF_INET) {
+		return ntohs(reinterpret_cast<sockaddr_in*>(&address)->sin_port);
+	}
+	if (address.ss_family == AF_INET6) {
+		return ntohs(reinterpret_cast<sockaddr_in6*>(&address)->sin6_port);
+	}
+	return 0;
+}
+
+#ifndef _WIN32
+bool resolve(const std::string& host, int port, sockaddr_storage& address, socklen_t& length) {
+	if (isUnixAddress(host)) {
+		return makeUnixAddress(host, address, length);
+	}
+
+	addrinfo hints = {};
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	addrinfo* results = nullptr;
+	std::string service = std::to_string(port);
+	int status = getaddrinfo(host.c_str(), service.c_str(), &hints, &results);
+	if (status != 0) {
+		std::cerr << "Failed to resolve " << host << ": " << gai_strerror(status) << std::endl;
+		return false;
+	}
+	std::memcpy(&address, results->ai_addr, results->ai_addrlen);
+	length = static_cast<socklen_t>(results->ai_addrlen);
+	freeaddrinfo(results);
+	return true;
+}
+#endif
+
+ssize_t receiveSome(int socket, char* buffer, size_t length) {
+	#ifdef _WIN32
+	return recv(socket, buffer, static_cast<int>(length), 0);
+	#else
+	ssize_t received;
+	do {
+		received = recv(socket, buffer, length, 0);
+	} while (received < 0 && errno == EINTR);
+	return received;
+	#endif
+}
+
+bool receiveExact(int socket, char* buffer, size_t length) {
+	size_t received = 0;
+	while (received < length) {
+		ssize_t bytesReceived = receiveSome(socket, buffer + received, length - received);
+		if (bytesReceived <= 0) {
+			return false;
+		}
+		received += static_cast<size_t>(bytesReceived);
+	}
+	return true;
+}
+
+bool discard(int socket, size_t length) {
+	char buffer[4096];
+	while (length > 0) {
+		size_t chunk = std::min(length, sizeof(buffer));
+		if (!receiveExact(socket, buffer, chunk)) {
+			return false;
+		}
+		length -= chunk;
+	}
+	return true;
+}
+
+ssize_t sendSome(int socket, const char* data, size_t length) {
+	#ifdef _WIN32
+	return send(socket, data, static_cast<int>(length), SEND_FLAGS);
+	#else
+	ssize_t sent;
+	do {
+		sent = send(socket, data, length, SEND_FLAGS);
+	} while (sent < 0 && errno == EINTR);
+	return sent;
+	#endif
+}
+
+bool sendAll(int socket, const char* data, size_t length) {
+	size_t sent = 0;
+	while (sent < length) {
+		ssize_t bytesSent = sendSome(socket, data + sent, length - sent);
+		#ifndef _WIN32
+		if (bytesSent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+			if (!waitUntilWritable(socket)) {
+				return false;
+			}
+			continue;
+		}
+		#endif
+		if (bytesSent <= 0) {
+			return false;
+		}
+		sent += static_cast<size_t>(bytesSent);
+	}
+	return true;
+}
+
+bool sendVector(int socket, const std::vector<FrameSlice>& slices) {
+	#ifdef _WIN32
+	std::vector<WSABUF> buffers(slices.size());
+	for (size_t i = 0; i < slices.size(); i++) {
+		buffers[i].buf = const_cast<char*>(slices[i].data);
+		buffers[i].len = static_cast<ULONG>(slices[i].length);
+	}
+	DWORD bytesSent = 0;
+	return WSASend(socket, buffers.data(), static_cast<DWORD>(buffers.size()),
+		&bytesSent, 0, NULL, NULL) == 0;
+	#else
+	std::vector<iovec> buffers(slices.size());
+	for (size_t i = 0; i < slices.size(); i++) {
+		buffers[i].iov_base = const_cast<char*>(slices[i].data);
+		buffers[i].iov_len = slices[i].length;
+	}
+
+	// sendmsg accepts at most IOV_MAX entries and may write partially.
+	size_t current = 0;
+	while (current < buffers.size()) {
+		msghdr message = {};
+		message.msg_iov = &buffers[current];
+		message.msg_iovlen = std::min<size_t>(buffers.size() - current, IOV_MAX);
+		ssize_t bytesSent = sendmsg(socket, &message, SEND_FLAGS);
+		if (bytesSent < 0 && errno == EINTR) {
+			continue;
+		}
+		if (bytesSent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+			if (!waitUntilWritable(socket)) {
+				return false;
+			}
+			continue;
+		}
+		if (bytesSent <= 0) {
+			return false;
+		}
+
+		size_t remaining = static_cast<size_t>(bytesSent);
+		while (current < buffers.size() && remaining >= buffers[current].iov_len) {
+			remaining -= buffers[current].iov_len;
+			current++;
+		}
+		if (remaining > 0) {
+			buffers[current].iov_base = static_cast<char*>(buffers[current].iov_base) + remaining;
+			buffers[current].iov_len -= remaining;
+		}
+	}
+	return true;
+	#endif
+}
+
+size_t encodeFrameHeader(uint32_t flags, uint32_t length, uint64_t traceId, char* out) {
+	if (traceId != 0) {
+		flags |= FRAME_FLAG_TRACE;
+	}
+	uint32_t networkLength = htonl(flags | (length & FRAME_LENGTH_MASK));
+	std::memcpy(out, &networkLength, sizeof(networkLength));
+	if (traceId == 0) {
+		return sizeof(networkLength);
+	}
+	encodeTraceId(traceId, out + sizeof(networkLength));
+	return sizeof(networkLength) + TRACE_ID_SIZE;
+}
+
+FrameHeader decodeLengthWord(const char* data) {
+	uint32_t networkLength;
+	std::memcpy(&networkLength, data, sizeof(networkLength));
+	uint32_t lengthWord = ntohl(networkLength);
+
+	FrameHeader header;
+	header.flags = lengthWord & ~FRAME_LENGTH_MASK;
+	header.length = lengthWord & FRAME_LENGTH_MASK;
+	return header;
+}
+
+void appendFrame(std::vector<FrameSlice>& slices, char* headerStorage, uint32_t flags, std::string_view payload, uint64_t traceId) {
+	size_t headerSize = encodeFrameHeader(flags, static_cast<uint32_t>(payload.size()), traceId, headerStorage);
+	slices.push_back({ headerStorage, headerSize });
+	if (!payload.empty()) {
+		slices.push_back({ payload.data(), payload.size() });
+	}
+}
+
+bool sendFrame(int socket, uint32_t flags, std::string_view payload, uint64_t traceId) {
+	char header[MAX_FRAME_HEADER_SIZE];
+	std::vector<FrameSlice> slices;
+	appendFrame(slices, header, flags, payload, traceId);
+	return sendVector(socket, slices);
+}
+
+bool receiveFrameHeader(int socket, FrameHeader& header) {
+	char lengthWord[sizeof(uint32_t)];
+	if (!receiveExact(socket, lengthWord, sizeof(lengthWord))) {
+		return false;
+	}
+	header = decodeLengthWord(lengthWord);
+	if (header.flags & FRAME_FLAG_TRACE) {
+		char encodedTraceId[TRACE_ID_SIZE];
+		if (!receiveExact(socket, encodedTraceId, TRACE_ID_SIZE)) {
+			return false;
+		}
+		header.traceId = decodeTraceId(encodedTraceId);
+	}
+	return true;
+}
+
+void shutdownSocket(int socket) {
+	if (socket != -1) {
+		#ifdef _WIN32
+		shutdown(socket, SD_BOTH);
+		#else
+		shutdown(socket, SHUT_RDWR);
+		#endif
+	}
+}
+
+void closeSocket(int socket) {
+	if (socket != -1) {
+		#ifdef _WIN32
+		closesocket(socket);
+		#else
+		close(socket);
+		#endif
+	}
+}
+
+}
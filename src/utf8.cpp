@@ -0,0 +1,370 @@
+#include "../include/utf8.hpp"
+#include <cstring>
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#define UTF8_SIMD_X86 1
+#include <immintrin.h>
+#endif
+
+namespace {
+
+bool isAsciiScalar(const unsigned char* data, size_t length) {
+	uint64_t bits = 0;
+	size_t i = 0;
+	for (; i + 8 <= length; i += 8) {
+		uint64_t word;
+		std::memcpy(&word, data + i, sizeof(word));
+		bits |= word;
+	}
+	for (; i < length; i++) {
+		bits |= data[i];
+	}
+	return (bits & 0x8080808080808080ull) == 0;
+}
+
+}
+
+bool isValidUtf8Scalar(const char* text, size_t length) {
+	const unsigned char* data = reinterpret_cast<const unsigned char*>(text);
+	size_t i = 0;
+	while (i < length) {
+		if (i + 8 <= length) {
+			uint64_t word;
+			std::memcpy(&word, data + i, sizeof(word));
+			if ((word & 0x8080808080808080ull) == 0) {
+				i += 8;
+				continue;
+			}
+		}
+
+		unsigned char lead = data[i];
+		if (lead < 0x80) {
+			i++;
+			continue;
+		}
+
+		size_t sequenceLength;
+		unsigned char low = 0x80;
+		unsigned char high = 0xBF;
+		if (lead >= 0xC2 && lead <= 0xDF) {
+			sequenceLength = 2;
+		} else if (lead >= 0xE0 && lead <= 0xEF) {
+			sequenceLength = 3;
+			if (lead == 0xE0) {
+				low = 0xA0;
+			} else if (lead == 0xED) {
+				high = 0x9F;
+			}
+		} else if (lead >= 0xF0 && lead <= 0xF4) {
+			sequenceLength = 4;
+			if (lead == 0xF0) {
+				low = 0x90;
+			} else if (lead == 0xF4) {
+				high = 0x8F;
+			}
+		} else {
+			return false;
+		}
+
+		if (i + sequenceLength > length || data[i + 1] < low || data[i + 1] > high) {
+			return false;
+		}
+		for (size_t k = 2; k < sequenceLength; k++) {
+			if (data[i + k] < 0x80 || data[i + k] > 0xBF) {
+				return false;
+			}
+		}
+		i += sequenceLength;
+	}
+	return true;
+}
+
+namespace {
+
+#ifdef UTF8_SIMD_X86
+
+// Keiser & Lemire "lookup" validation, the algorithm used by simdjson: every
+// error class is encoded as a bit and three nibble lookups of the previous
+// and current byte must agree on at least one of them for input to be bad.
+const uint8_t TOO_SHORT = 1 << 0;
+const uint8_t TOO_LONG = 1 << 1;
+const uint8_t OVERLONG_3 = 1 << 2;
+const uint8_t TOO_LARGE = 1 << 3;
+const uint8_t SURROGATE = 1 << 4;
+const uint8_t OVERLONG_2 = 1 << 5;
+const uint8_t TOO_LARGE_1000 = 1 << 6;
+const uint8_t OVERLONG_4 = 1 << 6;
+const uint8_t TWO_CONTS = 1 << 7;
+const uint8_t CARRY = TOO_SHORT | TOO_LONG | TWO_CONTS;
+
+__attribute__((target("ssse3")))
+inline __m128i shiftRightNibble(__m128i value) {
+	return _mm_and_si128(_mm_srli_epi16(value, 4), _mm_set1_epi8(0x0F));
+}
+
+__attribute__((target("ssse3")))
+inline __m128i checkSpecialCases(__m128i input, __m128i prev1) {
+	const __m128i byte1HighTable = _mm_setr_epi8(
+		TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG,
+		TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG,
+		TWO_CONTS, TWO_CONTS, TWO_CONTS, TWO_CONTS,
+		TOO_SHORT | OVERLONG_2,
+		TOO_SHORT,
+		TOO_SHORT | OVERLONG_3 | SURROGATE,
+		TOO_SHORT | TOO_LARGE | TOO_LARGE_1000 | OVERLONG_4);
+	const __m128i byte1LowTable = _mm_setr_epi8(
+		CARRY | OVERLONG_3 | OVERLONG_2 | OVERLONG_4,
+		CARRY | OVERLONG_2,
+		CARRY,
+		CARRY,
+		CARRY | TOO_LARGE,
+		CARRY | TOO_LARGE | TOO_LARGE_1000,
+		CARRY | TOO_LARGE | TOO_LARGE_1000,
+		CARRY | TOO_LARGE | TOO_LARGE_1000,
+		CARRY | TOO_LARGE | TOO_LARGE_1000,
+		CARRY | TOO_LARGE | TOO_LARGE_1000,
+		CARRY | TOO_LARGE | TOO_LARGE_1000,
+		CARRY | TOO_LARGE | TOO_LARGE_1000,
+		CARRY | TOO_LARGE | TOO_LARGE_1000,
+		CARRY | TOO_LARGE | TOO_LARGE_1000 | SURROGATE,
+		CARRY | TOO_LARGE | TOO_LARGE_1000,
+		CARRY | TOO_LARGE | TOO_LARGE_1000);
+	const __m128i byte2HighTable = _mm_setr_epi8(
+		TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT,
+		TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT,
+		TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE_1000 | OVERLONG_4,
+		TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE,
+		TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE,
+		TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE,
+		TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT);
+
+	__m128i byte1High = _mm_shuffle_epi8(byte1HighTable, shiftRightNibble(prev1));
+	__m128i byte1Low = _mm_shuffle_epi8(byte1LowTable, _mm_and_si128(prev1, _mm_set1_epi8(0x0F)));
+	__m128i byte2High = _mm_shuffle_epi8(byte2HighTable, shiftRightNibble(input));
+	return _mm_and_si128(_mm_and_si128(byte1High, byte1Low), byte2High);
+}
+
+__attribute__((target("ssse3")))
+inline __m128i checkMultibyteLengths(__m128i input, __m128i previous, __m128i specialCases) {
+	__m128i prev2 = _mm_alignr_epi8(input, previous, 16 - 2);
+	__m128i prev3 = _mm_alignr_epi8(input, previous, 16 - 3);
+	__m128i isThirdByte = _mm_subs_epu8(prev2, _mm_set1_epi8(static_cast<char>(0xE0 - 0x80)));
+	__m128i isFourthByte = _mm_subs_epu8(prev3, _mm_set1_epi8(static_cast<char>(0xF0 - 0x80)));
+	__m128i must23 = _mm_and_si128(_mm_or_si128(isThirdByte, isFourthByte),
+		_mm_set1_epi8(static_cast<char>(0x80)));
+	return _mm_xor_si128(must23, specialCases);
+}
+
+__attribute__((target("ssse3")))
+bool isValidUtf8Ssse3(const unsigned char* data, size_t length) {
+	// Bytes that still expect continuations when they end a block.
+	const __m128i incompleteLimit = _mm_setr_epi8(
+		-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+		static_cast<char>(0xF0 - 1), static_cast<char>(0xE0 - 1), static_cast<char>(0xC0 - 1));
+
+	__m128i error = _mm_setzero_si128();
+	__m128i previous = _mm_setzero_si128();
+	__m128i previousIncomplete = _mm_setzero_si128();
+
+	auto checkBlock = [&](__m128i input) __attribute__((target("ssse3"))) {
+		if (_mm_movemask_epi8(input) == 0) {
+			error = _mm_or_si128(error, previousIncomplete);
+			previousIncomplete = _mm_setzero_si128();
+		} else {
+			__m128i prev1 = _mm_alignr_epi8(input, previous, 16 - 1);
+			__m128i specialCases = checkSpecialCases(input, prev1);
+			error = _mm_or_si128(error, checkMultibyteLengths(input, previous, specialCases));
+			previousIncomplete = _mm_subs_epu8(input, incompleteLimit);
+		}
+		previous = input;
+	};
+
+	size_t i = 0;
+	for (; i + 64 <= length; i += 64) {
+		__m128i block0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+		__m128i block1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i + 16));
+		__m128i block2 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i + 32));
+		__m128i block3 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i + 48));
+		__m128i any = _mm_or_si128(_mm_or_si128(block0, block1), _mm_or_si128(block2, block3));
+		if (_mm_movemask_epi8(any) == 0) {
+			error = _mm_or_si128(error, previousIncomplete);
+			previousIncomplete = _mm_setzero_si128();
+			previous = block3;
+			continue;
+		}
+		checkBlock(block0);
+		checkBlock(block1);
+		checkBlock(block2);
+		checkBlock(block3);
+	}
+	for (; i + 16 <= length; i += 16) {
+		checkBlock(_mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i)));
+	}
+	if (i < length) {
+		// Zero padding is ASCII, so a truncated trailing sequence is reported
+		// as TOO_SHORT by the padded block itself.
+		alignas(16) unsigned char tail[16] = {};
+		std::memcpy(tail, data + i, length - i);
+		checkBlock(_mm_load_si128(reinterpret_cast<const __m128i*>(tail)));
+	}
+	error = _mm_or_si128(error, previousIncomplete);
+
+	return _mm_movemask_epi8(_mm_cmpeq_epi8(error, _mm_setzero_si128())) == 0xFFFF;
+}
+
+bool isAsciiSse2(const unsigned char* data, size_t length) {
+	__m128i bits = _mm_setzero_si128();
+	size_t i = 0;
+	for (; i + 64 <= length; i += 64) {
+		bits = _mm_or_si128(bits, _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i)));
+		bits = _mm_or_si128(bits, _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i + 16)));
+		bits = _mm_or_si128(bits, _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i + 32)));
+		bits = _mm_or_si128(bits, _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i + 48)));
+		if (_mm_movemask_epi8(bits) != 0) {
+			return false;
+		}
+	}
+	for (; i + 16 <= length; i += 16) {
+		bits = _mm_or_si128(bits, _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i)));
+	}
+	return _mm_movemask_epi8(bits) == 0 && isAsciiScalar(data + i, length - i);
+}
+
+bool hasSsse3() {
+	static const bool supported = __builtin_cpu_supports("ssse3");
+	return supported;
+}
+
+#endif
+
+void appendCodePoint(std::string& out, uint32_t codePoint) {
+	if (codePoint < 0x80) {
+		out.push_back(static_cast<char>(codePoint));
+	} else if (codePoint < 0x800) {
+		out.push_back(static_cast<char>(0xC0 | (codePoint >> 6)));
+		out.push_back(static_cast<char>(0x80 | (codePoint & 0x3F)));
+	} else if (codePoint < 0x10000) {
+		out.push_back(static_cast<char>(0xE0 | (codePoint >> 12)));
+		out.push_back(static_cast<char>(0x80 | ((codePoint >> 6) & 0x3F)));
+		out.push_back(static_cast<char>(0x80 | (codePoint & 0x3F)));
+	} else {
+		out.push_back(static_cast<char>(0xF0 | (codePoint >> 18)));
+		out.push_back(static_cast<char>(0x80 | ((codePoint >> 12) & 0x3F)));
+		out.push_back(static_cast<char>(0x80 | ((codePoint >> 6) & 0x3F)));
+		out.push_back(static_cast<char>(0x80 | (codePoint & 0x3F)));
+	}
+}
+
+}
+
+bool isValidUtf8(const char* data, size_t length) {
+	#ifdef UTF8_SIMD_X86
+	if (hasSsse3()) {
+		return isValidUtf8Ssse3(reinterpret_cast<const unsigned char*>(data), length);
+	}
+	#endif
+	return isValidUtf8Scalar(data, length);
+}
+
+bool isAscii(const char* data, size_t length) {
+	const unsigned char* bytes = reinterpret_cast<const unsigned char*>(data);
+	#ifdef UTF8_SIMD_X86
+	return isAsciiSse2(bytes, length);
+	#else
+	return isAsciiScalar(bytes, length);
+	#endif
+}
+
+bool isUnicodeWhitespace(uint32_t codePoint) {
+	if (codePoint < 0x80) {
+		return isAsciiWhitespace(static_cast<unsigned char>(codePoint));
+	}
+	switch (codePoint) {
+	case 0x0085:
+	case 0x00A0:
+	case 0x1680:
+	case 0x2028:
+	case 0x2029:
+	case 0x202F:
+	case 0x205F:
+	case 0x3000:
+		return true;
+	default:
+		return codePoint >= 0x2000 && codePoint <= 0x200A;
+	}
+}
+
+uint32_t foldCodePoint(uint32_t codePoint) {
+	if (codePoint < 0x80) {
+		return codePoint >= 'A' && codePoint <= 'Z' ? codePoint + 0x20 : codePoint;
+	}
+	// Latin-1 Supplement, except the multiplication sign.
+	if (codePoint >= 0xC0 && codePoint <= 0xDE && codePoint != 0xD7) {
+		return codePoint + 0x20;
+	}
+	// Latin Extended-A pairs capital/small letters on even/odd code points,
+	// with a shifted run between U+0139 and U+0148 and after U+0179.
+	if (codePoint >= 0x0100 && codePoint <= 0x0137 && codePoint != 0x0130) {
+		return codePoint | 1;
+	}
+	if ((codePoint >= 0x0139 && codePoint <= 0x0148) || (codePoint >= 0x0179 && codePoint <= 0x017E)) {
+		return (codePoint & 1) ? codePoint + 1 : codePoint;
+	}
+	if (codePoint >= 0x014A && codePoint <= 0x0177) {
+		return codePoint | 1;
+	}
+	if (codePoint == 0x0178) {
+		return 0x00FF;
+	}
+	// Greek capitals, skipping the unassigned U+03A2.
+	if (codePoint >= 0x0391 && codePoint <= 0x03A9 && codePoint != 0x03A2) {
+		return codePoint + 0x20;
+	}
+	// Cyrillic: Ѐ..Џ, А..Я and the paired letters of U+0460..U+04FF.
+	if (codePoint >= 0x0400 && codePoint <= 0x040F) {
+		return codePoint + 0x50;
+	}
+	if (codePoint >= 0x0410 && codePoint <= 0x042F) {
+		return codePoint + 0x20;
+	}
+	if ((codePoint >= 0x0460 && codePoint <= 0x0481) || (codePoint >= 0x048A && codePoint <= 0x04BF) ||
+		(codePoint >= 0x04D0 && codePoint <= 0x04FF)) {
+		return codePoint | 1;
+	}
+	// Fullwidth Latin capitals.
+	if (codePoint >= 0xFF21 && codePoint <= 0xFF3A) {
+		return codePoint + 0x20;
+	}
+	return codePoint;
+}
+
+void foldCase(std::string_view word, std::string& out) {
+	out.clear();
+	if (isAscii(word.data(), word.size())) {
+		out.assign(word.data(), word.size());
+		for (char& c : out) {
+			if (c >= 'A' && c <= 'Z') {
+				c = static_cast<char>(c + 0x20);
+			}
+		}
+		return;
+	}
+
+	size_t position = 0;
+	while (position < word.size()) {
+		unsigned char c = static_cast<unsigned char>(word[position]);
+		if (c < 0x80) {
+			out.push_back(static_cast<char>(c >= 'A' && c <= 'Z' ? c + 0x20 : c));
+			position++;
+			continue;
+		}
+		size_t start = position;
+		uint32_t codePoint = decodeCodePoint(word, position);
+		uint32_t folded = foldCodePoint(codePoint);
+		if (folded == codePoint) {
+			out.append(word.data() + start, position - start);
+		} else {
+			appendCodePoint(out, folded);
+		}
+	}
+}
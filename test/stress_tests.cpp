@@ -0,0 +1,305 @@
+#include "../include/client.hpp"
+#include "../include/servers.hpp"
+#include "../include/async.hpp"
+#include <gtest/gtest.h>
+#include <thread>
+#include <chrono>
+#include <memory>
+#include <vector>
+#include <string>
+#include <string_view>
+#include <algorithm>
+#include <charconv>
+#include <condition_variable>
+#include <fstream>
+#include <sstream>
+#include <cstdlib>
+#include <csignal>
+
+const std::string STRESS_HOST = "127.0.0.1";
+const std::chrono::seconds STRESS_READY_TIMEOUT(5);
+const std::chrono::seconds STRESS_DELIVERY_TIMEOUT(120);
+
+//       sendBatch,  
+//     .
+const int BATCH_CLIENTS = 200;
+const int BATCH_MESSAGES_PER_CLIENT = 1000;
+//         .
+const int LATENCY_CLIENTS = 10;
+const int LATENCY_MESSAGES_PER_CLIENT = 200;
+
+#ifndef STRESS_BASELINE_FILE
+#define STRESS_BASELINE_FILE "stress_baseline.txt"
+#endif
+
+//      :  " ".
+struct StressBaseline {
+    double threadedMessagesPerSecond = 0;
+    double asyncMessagesPerSecond = 0;
+    double asyncP99LatencyMs = 0;
+};
+
+bool loadStressBaseline(StressBaseline& baseline) {
+    const char* path = std::getenv("STRESS_BASELINE_FILE");
+    std::ifstream input(path != NULL ? path : STRESS_BASELINE_FILE);
+    if (!input) {
+        return false;
+    }
+
+    std::string line;
+    while (std::getline(input, line)) {
+        std::istringstream fields(line);
+        std::string key;
+        double value;
+        if (!(fields >> key >> value) || key[0] == '#') {
+            continue;
+        }
+        if (key == "threaded_messages_per_second") {
+            baseline.threadedMessagesPerSecond = value;
+        }
+        else if (key == "async_messages_per_second") {
+            baseline.asyncMessagesPerSecond = value;
+        }
+        else if (key == "async_p99_latency_ms") {
+            baseline.asyncP99LatencyMs = value;
+        }
+    }
+    return true;
+}
+
+//        
+// ,   ,      .
+std::string stressMessage(int client, int sequence) {
+    uint64_t hash = (static_cast<uint64_t>(client) << 32 | static_cast<uint32_t>(sequence)) * 0x9E3779B97F4A7C15ull;
+    char payload[17];
+    for (int i = 0; i < 16; i++) {
+        payload[i] = "0123456789abcdef"[(hash >> (60 - 4 * i)) & 0xF];
+    }
+    payload[16] = '\0';
+    return "c" + std::to_string(client) + " s" + std::to_string(sequence)
+        + " p" + payload + " q" + std::string(payload, 8) + " r" + std::string(payload + 8, 8);
+}
+
+//     ,    
+//  ,     .
+class DeliveryChecker {
+public:
+    explicit DeliveryChecker(int clients) : nextSequence(clients, 0) {}
+
+    void onMessage(std::string_view message) {
+        std::lock_guard<std::mutex> lock(mutex);
+        int client = -1;
+        int sequence = -1;
+        if (!parseIds(message, client, sequence) ||
+            message != stressMessage(client, sequence)) {
+            corrupted++;
+        }
+        else if (sequence != nextSequence[client]) {
+            outOfOrder++;
+        }
+        else {
+            nextSequence[client]++;
+        }
+        received++;
+        arrived.notify_all();
+    }
+
+    bool waitFor(size_t expected, std::chrono::seconds timeout) {
+        std::unique_lock<std::mutex> lock(mutex);
+        return arrived.wait_for(lock, timeout, [&]() { return received >= expected; });
+    }
+
+    size_t receivedCount() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return received;
+    }
+
+    size_t corrupted = 0;
+    size_t outOfOrder = 0;
+
+private:
+    std::mutex mutex;
+    std::condition_variable arrived;
+    std::vector<int> nextSequence;
+    size_t received = 0;
+
+    bool parseIds(std::string_view message, int& client, int& sequence) const {
+        size_t space = message.find(' ');
+        if (message.size() < 4 || message[0] != 'c' || space == std::string_view::npos ||
+            space + 2 >= message.size() || message[space + 1] != 's') {
+            return false;
+        }
+        const char* end = message.data() + message.size();
+        if (std::from_chars(message.data() + 1, message.data() + space, client).ec != std::errc() ||
+            std::from_chars(message.data() + space + 2, end, sequence).ec != std::errc()) {
+            return false;
+        }
+        return client >= 0 && client < static_cast<int>(nextSequence.size());
+    }
+};
+
+//        .
+class StressTest : public ::testing::Test {
+protected:
+    void startChain(size_t asyncThreads) {
+        displayServer = std::make_unique<DisplayServer>(0);
+        displayServer->setMessageHandler([this](std::string_view message) { checker.onMessage(message); });
+        displayServer->setReadyCallback([this](int port) { displayReady.signal(port); });
+        displayThread = std::thread([this] { displayServer->start(); });
+        ASSERT_TRUE(displayReady.waitFor(STRESS_READY_TIMEOUT));
+
+        processingServer = std::make_unique<ProcessingServer>(0, STRESS_HOST, displayReady.port());
+        processingServer->setReadyCallback([this](int port) { processingReady.signal(port); });
+        processingThread = std::thread([this, asyncThreads] {
+            if (asyncThreads > 0) {
+                processingServer->startAsync(asyncThreads);
+            } else {
+                processingServer->start();
+            }
+        });
+        ASSERT_TRUE(processingReady.waitFor(STRESS_READY_TIMEOUT));
+        processingPort = processingReady.port();
+        ASSERT_TRUE(loadStressBaseline(baseline)) << "Missing baseline " << STRESS_BASELINE_FILE;
+    }
+
+    void TearDown() override {
+        if (processingThread.joinable()) {
+            processingServer->stop();
+            processingThread.join();
+        }
+        if (displayThread.joinable()) {
+            displayServer->stop();
+            displayThread.join();
+        }
+    }
+
+    std::vector<std::thread> startBatchClients(std::atomic<int>& failures) {
+        std::vector<std::thread> clients;
+        for (int id = 0; id < BATCH_CLIENTS; id++) {
+            clients.emplace_back([this, id, &failures] {
+                std::vector<std::string> messages;
+                for (int sequence = 0; sequence < BATCH_MESSAGES_PER_CLIENT; sequence++) {
+                    messages.push_back(stressMessage(id, sequence));
+                }
+                std::vector<std::string_view> views(messages.begin(), messages.end());
+
+                Client client(STRESS_HOST, processingPort);
+                if (!client.sendBatch(views)) {
+                    failures++;
+                }
+            });
+        }
+        return clients;
+    }
+
+    void expectIntactDelivery(size_t expected) {
+        EXPECT_TRUE(checker.waitFor(expected, STRESS_DELIVERY_TIMEOUT))
+            << "Delivered " << checker.receivedCount() << " of " << expected;
+        EXPECT_EQ(checker.receivedCount(), expected);
+        EXPECT_EQ(checker.corrupted, 0u);
+        EXPECT_EQ(checker.outOfOrder, 0u);
+    }
+
+    DeliveryChecker checker{ BATCH_CLIENTS + LATENCY_CLIENTS };
+    StressBaseline baseline;
+    ReadinessLatch displayReady;
+    ReadinessLatch processingReady;
+    std::unique_ptr<DisplayServer> displayServer;
+    std::unique_ptr<ProcessingServer> processingServer;
+    std::thread displayThread;
+    std::thread processingThread;
+    int processingPort = 0;
+};
+
+double secondsSince(std::chrono::steady_clock::time_point started) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+}
+
+//  1:      ,   
+TEST_F(StressTest, ThreadedServerDeliversEveryMessageIntact) {
+    startChain(0);
+    auto started = std::chrono::steady_clock::now();
+
+    std::atomic<int> failures(0);
+    std::vector<std::thread> clients = startBatchClients(failures);
+    for (auto& client : clients) {
+        client.join();
+    }
+
+    size_t expected = static_cast<size_t>(BATCH_CLIENTS) * BATCH_MESSAGES_PER_CLIENT;
+    expectIntactDelivery(expected);
+    EXPECT_EQ(failures.load(), 0);
+
+    double throughput = expected / secondsSince(started);
+    std::cout << "Threaded server: " << static_cast<long>(throughput) << " messages/s" << std::endl;
+    EXPECT_GE(throughput, baseline.threadedMessagesPerSecond) << "Throughput regressed";
+}
+
+#ifndef _WIN32
+//  2:       
+TEST_F(StressTest, AsyncServerKeepsLatencyUnderLoad) {
+    startChain(2);
+    auto started = std::chrono::steady_clock::now();
+
+    std::atomic<int> failures(0);
+    std::vector<std::thread> clients = startBatchClients(failures);
+    for (auto& client : clients) {
+        client.join();
+    }
+
+    size_t batchMessages = static_cast<size_t>(BATCH_CLIENTS) * BATCH_MESSAGES_PER_CLIENT;
+    expectIntactDelivery(batchMessages);
+    double throughput = batchMessages / secondsSince(started);
+
+    //   ,    :  200
+    //        ,   .
+    //       .
+    std::vector<double> latencies;
+    EventLoop loop;
+    std::vector<std::unique_ptr<AsyncClient>> latencyClients;
+    for (int id = 0; id < LATENCY_CLIENTS; id++) {
+        latencyClients.push_back(std::make_unique<AsyncClient>(loop, STRESS_HOST, processingPort));
+    }
+
+    int remaining = LATENCY_CLIENTS;
+    for (int id = 0; id < LATENCY_CLIENTS; id++) {
+        loop.spawn([](EventLoop& loop, AsyncClient& client, int id, std::vector<double>& latencies,
+            std::atomic<int>& failures, int& remaining) -> Task<void> {
+            for (int sequence = 0; sequence < LATENCY_MESSAGES_PER_CLIENT; sequence++) {
+                std::string message = stressMessage(BATCH_CLIENTS + id, sequence);
+                auto sentAt = std::chrono::steady_clock::now();
+                bool acknowledged = co_await client.send(message);
+                if (!acknowledged) {
+                    failures++;
+                    break;
+                }
+                latencies.push_back(secondsSince(sentAt) * 1000.0);
+            }
+            if (--remaining == 0) {
+                loop.stop();
+            }
+        }(loop, *latencyClients[id], id, latencies, failures, remaining));
+    }
+    loop.run();
+
+    expectIntactDelivery(batchMessages + static_cast<size_t>(LATENCY_CLIENTS) * LATENCY_MESSAGES_PER_CLIENT);
+    EXPECT_EQ(failures.load(), 0);
+    ASSERT_FALSE(latencies.empty());
+
+    std::sort(latencies.begin(), latencies.end());
+    double p99 = latencies[latencies.size() * 99 / 100];
+    std::cout << "Async server: " << static_cast<long>(throughput) << " messages/s, p99 "
+        << p99 << " ms" << std::endl;
+    EXPECT_GE(throughput, baseline.asyncMessagesPerSecond) << "Throughput regressed";
+    EXPECT_LE(p99, baseline.asyncP99LatencyMs) << "p99 latency regressed";
+}
+#endif
+
+int main(int argc, char** argv) {
+    #ifndef _WIN32
+    // ,   ,    .
+    signal(SIGPIPE, SIG_IGN);
+    #endif
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -1,43 +1,89 @@
 #include "../include/client.hpp"
 #include "../include/servers.hpp"
+#include "../include/async.hpp"
 #include <gtest/gtest.h>
 #include <thread>
 #include <chrono>
 #include <cstdlib>
+#include <memory>
+#include <cstdio>
+#include <fstream>
+#include <mutex>
+#include <future>
+#include <algorithm>
+#include <random>
+#include <cstring>
+
+#ifndef _WIN32
+#include <sys/socket.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#endif
 
-const int TEST_DISPLAY_PORT = 7071;
-const int TEST_PROCESSING_PORT = 9091;
 const std::string TEST_HOST = "127.0.0.1";
+const std::chrono::seconds TEST_READY_TIMEOUT(5);
 
+// Runs the display and processing servers in-process on ephemeral ports.
 class ServerTest : public ::testing::Test {
 protected:
     void SetUp() override {
-        display_server_thread = std::thread([] {
-            DisplayServer server(TEST_DISPLAY_PORT);
-            server.start();
-            });
-
-        processing_server_thread = std::thread([] {
-            ProcessingServer server(TEST_PROCESSING_PORT, TEST_HOST, TEST_DISPLAY_PORT);
-            server.start();
-            });
+        displayServer = std::make_unique<DisplayServer>(0);
+        displayServer->setReadyCallback([this](int port) { displayReady.signal(port); });
+        displayServer->setMessageHandler([this](std::string_view text) {
+            std::lock_guard<std::mutex> lock(displayedMutex);
+            displayed.emplace_back(text);
+        });
+        display_server_thread = std::thread([this] { displayServer->start(); });
+        ASSERT_TRUE(displayReady.waitFor(TEST_READY_TIMEOUT));
 
-        std::this_thread::sleep_for(std::chrono::seconds(1));
+        processingServer = std::make_unique<ProcessingServer>(0, TEST_HOST, displayReady.port());
+        processingServer->setReadyCallback([this](int port) { processingReady.signal(port); });
+        processing_server_thread = std::thread([this] { processingServer->start(); });
+        ASSERT_TRUE(processingReady.waitFor(TEST_READY_TIMEOUT));
+        processingPort = processingReady.port();
     }
 
     void TearDown() override {
-        system("taskkill /F /IM tests.exe");
-        display_server_thread.join();
-        processing_server_thread.join();
+        if (processing_server_thread.joinable()) {
+            processingServer->stop();
+            processing_server_thread.join();
+        }
+        if (display_server_thread.joinable()) {
+            displayServer->stop();
+            display_server_thread.join();
+        }
     }
 
+    // The display server answers nothing, so tests poll what it received.
+    std::vector<std::string> waitForDisplayed(size_t count) {
+        auto deadline = std::chrono::steady_clock::now() + TEST_READY_TIMEOUT;
+        while (std::chrono::steady_clock::now() < deadline) {
+            {
+                std::lock_guard<std::mutex> lock(displayedMutex);
+                if (displayed.size() >= count) {
+                    return displayed;
+                }
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        std::lock_guard<std::mutex> lock(displayedMutex);
+        return displayed;
+    }
+
+    ReadinessLatch displayReady;
+    ReadinessLatch processingReady;
+    std::unique_ptr<DisplayServer> displayServer;
+    std::unique_ptr<ProcessingServer> processingServer;
     std::thread display_server_thread;
     std::thread processing_server_thread;
+    int processingPort = 0;
+    std::mutex displayedMutex;
+    std::vector<std::string> displayed;
 };
 
 //  1:      
 TEST_F(ServerTest, ClientConnectsToProcessingServer) {
-    Client client(TEST_HOST, TEST_PROCESSING_PORT);
+    Client client(TEST_HOST, processingPort);
     EXPECT_TRUE(client.connectToServer());
 }
 
@@ -62,7 +108,7 @@ TEST(ProcessingServerTest, ValidatesDataCorrectly) {
 
 //  4:     
 TEST_F(ServerTest, ClientSendsAndReceivesData) {
-    Client client(TEST_HOST, TEST_PROCESSING_PORT);
+    Client client(TEST_HOST, processingPort);
     ASSERT_TRUE(client.connectToServer());
 
     EXPECT_TRUE(client.sendData("test message"));
@@ -71,7 +117,7 @@ TEST_F(ServerTest, ClientSendsAndReceivesData) {
 
 //  5:    
 TEST_F(ServerTest, FullChainTest) {
-    Client client(TEST_HOST, TEST_PROCESSING_PORT);
+    Client client(TEST_HOST, processingPort);
     ASSERT_TRUE(client.connectToServer());
 
     //  
@@ -85,12 +131,1221 @@ TEST_F(ServerTest, FullChainTest) {
 
 //  6:    
 TEST_F(ServerTest, InvalidDataHandling) {
-    Client client(TEST_HOST, TEST_PROCESSING_PORT);
+    Client client(TEST_HOST, processingPort);
     ASSERT_TRUE(client.connectToServer());
 
     EXPECT_FALSE(client.sendData(""));
 }
 
+//  7:    
+TEST_F(ServerTest, ClientSendsBatch) {
+    Client client(TEST_HOST, processingPort);
+    ASSERT_TRUE(client.connectToServer());
+
+    std::vector<std::string> messages;
+    for (int i = 0; i < 1200; i++) {
+        messages.push_back("batch message " + std::to_string(i));
+    }
+    std::vector<std::string_view> views(messages.begin(), messages.end());
+
+    EXPECT_TRUE(client.sendBatch(views));
+    const std::string_view invalid[] = { "valid", "", "valid" };
+    EXPECT_FALSE(client.sendBatch(invalid));
+}
+
+//  8:    
+TEST_F(ServerTest, ClientSendsInputFile) {
+    const std::string path = "client_input_test.txt";
+    {
+        std::ofstream input(path, std::ios::binary);
+        for (int i = 0; i < 5000; i++) {
+            input << "input line " << i << "\r\n";
+        }
+        input << "\n" << "last line without newline";
+    }
+
+    Client client(TEST_HOST, processingPort);
+    EXPECT_TRUE(client.runInput(path));
+    std::remove(path.c_str());
+}
+
+#ifndef _WIN32
+//  9:         
+TEST(EventLoopTest, AwaitsSocketReadiness) {
+    int sockets[2];
+    ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, sockets), 0);
+    setNonBlocking(sockets[0]);
+    setNonBlocking(sockets[1]);
+
+    EventLoop loop;
+    std::string payload(1 << 20, 'x');
+    loop.spawn([](EventLoop& loop, int socket, const std::string& payload) -> Task<void> {
+        co_await asyncSendAll(loop, socket, payload.data(), payload.size());
+    }(loop, sockets[0], payload));
+
+    std::string received(payload.size(), '\0');
+    bool completed = loop.runUntilComplete(
+        asyncReceiveExact(loop, sockets[1], &received[0], received.size()));
+
+    EXPECT_TRUE(completed);
+    EXPECT_EQ(received, payload);
+    close(sockets[0]);
+    close(sockets[1]);
+}
+
+//  10:   
+TEST_F(ServerTest, AsyncClientReceivesAcknowledgement) {
+    EventLoop loop;
+    AsyncClient client(loop, TEST_HOST, processingPort);
+
+    EXPECT_TRUE(loop.runUntilComplete(client.send("async message")));
+}
+#endif
+
+//  11:    
+TEST(DictionaryTest, EncodesAndDecodesWordIds) {
+    WordEncoder encoder(3);
+    WordTable table(3);
+    std::string encoded;
+    std::string decoded;
+
+    encoder.encode("alpha beta gamma", encoded);
+    ASSERT_TRUE(table.decode(encoded.data(), encoded.size(), decoded));
+    EXPECT_EQ(decoded, "alpha beta gamma");
+
+    encoded.clear();
+    encoder.encode("gamma alpha delta beta", encoded);
+    EXPECT_LT(encoded.size(), std::string("gamma alpha delta beta").size());
+    ASSERT_TRUE(table.decode(encoded.data(), encoded.size(), decoded));
+    EXPECT_EQ(decoded, "gamma alpha delta beta");
+    EXPECT_EQ(table.size(), 3u);
+
+    std::string_view word;
+    ASSERT_TRUE(table.lookup(1, word));
+    EXPECT_EQ(word, "beta");
+    EXPECT_FALSE(table.lookup(3, word));
+}
+
+//  12:    UTF-8
+TEST(ProcessingServerTest, RejectsMalformedUtf8) {
+    ProcessingServer server(0, "", 0);
+
+    std::string valid = "\xD0\x9F\xD1\x80\xD0\xB8\xD0\xB2\xD0\xB5\xD1\x82, hello \xE2\x82\xAC \xF0\x9F\x98\x80";
+    for (int i = 0; i < 6; i++) {
+        valid += valid;
+    }
+    EXPECT_TRUE(server.validateData(valid));
+    EXPECT_FALSE(server.validateData(valid + "\xC3"));
+    EXPECT_FALSE(server.validateData("overlong \xC0\xAF"));
+    EXPECT_FALSE(server.validateData("surrogate \xED\xA0\x80"));
+    EXPECT_FALSE(server.validateData("too large \xF4\x90\x80\x80"));
+    EXPECT_FALSE(server.validateData(std::string(100, 'a') + "\x80" + std::string(100, 'b')));
+}
+
+//  13:     Unicode   
+TEST(ProcessingServerTest, SplitsOnUnicodeWhitespaceAndFoldsCase) {
+    ProcessingServer server(0, "", 0);
+    TokenizerOptions options;
+    options.unicodeWhitespace = true;
+    options.caseFold = true;
+    server.setTokenizerOptions(options);
+
+    // "", ""  ""  UTF-8,  NBSP  IDEOGRAPHIC SPACE
+    std::string result = server.processData(
+        "\xD0\x9C\xD0\xB8\xD1\x80" "\xC2\xA0"
+        "\xD0\xBC\xD0\xB8\xD1\x80" "\xE3\x80\x80"
+        "\xD0\x9C\xD0\x98\xD0\xA0");
+    EXPECT_EQ(result, "\xD0\xBC\xD0\xB8\xD1\x80");
+}
+
+//  14:   
+TEST(ProcessingServerTest, RunsConfiguredPipeline) {
+    ProcessingServer server(0, "", 0);
+    PipelineConfig config;
+    config.stages = PIPELINE_LOWERCASE | PIPELINE_STOP_WORDS | PIPELINE_DEDUP | PIPELINE_TRUNCATE;
+    config.stopWords = { "the", "a" };
+    config.truncateLimit = 3;
+    server.setPipelineConfig(config);
+
+    EXPECT_EQ(server.processData("The cat saw a CAT and the dog ran"), "cat saw and");
+
+    config.stages = PIPELINE_LOWERCASE;
+    server.setPipelineConfig(config);
+    EXPECT_EQ(server.processData("Echo ECHO echo"), "echo echo echo");
+}
+
+//  15:       
+TEST(LifecycleTest, SignalsReadinessWithBoundPort) {
+    ReadinessLatch ready;
+    DisplayServer server(0);
+    server.setReadyCallback([&ready](int port) { ready.signal(port); });
+    std::thread serverThread([&server] { server.start(); });
+
+    ASSERT_TRUE(ready.waitFor(std::chrono::seconds(5)));
+    EXPECT_GT(ready.port(), 0);
+
+    server.stop();
+    serverThread.join();
+}
+
+//  16:    
+TEST(LifecycleTest, BackoffGrowsWithinBounds) {
+    Backoff backoff(std::chrono::milliseconds(100), std::chrono::milliseconds(400));
+    long long windows[] = { 100, 200, 400, 400 };
+    for (long long window : windows) {
+        long long delay = backoff.next().count();
+        EXPECT_GE(delay, window / 2);
+        EXPECT_LE(delay, window);
+    }
+
+    backoff.reset();
+    EXPECT_LE(backoff.next().count(), 100);
+}
+
+//  17:        Chrome
+TEST(TraceTest, RecordsSpansAndConvertsToChromeFormat) {
+    const std::string tracePath = "trace_test.trc";
+    const std::string jsonPath = "trace_test.json";
+    ASSERT_TRUE(startTraceWriter(tracePath));
+
+    uint64_t traceId = newTraceId();
+    std::thread worker([traceId] {
+        TraceSpan span(traceId, TRACE_PROCESSING_PIPELINE);
+    });
+    worker.join();
+    {
+        TraceSpan span(traceId, TRACE_DISPLAY_OUTPUT);
+        TraceSpan untraced(0, TRACE_DISPLAY_RECEIVE);
+    }
+    stopTraceWriter();
+
+    ASSERT_TRUE(convertTraceToChrome({ tracePath }, jsonPath));
+    std::ifstream json(jsonPath);
+    std::string contents((std::istreambuf_iterator<char>(json)), std::istreambuf_iterator<char>());
+    EXPECT_NE(contents.find("\"processing.pipeline\""), std::string::npos);
+    EXPECT_NE(contents.find("\"display.output\""), std::string::npos);
+    EXPECT_EQ(contents.find("\"display.receive\""), std::string::npos);
+
+    char encoded[TRACE_ID_SIZE];
+    encodeTraceId(traceId, encoded);
+    EXPECT_EQ(decodeTraceId(encoded), traceId);
+
+    json.close();
+    std::remove(tracePath.c_str());
+    std::remove(jsonPath.c_str());
+}
+
+//  18:    
+TEST(TraceTest, SamplesAtConfiguredRate) {
+    TraceSampler sampler;
+    EXPECT_FALSE(sampler.sample());
+
+    sampler.setRate(1.0);
+    EXPECT_TRUE(sampler.sample());
+
+    sampler.setRate(0.01);
+    int sampled = 0;
+    for (int i = 0; i < 100000; i++) {
+        sampled += sampler.sample() ? 1 : 0;
+    }
+    EXPECT_GT(sampled, 700);
+    EXPECT_LT(sampled, 1300);
+}
+
+#ifndef _WIN32
+//  19:       
+TEST(SpliceRelayTest, KeepsOrderWhenPipeOverflows) {
+    int input[2];
+    int output[2];
+    ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, input), 0);
+    ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, output), 0);
+
+    SpliceRelay relay;
+#ifdef __linux__
+    EXPECT_TRUE(relay.isZeroCopy());
+#endif
+
+    //       ,   
+    //       .
+    std::string expected;
+    for (int i = 0; i < 2000; i++) {
+        std::string header = "<" + std::to_string(i) + ">";
+        std::string payload = "payload " + std::to_string(i);
+        ASSERT_TRUE(relay.append(header.data(), header.size()));
+        ASSERT_EQ(send(input[1], payload.data(), payload.size(), 0), static_cast<ssize_t>(payload.size()));
+        ASSERT_EQ(relay.fill(input[0], payload.size()), static_cast<ssize_t>(payload.size()));
+        expected += header + payload;
+    }
+    EXPECT_EQ(relay.buffered(), expected.size());
+
+    std::thread drainer([&] { EXPECT_TRUE(relay.drainTo(output[1])); close(output[1]); });
+    std::string received;
+    char buffer[4096];
+    for (ssize_t n; (n = recv(output[0], buffer, sizeof(buffer), 0)) > 0;) {
+        received.append(buffer, static_cast<size_t>(n));
+    }
+    drainer.join();
+
+    EXPECT_EQ(received, expected);
+    EXPECT_EQ(relay.buffered(), 0u);
+    close(input[0]);
+    close(input[1]);
+    close(output[0]);
+}
+#endif
+
+//  20:       
+TEST_F(ServerTest, PassthroughRelaysMessagesUnchanged) {
+    ConnectionOptions options;
+    EXPECT_TRUE(ProcessingServer::parseConnectionOptions("passthrough=1", options));
+    EXPECT_TRUE(options.passthrough);
+    EXPECT_FALSE(ProcessingServer::parseConnectionOptions("bogus=1", options));
+
+    Client rejected(TEST_HOST, processingPort);
+    rejected.setConnectionOptions("passthrough=2");
+    EXPECT_FALSE(rejected.connectToServer());
+
+    Client client(TEST_HOST, processingPort);
+    client.setConnectionOptions("passthrough=1");
+    ASSERT_TRUE(client.connectToServer());
+    ASSERT_TRUE(client.sendData("hello hello world"));
+    ASSERT_TRUE(client.receiveAcknowledgement());
+
+    std::vector<std::string> batch;
+    for (int i = 0; i < 500; i++) {
+        batch.push_back("copy copy " + std::to_string(i));
+    }
+    ASSERT_TRUE(client.sendBatch(std::vector<std::string_view>(batch.begin(), batch.end())));
+
+    Client processed(TEST_HOST, processingPort);
+    ASSERT_TRUE(processed.connectToServer());
+    ASSERT_TRUE(processed.sendData("hello hello world"));
+    ASSERT_TRUE(processed.receiveAcknowledgement());
+
+    std::vector<std::string> received = waitForDisplayed(batch.size() + 2);
+    ASSERT_EQ(received.size(), batch.size() + 2);
+    EXPECT_EQ(received.front(), "hello hello world");
+    for (size_t i = 0; i < batch.size(); i++) {
+        EXPECT_EQ(received[i + 1], batch[i]);
+    }
+    EXPECT_EQ(received.back(), "hello world");
+}
+
+#ifndef _WIN32
+//  21:       Unix-  IPv4/IPv6
+TEST(TransportTest, TransfersExactLengthsOverUnixAndTcp) {
+    std::string path = "unix:/tmp/client_server_transport_" + std::to_string(getpid()) + ".sock";
+    std::string payload(1 << 20, '\0');
+    for (size_t i = 0; i < payload.size(); i++) {
+        payload[i] = static_cast<char>(i * 31);
+    }
+
+    std::vector<std::string> hosts = { path, "127.0.0.1" };
+    int tcpListener = transport::listenOn("", 0);
+    ASSERT_GE(tcpListener, 0);
+    sockaddr_storage bound = {};
+    socklen_t boundLength = sizeof(bound);
+    ASSERT_EQ(getsockname(tcpListener, reinterpret_cast<sockaddr*>(&bound), &boundLength), 0);
+    if (bound.ss_family == AF_INET6) {
+        hosts.push_back("::1");
+    }
+
+    for (const std::string& host : hosts) {
+        SCOPED_TRACE(host);
+        bool isUnix = transport::isUnixAddress(host);
+        int listener = isUnix ? transport::listenOn(host, 0) : tcpListener;
+        ASSERT_GE(listener, 0);
+        int port = transport::boundPort(listener);
+        EXPECT_EQ(port == 0, isUnix);
+
+        int client = transport::connectTo(host, port);
+        ASSERT_GE(client, 0);
+        int server = transport::accept(listener);
+        ASSERT_GE(server, 0);
+
+        std::thread sender([&] {
+            std::vector<FrameSlice> slices = { { payload.data(), 3 }, { payload.data() + 3, payload.size() - 3 } };
+            EXPECT_TRUE(transport::sendVector(client, slices));
+            EXPECT_TRUE(transport::sendAll(client, "tail", 4));
+        });
+        std::string received(payload.size(), '\0');
+        EXPECT_TRUE(transport::receiveExact(server, &received[0], received.size()));
+        char tail[4];
+        EXPECT_TRUE(transport::receiveExact(server, tail, sizeof(tail)));
+        sender.join();
+        EXPECT_EQ(received, payload);
+        EXPECT_EQ(std::string(tail, sizeof(tail)), "tail");
+
+        //         .
+        transport::closeSocket(client);
+        EXPECT_FALSE(transport::receiveExact(server, tail, 1));
+        transport::closeSocket(server);
+        if (isUnix) {
+            transport::closeSocket(listener);
+        }
+    }
+    transport::closeSocket(tcpListener);
+    unlink(path.c_str() + sizeof(transport::UNIX_PREFIX) - 1);
+}
+
+//  22:      Unix-
+TEST(TransportTest, FullChainOverUnixSockets) {
+    std::string prefix = "unix:/tmp/client_server_chain_" + std::to_string(getpid());
+    std::string displayPath = prefix + "_display.sock";
+    std::string processingPath = prefix + "_processing.sock";
+
+    std::mutex displayedMutex;
+    std::vector<std::string> displayed;
+    ReadinessLatch displayReady;
+    DisplayServer displayServer(0);
+    displayServer.setListenAddress(displayPath);
+    displayServer.setReadyCallback([&](int port) { displayReady.signal(port); });
+    displayServer.setMessageHandler([&](std::string_view text) {
+        std::lock_guard<std::mutex> lock(displayedMutex);
+        displayed.emplace_back(text);
+    });
+    std::thread displayThread([&] { displayServer.start(); });
+    ASSERT_TRUE(displayReady.waitFor(TEST_READY_TIMEOUT));
+
+    ReadinessLatch processingReady;
+    ProcessingServer processingServer(0, displayPath, 0);
+    processingServer.setListenAddress(processingPath);
+    processingServer.setReadyCallback([&](int port) { processingReady.signal(port); });
+    std::thread processingThread([&] { processingServer.start(); });
+    ASSERT_TRUE(processingReady.waitFor(TEST_READY_TIMEOUT));
+    EXPECT_EQ(processingReady.port(), 0);
+
+    {
+        Client client(processingPath, 0);
+        ASSERT_TRUE(client.connectToServer());
+        EXPECT_TRUE(client.sendData("unix unix socket"));
+        EXPECT_TRUE(client.receiveAcknowledgement());
+    }
+
+    auto deadline = std::chrono::steady_clock::now() + TEST_READY_TIMEOUT;
+    while (std::chrono::steady_clock::now() < deadline) {
+        {
+            std::lock_guard<std::mutex> lock(displayedMutex);
+            if (!displayed.empty()) {
+                break;
+            }
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+
+    processingServer.stop();
+    processingThread.join();
+    displayServer.stop();
+    displayThread.join();
+    unlink(displayPath.c_str() + sizeof(transport::UNIX_PREFIX) - 1);
+    unlink(processingPath.c_str() + sizeof(transport::UNIX_PREFIX) - 1);
+
+    ASSERT_EQ(displayed.size(), 1u);
+    EXPECT_EQ(displayed[0], "unix socket");
+}
+#endif
+
+//  23:       
+TEST(ProcessingServerTest, ParallelDedupMatchesSerial) {
+    const char* vocabulary[] = {
+        "alpha", "Beta", "GAMMA", "delta", "the", "a",
+        "\xD0\x9F\xD1\x80\xD0\xB8\xD0\xB2\xD0\xB5\xD1\x82", "\xD0\xBF\xD1\x80\xD0\xB8\xD0\xB2\xD0\xB5\xD1\x82"
+    };
+    const char* separators[] = { " ", "  ", "\t", "\n", "\xC2\xA0", "\xE3\x80\x80" };
+
+    std::string text;
+    unsigned state = 12345;
+    while (text.size() < 300000) {
+        state = state * 1103515245u + 12345u;
+        text += vocabulary[(state >> 16) % 8];
+        text += std::to_string((state >> 8) % 5000);
+        text += separators[(state >> 4) % 6];
+    }
+
+    for (unsigned stages = 0; stages < PIPELINE_STAGE_COMBINATIONS; stages++) {
+        if (!(stages & PIPELINE_DEDUP)) {
+            continue;
+        }
+        for (bool unicode : { false, true }) {
+            SCOPED_TRACE("stages " + std::to_string(stages) + (unicode ? " unicode" : ""));
+            PipelineConfig serial;
+            serial.stages = stages;
+            serial.unicodeWhitespace = unicode;
+            serial.stopWords = { "the1", "a2", "alpha3" };
+            serial.truncateLimit = 7000;
+            serial.parallelThreshold = 0;
+
+            PipelineConfig parallel = serial;
+            parallel.parallelThreshold = 1;
+            parallel.parallelThreads = 4;
+
+            std::string expected = runPipeline(serial, text);
+            EXPECT_EQ(runPipeline(parallel, text), expected);
+            EXPECT_EQ(runParallelDedupPipeline(parallel, text.substr(0, 1000)), runPipeline(serial, text.substr(0, 1000)));
+        }
+    }
+}
+
+//  24:     top-K    
+TEST(WordFrequencySketchTest, TracksHeavyHittersWhileReadersQuery) {
+    SketchConfig config;
+    config.width = 1024;
+    config.depth = 4;
+    config.topK = 8;
+    WordFrequencySketch sketch(config);
+
+    // Word i occurs 2000 / (i + 1) times: a few heavy words and a long tail.
+    std::vector<std::string> words;
+    std::vector<uint64_t> exact;
+    for (int i = 0; i < 2000; i++) {
+        words.push_back("word" + std::to_string(i) + std::string(i % 70, 'x'));
+        exact.push_back(2000 / (i + 1));
+    }
+
+    std::atomic<bool> writing(true);
+    std::atomic<int> tornReads(0);
+    std::thread reader([&] {
+        while (writing) {
+            for (const WordCount& entry : sketch.top(config.topK)) {
+                if (entry.word.compare(0, 4, "word") != 0 || entry.word.size() > SKETCH_MAX_WORD_LENGTH) {
+                    tornReads++;
+                }
+            }
+        }
+    });
+
+    uint64_t total = 0;
+    for (uint64_t round = 0; round < exact[0]; round++) {
+        for (size_t i = 0; i < words.size() && round < exact[i]; i++) {
+            sketch.add(words[i]);
+            total++;
+        }
+    }
+    writing = false;
+    reader.join();
+
+    EXPECT_EQ(tornReads, 0);
+    EXPECT_EQ(sketch.total(), total);
+    for (size_t i = 0; i < words.size(); i++) {
+        uint64_t estimate = sketch.estimate(words[i]);
+        EXPECT_GE(estimate, exact[i]);
+        EXPECT_LE(estimate, exact[i] + 4 * total / config.width);
+    }
+
+    std::vector<WordCount> top = sketch.top(5);
+    ASSERT_EQ(top.size(), 5u);
+    for (size_t i = 0; i < top.size(); i++) {
+        EXPECT_EQ(top[i].word, words[i]);
+        EXPECT_EQ(top[i].count, sketch.estimate(words[i]));
+    }
+    EXPECT_EQ(sketch.top(100).size(), config.topK);
+    EXPECT_LE(sketch.estimate("missing"), 4 * total / config.width);
+}
+
+//  25:       
+TEST(DisplayServerTest, AnswersWordStatisticsQueries) {
+    ReadinessLatch displayReady;
+    DisplayServer displayServer(0);
+    displayServer.setMessageHandler([](std::string_view) {});
+    displayServer.enableWordStatistics(SketchConfig());
+    displayServer.setQueryAddress(TEST_HOST, 0);
+    displayServer.setReadyCallback([&](int port) { displayReady.signal(port); });
+    std::thread displayThread([&] { displayServer.start(); });
+    ASSERT_TRUE(displayReady.waitFor(TEST_READY_TIMEOUT));
+
+    ReadinessLatch processingReady;
+    ProcessingServer processingServer(0, TEST_HOST, displayReady.port());
+    processingServer.setReadyCallback([&](int port) { processingReady.signal(port); });
+    std::thread processingThread([&] { processingServer.start(); });
+    ASSERT_TRUE(processingReady.waitFor(TEST_READY_TIMEOUT));
+
+    {
+        Client client(TEST_HOST, processingReady.port());
+        ASSERT_TRUE(client.connectToServer());
+        for (const char* message : { "hot cold", "hot warm", "hot warm", "hot" }) {
+            EXPECT_TRUE(client.sendData(message));
+            EXPECT_TRUE(client.receiveAcknowledgement());
+        }
+    }
+
+    auto statistics = displayServer.wordStatistics();
+    ASSERT_TRUE(statistics);
+    auto deadline = std::chrono::steady_clock::now() + TEST_READY_TIMEOUT;
+    while (statistics->total() < 7 && std::chrono::steady_clock::now() < deadline) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+
+    std::string answers;
+    int querySocket = transport::connectTo(TEST_HOST, displayServer.queryPort());
+    ASSERT_NE(querySocket, -1);
+    std::string queries = "TOP 2\nCOUNT warm\nTOTAL\nHOT\n";
+    EXPECT_TRUE(transport::sendAll(querySocket, queries.data(), queries.size()));
+    char buffer[256];
+    while (answers.find("ERROR") == std::string::npos) {
+        ssize_t received = transport::receiveSome(querySocket, buffer, sizeof(buffer));
+        if (received <= 0) {
+            break;
+        }
+        answers.append(buffer, static_cast<size_t>(received));
+    }
+    transport::closeSocket(querySocket);
+
+    processingServer.stop();
+    processingThread.join();
+    displayServer.stop();
+    displayThread.join();
+
+    EXPECT_EQ(answers.substr(0, answers.find("ERROR")), "hot 4\nwarm 2\nEND\nwarm 2\n7\n");
+    EXPECT_EQ(DisplayServer::answerQuery(*statistics, "TOP x"), "ERROR expected TOP [n]\n");
+}
+
+//  26:      
+TEST(FairSchedulerTest, ServesClientsByWeightInOrder) {
+    SchedulerConfig config;
+    config.workerThreads = 1;
+    std::vector<std::string> served;
+    std::mutex servedMutex;
+    std::promise<void> gate;
+    std::shared_future<void> opened = gate.get_future().share();
+    {
+        FairScheduler scheduler(config);
+        uint64_t blocker = scheduler.addClient(PRIORITY_NORMAL);
+        uint64_t bulk = scheduler.addClient(PRIORITY_BULK);
+        uint64_t interactive = scheduler.addClient(PRIORITY_INTERACTIVE);
+
+        // The only worker waits on the gate while both queues fill up.
+        ASSERT_TRUE(scheduler.submit(blocker, 1, [opened]() { opened.wait(); }));
+        for (int i = 0; i < 20; i++) {
+            for (auto [client, name] : { std::pair(bulk, "b"), std::pair(interactive, "i") }) {
+                std::string job = name + std::to_string(i);
+                ASSERT_TRUE(scheduler.submit(client, SCHEDULER_QUANTUM, [&served, &servedMutex, job]() {
+                    std::lock_guard<std::mutex> lock(servedMutex);
+                    served.push_back(job);
+                }));
+            }
+        }
+
+        std::vector<ClientSchedulingStats> queued = scheduler.statistics();
+        ASSERT_EQ(queued.size(), 3u);
+        EXPECT_EQ(queued[1].priority, PRIORITY_BULK);
+        EXPECT_EQ(queued[1].queued, 20u);
+        EXPECT_EQ(queued[2].maxQueued, 20u);
+
+        gate.set_value();
+        scheduler.drain(bulk);
+        scheduler.drain(interactive);
+
+        std::vector<ClientSchedulingStats> finished = scheduler.statistics();
+        EXPECT_EQ(finished[1].completed, 20u);
+        EXPECT_EQ(finished[1].queued, 0u);
+        EXPECT_GE(finished[1].maxWait, finished[2].maxWait);
+        EXPECT_GT(finished[1].averageWait().count(), 0);
+        scheduler.removeClient(blocker);
+    }
+
+    // Bulk and interactive alternate turns of one and eight jobs.
+    ASSERT_EQ(served.size(), 40u);
+    std::vector<std::string> expected = { "b0", "i0", "i1", "i2", "i3", "i4", "i5", "i6", "i7", "b1", "i8" };
+    EXPECT_EQ(std::vector<std::string>(served.begin(), served.begin() + expected.size()), expected);
+    int bulkSeen = 0;
+    int interactiveSeen = 0;
+    for (const std::string& job : served) {
+        int& seen = job[0] == 'b' ? bulkSeen : interactiveSeen;
+        EXPECT_EQ(job.substr(1), std::to_string(seen++));
+    }
+}
+
+//  27:       
+//    
+TEST(FairSchedulerTest, ProcessingServerDeliversEveryClientInOrder) {
+    ConnectionOptions options;
+    EXPECT_TRUE(ProcessingServer::parseConnectionOptions("class=bulk", options));
+    EXPECT_EQ(options.priority, PRIORITY_BULK);
+    EXPECT_FALSE(ProcessingServer::parseConnectionOptions("class=urgent", options));
+    EXPECT_EQ(options.priority, PRIORITY_BULK);
+
+    for (bool async : { false, true }) {
+        SCOPED_TRACE(async ? "async" : "threads");
+        std::mutex displayedMutex;
+        std::vector<std::string> displayed;
+        ReadinessLatch displayReady;
+        DisplayServer displayServer(0);
+        displayServer.setMessageHandler([&](std::string_view text) {
+            std::lock_guard<std::mutex> lock(displayedMutex);
+            displayed.emplace_back(text);
+        });
+        displayServer.setReadyCallback([&](int port) { displayReady.signal(port); });
+        std::thread displayThread([&] { displayServer.start(); });
+        ASSERT_TRUE(displayReady.waitFor(TEST_READY_TIMEOUT));
+
+        SchedulerConfig config;
+        config.workerThreads = 2;
+        config.maxQueueDepth = 4;
+        config.classes[PRIORITY_BULK].rateLimit = 1 << 20;
+        ReadinessLatch processingReady;
+        ProcessingServer processingServer(0, TEST_HOST, displayReady.port());
+        processingServer.setFairScheduling(config);
+        processingServer.setReadyCallback([&](int port) { processingReady.signal(port); });
+        std::thread processingThread([&] {
+            if (async) {
+                processingServer.startAsync(2);
+            } else {
+                processingServer.start();
+            }
+        });
+        ASSERT_TRUE(processingReady.waitFor(TEST_READY_TIMEOUT));
+
+        const int MESSAGES = 300;
+        std::vector<std::thread> clients;
+        std::atomic<int> failures(0);
+        std::atomic<size_t> maxQueued(0);
+        for (std::string name : { "bulk", "interactive", "normal" }) {
+            clients.emplace_back([&, name]() {
+                Client client(TEST_HOST, processingReady.port());
+                client.setConnectionOptions("class=" + name);
+                std::vector<std::string> batch;
+                for (int i = 0; i < MESSAGES; i++) {
+                    batch.push_back(name + " " + name + " " + std::to_string(i));
+                }
+                if (!client.connectToServer() ||
+                    !client.sendBatch(std::vector<std::string_view>(batch.begin(), batch.end())) ||
+                    client.sendData("\xFF") || client.receiveAcknowledgement() ||
+                    !client.sendData(name + " done") || !client.receiveAcknowledgement()) {
+                    failures++;
+                }
+                for (const ClientSchedulingStats& stats : processingServer.schedulingStatistics()) {
+                    if (stats.priority == PRIORITY_BULK) {
+                        maxQueued = std::max(maxQueued.load(), stats.maxQueued);
+                    }
+                }
+            });
+        }
+        for (auto& client : clients) {
+            client.join();
+        }
+
+        auto deadline = std::chrono::steady_clock::now() + TEST_READY_TIMEOUT;
+        while (std::chrono::steady_clock::now() < deadline) {
+            {
+                std::lock_guard<std::mutex> lock(displayedMutex);
+                if (displayed.size() >= 3 * (MESSAGES + 1)) {
+                    break;
+                }
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+
+        processingServer.stop();
+        processingThread.join();
+        displayServer.stop();
+        displayThread.join();
+
+        EXPECT_EQ(failures, 0);
+        EXPECT_LE(maxQueued, config.maxQueueDepth);
+        EXPECT_TRUE(processingServer.schedulingStatistics().empty());
+        ASSERT_EQ(displayed.size(), 3u * (MESSAGES + 1));
+        for (std::string name : { "bulk", "interactive", "normal" }) {
+            int next = 0;
+            for (const std::string& text : displayed) {
+                if (text.compare(0, name.size() + 1, name + " ") != 0) {
+                    continue;
+                }
+                EXPECT_EQ(text, next < MESSAGES ? name + " " + std::to_string(next) : name + " done");
+                next++;
+            }
+            EXPECT_EQ(next, MESSAGES + 1);
+        }
+    }
+}
+
+#ifndef _WIN32
+//  28:        
+TEST_F(ServerTest, RejectsOversizedBatchHeader) {
+    for (uint32_t messageCount : { 0u, static_cast<uint32_t>(MAX_BATCH_MESSAGES) + 1, FRAME_LENGTH_MASK }) {
+        int socket = transport::connectTo(TEST_HOST, processingPort);
+        ASSERT_GE(socket, 0);
+        uint32_t header = htonl(FRAME_FLAG_BATCH | messageCount);
+        ASSERT_TRUE(transport::sendAll(socket, reinterpret_cast<const char*>(&header), sizeof(header)));
+
+        char reply[2];
+        ASSERT_TRUE(transport::receiveExact(socket, reply, sizeof(reply)));
+        EXPECT_EQ(std::string(reply, sizeof(reply)), "NO");
+        EXPECT_FALSE(transport::receiveExact(socket, reply, 1));
+        transport::closeSocket(socket);
+    }
+
+    Client client(TEST_HOST, processingPort);
+    ASSERT_TRUE(client.connectToServer());
+    EXPECT_TRUE(client.sendData("still serving"));
+    EXPECT_TRUE(client.receiveAcknowledgement());
+}
+#endif
+
+//  29:       
+TEST_F(ServerTest, ClientSkipsRejectedInputLines) {
+    const std::string path = "client_rejected_input_test.txt";
+    const int LINES = 1200;
+    {
+        std::ofstream input(path, std::ios::binary);
+        for (int i = 0; i < LINES; i++) {
+            input << (i == 10 || i == 700 ? "bad \xFF line" : "line " + std::to_string(i)) << "\n";
+        }
+    }
+
+    Client client(TEST_HOST, processingPort);
+    EXPECT_TRUE(client.runInput(path));
+    std::remove(path.c_str());
+
+    //     .
+    std::vector<std::string> received = waitForDisplayed(LINES - 2);
+    ASSERT_EQ(received.size(), static_cast<size_t>(LINES - 2));
+    size_t next = 0;
+    for (int i = 0; i < LINES; i++) {
+        if (i != 10 && i != 700) {
+            EXPECT_EQ(received[next++], "line " + std::to_string(i));
+        }
+    }
+}
+
+//  30:        
+TEST(FairSchedulerTest, KeepsClassWeightsWithSeveralWorkers) {
+    SchedulerConfig config;
+    config.workerThreads = 2;
+    config.maxQueueDepth = 100;
+    const int JOBS = 80;
+    std::vector<PriorityClass> served;
+    std::mutex servedMutex;
+    std::promise<void> gate;
+    std::shared_future<void> opened = gate.get_future().share();
+    {
+        FairScheduler scheduler(config);
+        std::vector<uint64_t> blockers;
+        for (size_t i = 0; i < config.workerThreads; i++) {
+            blockers.push_back(scheduler.addClient(PRIORITY_NORMAL));
+            ASSERT_TRUE(scheduler.submit(blockers.back(), 1, [opened]() { opened.wait(); }));
+        }
+
+        // Two clients per class keep both workers busy, so clients are
+        // regularly passed over while their previous job still runs.
+        std::vector<uint64_t> clients;
+        for (PriorityClass priority : { PRIORITY_INTERACTIVE, PRIORITY_BULK, PRIORITY_INTERACTIVE, PRIORITY_BULK }) {
+            clients.push_back(scheduler.addClient(priority));
+        }
+        for (int i = 0; i < JOBS; i++) {
+            for (size_t c = 0; c < clients.size(); c++) {
+                PriorityClass priority = c % 2 == 0 ? PRIORITY_INTERACTIVE : PRIORITY_BULK;
+                ASSERT_TRUE(scheduler.submit(clients[c], SCHEDULER_QUANTUM, [&served, &servedMutex, priority]() {
+                    std::this_thread::sleep_for(std::chrono::microseconds(200));
+                    std::lock_guard<std::mutex> lock(servedMutex);
+                    served.push_back(priority);
+                }));
+            }
+        }
+
+        gate.set_value();
+        for (uint64_t client : clients) {
+            scheduler.removeClient(client);
+        }
+        for (uint64_t blocker : blockers) {
+            scheduler.removeClient(blocker);
+        }
+    }
+
+    // Interactive clients weigh eight times as much as bulk ones, so about
+    // one bulk job runs per eight interactive jobs until those run out.
+    ASSERT_EQ(served.size(), 4u * JOBS);
+    size_t lastInteractive = served.size();
+    while (served[lastInteractive - 1] != PRIORITY_INTERACTIVE) {
+        lastInteractive--;
+    }
+    size_t bulkBefore = std::count(served.begin(), served.begin() + lastInteractive, PRIORITY_BULK);
+    EXPECT_LE(bulkBefore, 2u * JOBS / 4);
+}
+
+//  31:    UTF-8     
+TEST(Utf8Test, VectorValidatorMatchesScalar) {
+    size_t checked = 0;
+    size_t mismatches = 0;
+    std::string firstMismatch;
+    auto compare = [&](const std::string& text, size_t length) {
+        checked++;
+        if (isValidUtf8(text.data(), length) != isValidUtf8Scalar(text.data(), length) && mismatches++ == 0) {
+            for (size_t i = 0; i < length; i++) {
+                firstMismatch += std::to_string(static_cast<unsigned char>(text[i])) + " ";
+            }
+        }
+    };
+
+    // Every two-byte sequence across a 16-byte and a 64-byte block boundary
+    // and at the very end of the input.
+    std::string buffer(80, 'a');
+    for (int first = 0; first < 256; first++) {
+        for (int second = 0; second < 256; second++) {
+            for (size_t offset : { 14u, 15u, 62u, 63u, 78u }) {
+                std::string text = buffer;
+                text[offset] = static_cast<char>(first);
+                text[offset + 1] = static_cast<char>(second);
+                compare(text, text.size());
+            }
+        }
+    }
+
+    // Every lead byte with continuations drawn from the range edges, placed
+    // at every offset, so some sequences are cut off by the end of the input.
+    const unsigned char edges[] = { 0x00, 0x7F, 0x80, 0x8F, 0x90, 0x9F, 0xA0, 0xBF, 0xC0, 0xC2, 0xF4, 0xFF };
+    buffer.assign(96, 'a');
+    size_t offset = 0;
+    for (int lead = 0xC0; lead < 0x100; lead++) {
+        for (unsigned char second : edges) {
+            for (unsigned char third : edges) {
+                for (unsigned char fourth : edges) {
+                    std::string text = buffer;
+                    const unsigned char sequence[] = { static_cast<unsigned char>(lead), second, third, fourth };
+                    for (size_t i = 0; i < 4 && offset + i < text.size(); i++) {
+                        text[offset + i] = static_cast<char>(sequence[i]);
+                    }
+                    compare(text, text.size());
+                    offset = (offset + 1) % text.size();
+                }
+            }
+        }
+    }
+
+    // Random valid text with an occasional corrupted byte, checked at every
+    // prefix length so each length hits every block and tail size.
+    const uint32_t codePoints[] = { 0x41, 0x7F, 0x80, 0x7FF, 0x800, 0xD7FF, 0xE000, 0xFFFD, 0xFFFF, 0x10000, 0x10FFFF };
+    std::mt19937 random(30);
+    for (int round = 0; round < 1500; round++) {
+        std::string text;
+        while (text.size() < 200) {
+            uint32_t codePoint = random() % 4 == 0 ? codePoints[random() % 11] : random() % 0x110000;
+            if (codePoint >= 0xD800 && codePoint <= 0xDFFF) {
+                continue;
+            }
+            if (codePoint < 0x80) {
+                text += static_cast<char>(codePoint);
+            } else if (codePoint < 0x800) {
+                text += static_cast<char>(0xC0 | (codePoint >> 6));
+                text += static_cast<char>(0x80 | (codePoint & 0x3F));
+            } else if (codePoint < 0x10000) {
+                text += static_cast<char>(0xE0 | (codePoint >> 12));
+                text += static_cast<char>(0x80 | ((codePoint >> 6) & 0x3F));
+                text += static_cast<char>(0x80 | (codePoint & 0x3F));
+            } else {
+                text += static_cast<char>(0xF0 | (codePoint >> 18));
+                text += static_cast<char>(0x80 | ((codePoint >> 12) & 0x3F));
+                text += static_cast<char>(0x80 | ((codePoint >> 6) & 0x3F));
+                text += static_cast<char>(0x80 | (codePoint & 0x3F));
+            }
+        }
+        if (round % 2 == 1) {
+            text[random() % text.size()] = static_cast<char>(random() % 256);
+        }
+        for (size_t length = 0; length <= text.size(); length++) {
+            compare(text, length);
+        }
+    }
+
+    EXPECT_GT(checked, 700000u);
+    EXPECT_EQ(mismatches, 0u) << "first mismatch: " << firstMismatch;
+}
+
+#ifndef _WIN32
+//  32:        
+TEST(EventLoopTest, DestroysSuspendedTasks) {
+    int sockets[2];
+    ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, sockets), 0);
+    setNonBlocking(sockets[0]);
+
+    struct Guard {
+        std::atomic<int>& destroyed;
+        ~Guard() { destroyed++; }
+    };
+    std::atomic<int> destroyed{ 0 };
+    {
+        EventLoop loop;
+        for (int i = 0; i < 3; i++) {
+            loop.spawn([](EventLoop& loop, int socket, std::atomic<int>& destroyed) -> Task<void> {
+                Guard guard{ destroyed };
+                char byte;
+                co_await asyncReceiveExact(loop, socket, &byte, 1);
+            }(loop, sockets[0], destroyed));
+        }
+        loop.spawn([](EventLoop& loop) -> Task<void> {
+            loop.stop();
+            co_return;
+        }(loop));
+        loop.run();
+        EXPECT_EQ(destroyed, 0);
+    }
+    EXPECT_EQ(destroyed, 3);
+    close(sockets[0]);
+    close(sockets[1]);
+}
+#endif
+
+#ifndef _WIN32
+//  33:       
+//    ,      
+TEST(ProcessingServerTest, AnswersWhenDisplayServerIsGone) {
+    for (int mode = 0; mode < 4; mode++) {
+        bool async = (mode & 1) != 0;
+        bool passthrough = (mode & 2) != 0;
+        SCOPED_TRACE(std::string(async ? "async" : "threads") + (passthrough ? ", passthrough" : ""));
+        ReadinessLatch displayReady;
+        DisplayServer displayServer(0);
+        displayServer.setMessageHandler([](std::string_view) {});
+        displayServer.setReadyCallback([&](int port) { displayReady.signal(port); });
+        std::thread displayThread([&] { displayServer.start(); });
+        ASSERT_TRUE(displayReady.waitFor(TEST_READY_TIMEOUT));
+
+        ReadinessLatch processingReady;
+        ProcessingServer processingServer(0, TEST_HOST, displayReady.port());
+        processingServer.setPassthrough(passthrough);
+        processingServer.setReadyCallback([&](int port) { processingReady.signal(port); });
+        std::thread processingThread([&] {
+            if (async) {
+                processingServer.startAsync(2);
+            } else {
+                processingServer.start();
+            }
+        });
+        ASSERT_TRUE(processingReady.waitFor(TEST_READY_TIMEOUT));
+
+        Client client(TEST_HOST, processingReady.port());
+        ASSERT_TRUE(client.connectToServer());
+        EXPECT_TRUE(client.sendData("before"));
+
+        displayServer.stop();
+        displayThread.join();
+
+        //    NO,      .
+        auto sent = std::async(std::launch::async, [&client]() {
+            int rejected = 0;
+            for (int i = 0; i < 5; i++) {
+                if (!client.sendData("after")) {
+                    rejected++;
+                }
+            }
+            return rejected;
+        });
+        bool answered = sent.wait_for(std::chrono::seconds(10)) == std::future_status::ready;
+
+        processingServer.stop();
+        processingThread.join();
+
+        EXPECT_TRUE(answered);
+        if (answered) {
+            EXPECT_GT(sent.get(), 0);
+        }
+    }
+}
+#endif
+
+#ifndef _WIN32
+//  34:    ,   
+TEST(SpliceRelayTest, FailsWithoutSignalWhenPeerIsGone) {
+    int input[2];
+    int output[2];
+    ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, input), 0);
+    ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, output), 0);
+
+    SpliceRelay relay;
+    std::string payload(1000, 'x');
+    ASSERT_TRUE(relay.append("<0>", 3));
+    ASSERT_EQ(send(input[1], payload.data(), payload.size(), 0), static_cast<ssize_t>(payload.size()));
+    ASSERT_EQ(relay.fill(input[0], payload.size()), static_cast<ssize_t>(payload.size()));
+
+    //   SIGPIPE splice       .
+    close(output[0]);
+    EXPECT_FALSE(relay.drainTo(output[1]));
+    relay.reset();
+    EXPECT_EQ(relay.buffered(), 0u);
+
+    close(input[0]);
+    close(input[1]);
+    close(output[1]);
+}
+#endif
+
+//  35:     2^32  
+TEST(WordFrequencySketchTest, CountsPastThirtyTwoBits) {
+    SketchConfig config;
+    config.width = 1024;
+    config.topK = 4;
+    WordFrequencySketch sketch(config);
+
+    const uint64_t LIMIT = UINT32_MAX;
+    sketch.add("warm", 1000);
+    sketch.add("hot", LIMIT - 2);
+    for (int i = 0; i < 5; i++) {
+        sketch.add("hot");
+    }
+    EXPECT_EQ(sketch.total(), LIMIT + 1003);
+    EXPECT_GE(sketch.estimate("hot"), LIMIT + 3);
+    EXPECT_LE(sketch.estimate("hot"), LIMIT + 1003);
+    EXPECT_GE(sketch.estimate("warm"), 1000u);
+
+    // ,  "hot"   32 ,   .
+    sketch.add("hotter", LIMIT);
+    sketch.add("hotter", LIMIT);
+    std::vector<WordCount> top = sketch.top(3);
+    ASSERT_EQ(top.size(), 3u);
+    EXPECT_EQ(top[0].word, "hotter");
+    EXPECT_GE(top[0].count, 2 * LIMIT);
+    EXPECT_EQ(top[1].word, "hot");
+    EXPECT_GT(top[1].count, LIMIT);
+    EXPECT_EQ(top[2].word, "warm");
+}
+
+//  36:       
+TEST(DictionaryTest, ForgetsWordsOfUnsentFrames) {
+    WordEncoder encoder;
+    WordTable table;
+    std::string encoded;
+    std::string decoded;
+
+    encoder.encode("alpha beta", encoded);
+    encoder.commit();
+    ASSERT_TRUE(table.decode(encoded.data(), encoded.size(), decoded));
+
+    //    gamma    .
+    encoded.clear();
+    encoder.encode("beta gamma", encoded);
+    encoder.rollback();
+    EXPECT_EQ(encoder.size(), 2u);
+
+    encoded.clear();
+    encoder.encode("gamma delta alpha", encoded);
+    encoder.commit();
+    ASSERT_TRUE(table.decode(encoded.data(), encoded.size(), decoded));
+    EXPECT_EQ(decoded, "gamma delta alpha");
+
+    encoded.clear();
+    encoder.encode("delta gamma beta", encoded);
+    ASSERT_TRUE(table.decode(encoded.data(), encoded.size(), decoded));
+    EXPECT_EQ(decoded, "delta gamma beta");
+    EXPECT_EQ(table.size(), encoder.size());
+}
+
+#ifndef _WIN32
+//  37:      
+TEST_F(ServerTest, BatchAckTellsInvalidFromUndelivered) {
+    int socket = transport::connectTo(TEST_HOST, processingPort);
+    ASSERT_GE(socket, 0);
+    std::vector<uint32_t> dropped;
+    auto sendBatch = [socket, &dropped](std::vector<std::string> messages, uint8_t& status, uint32_t& delivered) {
+        std::string frames;
+        uint32_t header = htonl(FRAME_FLAG_BATCH | static_cast<uint32_t>(messages.size()));
+        frames.append(reinterpret_cast<const char*>(&header), sizeof(header));
+        for (const std::string& message : messages) {
+            uint32_t length = htonl(static_cast<uint32_t>(message.size()));
+            frames.append(reinterpret_cast<const char*>(&length), sizeof(length));
+            frames += message;
+        }
+        char ack[BATCH_ACK_SIZE];
+        if (!transport::sendAll(socket, frames.data(), frames.size()) ||
+            !transport::receiveExact(socket, ack, BATCH_ACK_SIZE) || ack[0] != 'B' || ack[1] != 'A') {
+            return false;
+        }
+        status = static_cast<uint8_t>(ack[2]);
+        std::memcpy(&delivered, ack + 3, sizeof(delivered));
+        delivered = ntohl(delivered);
+        dropped.assign(status == BATCH_INVALID ? messages.size() - delivered : 0, 0);
+        for (uint32_t& index : dropped) {
+            if (!transport::receiveExact(socket, reinterpret_cast<char*>(&index), sizeof(index))) {
+                return false;
+            }
+            index = ntohl(index);
+        }
+        return true;
+    };
+
+    uint8_t status = 0;
+    uint32_t delivered = 0;
+    ASSERT_TRUE(sendBatch({ "one", "two", "three" }, status, delivered));
+    EXPECT_EQ(status, BATCH_DELIVERED);
+    EXPECT_EQ(delivered, 3u);
+
+    ASSERT_TRUE(sendBatch({ "one", "bad \xFF", "three", "", "five" }, status, delivered));
+    EXPECT_EQ(status, BATCH_INVALID);
+    EXPECT_EQ(delivered, 3u);
+    EXPECT_EQ(dropped, std::vector<uint32_t>({ 1, 3 }));
+    std::vector<std::string> received = waitForDisplayed(6);
+    ASSERT_EQ(received.size(), 6u);
+    EXPECT_EQ(received[3], "one");
+    EXPECT_EQ(received[4], "three");
+    EXPECT_EQ(received[5], "five");
+
+    displayServer->stop();
+    display_server_thread.join();
+    //        .
+    for (int attempt = 0; attempt < 5 && status != BATCH_UNDELIVERED; attempt++) {
+        ASSERT_TRUE(sendBatch({ "one", "two" }, status, delivered));
+    }
+    EXPECT_EQ(status, BATCH_UNDELIVERED);
+    EXPECT_EQ(delivered, 0u);
+    transport::closeSocket(socket);
+}
+#endif
+
+//  38:       
+TEST_F(ServerTest, ClientStopsInputWhenDisplayServerIsGone) {
+    const std::string path = "client_undelivered_input_test.txt";
+    const int LINES = 5000;
+    {
+        std::ofstream input(path, std::ios::binary);
+        for (int i = 0; i < LINES; i++) {
+            input << "line " << i << "\n";
+        }
+    }
+
+    displayServer->stop();
+    display_server_thread.join();
+
+    //         .
+    Client client(TEST_HOST, processingPort);
+    auto sent = std::async(std::launch::async, [&client, &path]() { return client.runInput(path); });
+    ASSERT_EQ(sent.wait_for(std::chrono::seconds(10)), std::future_status::ready);
+    EXPECT_FALSE(sent.get());
+    std::remove(path.c_str());
+}
+
+#ifndef _WIN32
+//  39:      
+TEST(TransportTest, FrameHeaderRoundTrip) {
+    int sockets[2];
+    ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, sockets), 0);
+
+    ASSERT_TRUE(transport::sendFrame(sockets[0], FRAME_FLAG_DICTIONARY, "traced", 0x0102030405060708ull));
+    ASSERT_TRUE(transport::sendFrame(sockets[0], 0, "plain"));
+
+    transport::FrameHeader header;
+    ASSERT_TRUE(transport::receiveFrameHeader(sockets[1], header));
+    EXPECT_EQ(header.flags, FRAME_FLAG_DICTIONARY | FRAME_FLAG_TRACE);
+    EXPECT_EQ(header.length, 6u);
+    EXPECT_EQ(header.traceId, 0x0102030405060708ull);
+    std::string payload(header.length, '\0');
+    ASSERT_TRUE(transport::receiveExact(sockets[1], &payload[0], payload.size()));
+    EXPECT_EQ(payload, "traced");
+
+    ASSERT_TRUE(transport::receiveFrameHeader(sockets[1], header));
+    EXPECT_EQ(header.flags, 0u);
+    EXPECT_EQ(header.length, 5u);
+    EXPECT_EQ(header.traceId, 0u);
+
+    //        .
+    char encoded[transport::MAX_FRAME_HEADER_SIZE];
+    ASSERT_EQ(transport::encodeFrameHeader(FRAME_FLAG_BATCH, 42, 0, encoded), sizeof(uint32_t));
+    header = transport::decodeLengthWord(encoded);
+    EXPECT_EQ(header.flags, FRAME_FLAG_BATCH);
+    EXPECT_EQ(header.length, 42u);
+
+    transport::closeSocket(sockets[0]);
+    transport::closeSocket(sockets[1]);
+}
+#endif
+
 int main(int argc, char** argv) {
     ::testing::InitGoogleTest(&argc, argv);
     return RUN_ALL_TESTS();